@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "stb_image.h"
+#include "stb_image_resize.h"
+#include "image_features.h"
+#include "distance.h"
+#include "cpu_dispatch.h"
+#include "rng.h"
+
+#define BENCH_FACE_IMAGES 10 // face/face1.jpg ... face/face10.jpg
+#define BENCH_SEED 20240611u
+
+/**
+ * The median of one benchmark from an earlier run, read by --baseline.
+ */
+struct BaselineResult {
+    std::string name;
+    double median;
+};
+
+/**
+ * Benchmark settings from the command line.
+ */
+struct BenchOptions {
+    const char* data_dir;  // Directory holding face/, input.jpg and image.png
+    const char* filter;    // Only benchmarks whose name contains this, NULL for all
+    int repetitions;       // Timed repetitions; the median is reported
+    double min_seconds;    // Minimum duration of one repetition
+    double warmup_seconds; // Untimed run before the repetitions
+    FILE* save_file;       // Medians written here for a later --baseline, NULL to not save
+    std::vector<BaselineResult> baseline; // Medians each benchmark is compared with
+};
+
+/**
+ * An image file read into memory, with its grayscale decode.
+ */
+struct BenchImage {
+    char name[64];
+    std::vector<unsigned char> bytes;
+    unsigned char* gray;
+    int width;
+    int height;
+};
+
+static volatile unsigned long long bench_sink; // Keeps the results of the kernels alive
+
+/**
+ * Runs a kernel repeatedly and prints its median time per operation and throughput.
+ *
+ * @param options The benchmark settings.
+ * @param name The benchmark name.
+ * @param bytes_per_op The input bytes one operation processes, 0 to omit the bandwidth.
+ * @param images_per_op The images one operation processes, 0 to omit the image rate.
+ * @param op The kernel, run once per call.
+ */
+static void bench_run(const BenchOptions& options, const char* name, double bytes_per_op, double images_per_op,
+                      const std::function<void()>& op) {
+    if (options.filter && !strstr(name, options.filter)) {
+        return;
+    }
+    typedef std::chrono::steady_clock Clock;
+
+    // Warm up, and size one repetition so it lasts at least min_seconds
+    long long iterations = 1;
+    Clock::time_point warmup_end = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.warmup_seconds));
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (long long i = 0; i < iterations; i++) {
+            op();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= options.min_seconds && Clock::now() >= warmup_end) {
+            break;
+        }
+        iterations = seconds > options.min_seconds / 100.0
+            ? (long long)(iterations * options.min_seconds / seconds) + 1
+            : iterations * 10;
+    }
+
+    std::vector<double> ns_per_op(options.repetitions);
+    for (int r = 0; r < options.repetitions; r++) {
+        Clock::time_point start = Clock::now();
+        for (long long i = 0; i < iterations; i++) {
+            op();
+        }
+        ns_per_op[r] = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+    }
+    std::sort(ns_per_op.begin(), ns_per_op.end());
+    double median = ns_per_op[options.repetitions / 2];
+
+    printf("%-40s %14.1f ns/op %8.1f%% spread", name, median,
+           median > 0.0 ? 100.0 * (ns_per_op[options.repetitions - 1] - ns_per_op[0]) / median : 0.0);
+    if (bytes_per_op > 0.0) {
+        printf(" %10.1f MB/s", bytes_per_op / median * 1e9 / 1e6);
+    }
+    if (images_per_op > 0.0) {
+        printf(" %10.1f images/s", images_per_op / median * 1e9);
+    }
+    for (const BaselineResult& result : options.baseline) {
+        if (result.name == name && median > 0.0) {
+            printf(" %8.3fx vs baseline", result.median / median);
+            break;
+        }
+    }
+    printf("\n");
+    if (options.save_file) {
+        fprintf(options.save_file, "%.1f %s\n", median, name);
+    }
+}
+
+/**
+ * Reads the medians saved by --save.
+ *
+ * @param path The file.
+ * @param baseline The output results.
+ * @return Returns true if the file is read, false otherwise.
+ */
+static bool load_baseline(const char* path, std::vector<BaselineResult>& baseline) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        // "<median ns> <name>", the name running to the end of the line
+        char* name = NULL;
+        double median = strtod(line, &name);
+        if (name == line || *name != ' ') {
+            continue;
+        }
+        name++;
+        name[strcspn(name, "\r\n")] = '\0';
+        BaselineResult result;
+        result.name = name;
+        result.median = median;
+        baseline.push_back(result);
+    }
+    fclose(file);
+    return true;
+}
+
+/**
+ * Reads an image file and decodes it to grayscale.
+ *
+ * @param options The benchmark settings.
+ * @param path The path relative to the data directory.
+ * @param image The output image.
+ * @return Returns true if the image is read and decoded, false otherwise.
+ */
+static bool load_bench_image(const BenchOptions& options, const char* path, BenchImage* image) {
+    char full_path[1024];
+    snprintf(full_path, sizeof(full_path), "%s/%s", options.data_dir, path);
+    FILE* file = fopen(full_path, "rb");
+    if (!file) {
+        printf("Failed to open %s!\n", full_path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    image->bytes.resize(length > 0 ? length : 0);
+    bool read = length > 0 && fread(image->bytes.data(), 1, length, file) == (size_t)length;
+    fclose(file);
+    if (!read) {
+        printf("Failed to read %s!\n", full_path);
+        return false;
+    }
+
+    int channels;
+    image->gray = stbi_load_from_memory(image->bytes.data(), (int)length, &image->width, &image->height, &channels, 1);
+    if (!image->gray) {
+        // input.jpg is in fact a WebP file, which stb_image cannot decode
+        printf("Skipping %s: %s\n", full_path, stbi_failure_reason());
+        return false;
+    }
+    snprintf(image->name, sizeof(image->name), "%s", path);
+    return true;
+}
+
+/**
+ * Prints the command line usage.
+ *
+ * @param program The name of the executable.
+ */
+static void print_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --data <dir>        Directory holding face/, input.jpg and image.png (default .)\n");
+    printf("  --filter <text>     Only run benchmarks whose name contains this\n");
+    printf("  --reps <n>          Timed repetitions, the median is reported (default 7)\n");
+    printf("  --min-time <s>      Minimum duration of one repetition (default 0.05)\n");
+    printf("  --warmup <s>        Untimed warmup per benchmark (default 0.1)\n");
+    printf("  --quick             One short repetition per benchmark, to check they all run\n");
+    printf("  --save <file>       Write the medians to a file, for a later --baseline\n");
+    printf("  --baseline <file>   Report the speedup of every benchmark over the medians saved in a file\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    options.data_dir = ".";
+    options.filter = NULL;
+    options.repetitions = 7;
+    options.min_seconds = 0.05;
+    options.warmup_seconds = 0.1;
+    options.save_file = NULL;
+    const char* save_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--data") == 0 && has_value) {
+            options.data_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            options.filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--reps") == 0 && has_value) {
+            options.repetitions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--min-time") == 0 && has_value) {
+            options.min_seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            options.warmup_seconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--quick") == 0) {
+            options.repetitions = 1;
+            options.min_seconds = 0.001;
+            options.warmup_seconds = 0.0;
+        }
+        else if (strcmp(argv[i], "--save") == 0 && has_value) {
+            save_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            if (!load_baseline(argv[++i], options.baseline)) {
+                printf("Failed to read baseline %s!\n", argv[i]);
+                return -1;
+            }
+        }
+        else {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (options.repetitions < 1) {
+        options.repetitions = 1;
+    }
+
+    // The bundled images, and synthetic frames of common camera sizes
+    std::vector<BenchImage> images;
+    for (int i = 0; i < BENCH_FACE_IMAGES + 2; i++) {
+        char path[64];
+        if (i < BENCH_FACE_IMAGES) {
+            snprintf(path, sizeof(path), "face/face%d.jpg", i + 1);
+        }
+        else {
+            snprintf(path, sizeof(path), "%s", i == BENCH_FACE_IMAGES ? "input.jpg" : "image.png");
+        }
+        BenchImage image;
+        if (load_bench_image(options, path, &image)) {
+            images.push_back(image);
+        }
+    }
+    if (images.size() < 2) {
+        printf("The benchmarks need at least two of the bundled images; run from the directory holding face/ or pass --data.\n");
+        return -1;
+    }
+
+    const int synthetic_sizes[][2] = { { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    const int synthetic_count = sizeof(synthetic_sizes) / sizeof(synthetic_sizes[0]);
+    std::vector<std::vector<unsigned char>> synthetic(synthetic_count);
+    Rng rng;
+    rng_seed(&rng, BENCH_SEED);
+    for (int s = 0; s < synthetic_count; s++) {
+        // Smooth gradients plus noise, so the resize and filters see realistic values
+        int width = synthetic_sizes[s][0];
+        int height = synthetic_sizes[s][1];
+        synthetic[s].resize((size_t)width * height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                int value = (x * 255 / width + y * 255 / height) / 2 + (int)(rng_next_u64(&rng) % 32) - 16;
+                synthetic[s][(size_t)y * width + x] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+        }
+    }
+
+    if (save_path) {
+        options.save_file = fopen(save_path, "w");
+        if (!options.save_file) {
+            printf("Failed to create %s!\n", save_path);
+            return -1;
+        }
+    }
+
+    printf("Kernels: %s (detected %s)\n", cpu_level_name(cpu_level()), cpu_level_name(cpu_detect()));
+    printf("%-40s %14s\n", "Benchmark", "Median");
+    char name[128];
+
+    // Decode: the whole file to grayscale, as process_image() does
+    for (const BenchImage& image : images) {
+        snprintf(name, sizeof(name), "decode/%s", image.name);
+        bench_run(options, name, (double)image.bytes.size(), 1.0, [&]() {
+            int width, height, channels;
+            unsigned char* gray = stbi_load_from_memory(image.bytes.data(), (int)image.bytes.size(), &width, &height, &channels, 1);
+            bench_sink += gray ? gray[0] : 0;
+            stbi_image_free(gray);
+        });
+    }
+
+    // Resize to SIZE x SIZE
+    unsigned char resized[SIZE * SIZE];
+    for (const BenchImage& image : images) {
+        snprintf(name, sizeof(name), "resize/%s %dx%d", image.name, image.width, image.height);
+        bench_run(options, name, (double)image.width * image.height, 1.0, [&]() {
+            stbir_resize_uint8(image.gray, image.width, image.height, 0, resized, SIZE, SIZE, 0, 1);
+            bench_sink += resized[0];
+        });
+    }
+    for (int s = 0; s < synthetic_count; s++) {
+        int width = synthetic_sizes[s][0];
+        int height = synthetic_sizes[s][1];
+        snprintf(name, sizeof(name), "resize/synthetic %dx%d", width, height);
+        bench_run(options, name, (double)width * height, 1.0, [&]() {
+            stbir_resize_uint8(synthetic[s].data(), width, height, 0, resized, SIZE, SIZE, 0, 1);
+            bench_sink += resized[0];
+        });
+    }
+
+    // Convolution: the four filters of one SIZE x SIZE image, then one filter over whole frames
+    stbir_resize_uint8(images[0].gray, images[0].width, images[0].height, 0, resized, SIZE, SIZE, 0, 1);
+    unsigned char planes[4][SIZE * SIZE];
+    bench_run(options, "convolution/4 filters 64x64", 4.0 * SIZE * SIZE, 1.0, [&]() {
+        convolution(resized, SIZE, SIZE, filter_horizontal, FILTER_SIZE, planes[0]);
+        convolution(resized, SIZE, SIZE, filter_vertical, FILTER_SIZE, planes[1]);
+        convolution(resized, SIZE, SIZE, filter_45, FILTER_SIZE, planes[2]);
+        convolution(resized, SIZE, SIZE, filter_minus_45, FILTER_SIZE, planes[3]);
+        bench_sink += planes[0][SIZE + 2] + planes[3][SIZE + 2];
+    });
+    for (int s = 0; s < synthetic_count; s++) {
+        int width = synthetic_sizes[s][0];
+        int height = synthetic_sizes[s][1];
+        std::vector<unsigned char> output((size_t)width * height);
+        snprintf(name, sizeof(name), "convolution/synthetic %dx%d", width, height);
+        bench_run(options, name, (double)width * height, 0.0, [&]() {
+            convolution(synthetic[s].data(), width, height, filter_45, FILTER_SIZE, output.data());
+            bench_sink += output[(size_t)width * 2 + 2];
+        });
+    }
+
+    // Distance between two gradient planes, as the training scan does 4 times per image
+    unsigned char other[SIZE * SIZE];
+    stbir_resize_uint8(images[1].gray, images[1].width, images[1].height, 0, resized, SIZE, SIZE, 0, 1);
+    convolution(resized, SIZE, SIZE, filter_horizontal, FILTER_SIZE, other);
+    bench_run(options, "compare_images/64x64", 2.0 * SIZE * SIZE, 0.0, [&]() {
+        bench_sink += (unsigned long long)compare_images(planes[0], other);
+    });
+
+    // The dispatched kernels at every level the processor supports
+    CpuLevel selected = cpu_level();
+    std::vector<unsigned char> entries(2 * 4 * SIZE * SIZE);
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i] = (unsigned char)rng_next_u64(&rng);
+    }
+    for (int level = 0; level < CPU_LEVEL_COUNT; level++) {
+        if (!cpu_set_level((CpuLevel)level)) {
+            continue;
+        }
+        snprintf(name, sizeof(name), "dispatch/convolution 64x64 %s", cpu_level_name((CpuLevel)level));
+        bench_run(options, name, (double)SIZE * SIZE, 0.0, [&]() {
+            convolution(resized, SIZE, SIZE, filter_45, FILTER_SIZE, planes[2]);
+            bench_sink += planes[2][SIZE + 2];
+        });
+        snprintf(name, sizeof(name), "dispatch/squared distance 16K %s", cpu_level_name((CpuLevel)level));
+        bench_run(options, name, 2.0 * 4 * SIZE * SIZE, 0.0, [&]() {
+            bench_sink += squared_distance_u8(entries.data(), entries.data() + 4 * SIZE * SIZE, 4 * SIZE * SIZE);
+        });
+        snprintf(name, sizeof(name), "dispatch/absolute distance 16K %s", cpu_level_name((CpuLevel)level));
+        bench_run(options, name, 2.0 * 4 * SIZE * SIZE, 0.0, [&]() {
+            bench_sink += absolute_distance_u8(entries.data(), entries.data() + 4 * SIZE * SIZE, 4 * SIZE * SIZE);
+        });
+    }
+    cpu_set_level(selected);
+
+    // The whole feature extraction of process_image(), decode included
+    for (const BenchImage& image : images) {
+        snprintf(name, sizeof(name), "pipeline/%s", image.name);
+        bench_run(options, name, (double)image.bytes.size(), 1.0, [&]() {
+            int width, height, channels;
+            unsigned char* gray = stbi_load_from_memory(image.bytes.data(), (int)image.bytes.size(), &width, &height, &channels, 1);
+            extract_gradients(gray, width, height, width, planes[0], planes[1], planes[2], planes[3]);
+            bench_sink += planes[0][SIZE + 2];
+            stbi_image_free(gray);
+        });
+    }
+
+    for (BenchImage& image : images) {
+        stbi_image_free(image.gray);
+    }
+    if (options.save_file) {
+        fclose(options.save_file);
+    }
+    return 0;
+}
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define LOAD_HAS_RUSAGE
+#endif
+
+#include "stb_image.h"
+#include "image_features.h"
+#include "gallery.h"
+#include "parallel.h"
+#include "stage_timer.h"
+#include "mem_stats.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "cpu_dispatch.h"
+#include "rng.h"
+
+#define LOAD_FACE_IMAGES 10      // face/face1.jpg ... face/face10.jpg
+#define LOAD_BASE_VARIANTS 256   // Distinct perturbed extractions the synthetic entries are derived from
+#define LOAD_SEED 20240611u
+
+/**
+ * Load test settings from the command line.
+ */
+struct LoadOptions {
+    const char* data_dir;   // Directory holding face/ and image.png
+    int gallery_size;       // Synthetic entries, plus the enrolled corpus
+    double qps;             // Open-loop request rate, 0 for closed loop
+    int concurrency;        // Closed-loop clients, or open-loop workers
+    double duration;        // Seconds of load
+    int cascade_top_m;      // 0 for the exact scan, otherwise the survivors of the coarse stage
+    int threads;            // Threads of the parallel scans, 0 for all cores
+    double max_gallery_mb;  // Refuse galleries larger than this
+    bool stats;             // Print the per-stage latency histograms
+    const char* trace_path; // Chrome trace JSON of the load, NULL when not tracing
+    bool perf;              // Count cycles, instructions and misses around the kernels
+};
+
+/**
+ * An image of the replayed corpus, kept encoded so every request decodes it again.
+ */
+struct CorpusImage {
+    char path[64];
+    std::vector<unsigned char> bytes;
+    int entry; // Gallery index it was enrolled as
+};
+
+/**
+ * Latencies and outcomes collected by one worker.
+ */
+struct WorkerResult {
+    std::vector<double> latencies_ms;
+    long long self_matches; // Requests whose best match is the entry their image was enrolled as
+    long long failures;
+};
+
+/**
+ * Reads a file into memory.
+ *
+ * @param path The path of the file.
+ * @param bytes The output bytes.
+ * @return Returns true if the file is read, false otherwise.
+ */
+static bool read_file(const char* path, std::vector<unsigned char>& bytes) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    bytes.resize(length > 0 ? length : 0);
+    bool read = length > 0 && fread(bytes.data(), 1, length, file) == (size_t)length;
+    fclose(file);
+    return read;
+}
+
+/**
+ * Extracts the packed entry of a randomly perturbed face: a random crop (85-100% of the side),
+ * contrast and brightness changes, and Gaussian pixel noise.
+ *
+ * @param gray The grayscale face.
+ * @param width The width of the face.
+ * @param height The height of the face.
+ * @param rng The random generator.
+ * @param entry The output array of GALLERY_ENTRY_SIZE bytes.
+ */
+static void perturbed_entry(const unsigned char* gray, int width, int height, Rng* rng, unsigned char* entry) {
+    double scale = 0.85 + 0.15 * rng_next_uniform(rng);
+    int crop_width = (int)(width * scale);
+    int crop_height = (int)(height * scale);
+    int left = (int)((width - crop_width) * rng_next_uniform(rng));
+    int top = (int)((height - crop_height) * rng_next_uniform(rng));
+    double contrast = 0.8 + 0.4 * rng_next_uniform(rng);
+    double brightness = 40.0 * rng_next_uniform(rng) - 20.0;
+
+    std::vector<unsigned char> crop((size_t)crop_width * crop_height);
+    for (int y = 0; y < crop_height; y++) {
+        for (int x = 0; x < crop_width; x++) {
+            double value = gray[(size_t)(top + y) * width + left + x] * contrast + brightness + 4.0 * rng_next_gaussian(rng);
+            crop[(size_t)y * crop_width + x] = (unsigned char)(value < 0.0 ? 0.0 : value > 255.0 ? 255.0 : value + 0.5);
+        }
+    }
+    unsigned char grad[4][SIZE * SIZE];
+    unsigned char coarse[COARSE_ENTRY_SIZE];
+    extract_gradients(crop.data(), crop_width, crop_height, crop_width, grad[0], grad[1], grad[2], grad[3]);
+    gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+}
+
+/**
+ * Fills the gallery with synthetic entries: perturbed extractions of the faces, each reused
+ * many times with a little noise on every gradient byte, so no two entries are equal.
+ *
+ * @param gallery The gallery.
+ * @param faces The decoded faces.
+ * @param widths The widths of the faces.
+ * @param heights The heights of the faces.
+ * @param face_count The number of faces.
+ * @param count The number of entries to add.
+ */
+static void fill_synthetic_gallery(Gallery* gallery, unsigned char** faces, const int* widths, const int* heights,
+                                   int face_count, int count) {
+    Rng rng;
+    rng_seed(&rng, LOAD_SEED);
+    int variant_count = count < LOAD_BASE_VARIANTS ? count : LOAD_BASE_VARIANTS;
+    std::vector<unsigned char> variants((size_t)variant_count * GALLERY_ENTRY_SIZE);
+    for (int v = 0; v < variant_count; v++) {
+        int face = v % face_count;
+        perturbed_entry(faces[face], widths[face], heights[face], &rng, variants.data() + (size_t)v * GALLERY_ENTRY_SIZE);
+    }
+
+    std::vector<unsigned char> entry(GALLERY_ENTRY_SIZE);
+    for (int i = 0; i < count; i++) {
+        const unsigned char* variant = variants.data() + (size_t)(i % variant_count) * GALLERY_ENTRY_SIZE;
+        for (int b = 0; b < GALLERY_ENTRY_SIZE; b += 8) {
+            // -3..+4 on every byte, eight bytes per random draw
+            uint64_t noise = rng_next_u64(&rng);
+            for (int k = 0; k < 8; k++, noise >>= 8) {
+                int value = variant[b + k] + (int)(noise & 7) - 3;
+                entry[b + k] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+        }
+        const unsigned char* planes = entry.data();
+        gallery_add(gallery, planes, planes + GALLERY_PLANE_SIZE, planes + 2 * GALLERY_PLANE_SIZE, planes + 3 * GALLERY_PLANE_SIZE);
+    }
+}
+
+/**
+ * Runs one request: decodes a corpus image, extracts its features and searches the gallery.
+ *
+ * @param options The load test settings.
+ * @param gallery The gallery.
+ * @param image The corpus image.
+ * @param result The worker's results, updated with the outcome.
+ */
+static void run_request(const LoadOptions& options, const Gallery* gallery, const CorpusImage& image, WorkerResult* result) {
+    int width, height, channels;
+    PerfSample counters;
+    perf_begin(&counters);
+    long long start = stage_now();
+    unsigned char* gray = stbi_load_from_memory(image.bytes.data(), (int)image.bytes.size(), &width, &height, &channels, 1);
+    stage_record(STAGE_DECODE, start);
+    perf_end(PERF_DECODE, &counters, gray ? (unsigned long long)width * height : 0);
+    if (!gray) {
+        result->failures++;
+        return;
+    }
+    unsigned char grad[4][SIZE * SIZE];
+    unsigned char entry[GALLERY_ENTRY_SIZE];
+    unsigned char coarse[COARSE_ENTRY_SIZE];
+    extract_gradients(gray, width, height, width, grad[0], grad[1], grad[2], grad[3]);
+    stbi_image_free(gray);
+    gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+
+    GalleryMatch match;
+    start = stage_now();
+    int found = options.cascade_top_m > 0
+        ? gallery_search_cascade(gallery, entry, coarse, options.cascade_top_m, 1, &match)
+        : gallery_search_exact(gallery, entry, 1, &match);
+    stage_record(STAGE_MATCH, start);
+    if (found == 1 && match.index == image.entry) {
+        result->self_matches++;
+    }
+}
+
+/**
+ * Returns the process CPU time so far.
+ *
+ * @return Returns user plus system seconds, or a negative value where unavailable.
+ */
+static double cpu_seconds() {
+#ifdef LOAD_HAS_RUSAGE
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#else
+    return -1.0;
+#endif
+}
+
+/**
+ * Returns a percentile of sorted latencies (nearest rank).
+ *
+ * @param sorted The latencies, in increasing order.
+ * @param quantile The quantile, in [0, 1].
+ * @return Returns the latency.
+ */
+static double percentile(const std::vector<double>& sorted, double quantile) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)(quantile * sorted.size() + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * Prints the command line usage.
+ *
+ * @param program The name of the executable.
+ */
+static void print_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --data <dir>          Directory holding face/ and image.png (default .)\n");
+    printf("  --gallery <n>         Synthetic gallery entries generated from the faces (default 10000)\n");
+    printf("  --qps <rate>          Open loop: issue requests at this rate (default: closed loop)\n");
+    printf("  --concurrency <n>     Closed-loop clients, or open-loop workers (default 1)\n");
+    printf("  --duration <s>        Seconds of load (default 10)\n");
+    printf("  --cascade <m>         Coarse scan, then exact re-rank of the best m, instead of the exact scan\n");
+    printf("  --threads <n>         Threads of the parallel gallery scans (default: all cores)\n");
+    printf("  --max-gallery-mb <n>  Refuse galleries larger than this (default 8192)\n");
+    printf("  --stats               Print per-stage latency percentiles and memory\n");
+    printf("  --trace <file>        Write the stage spans of every thread as Chrome trace JSON\n");
+    printf("  --perf                Print IPC and misses per pixel or gallery byte of each kernel (Linux)\n");
+}
+
+int main(int argc, char** argv) {
+    LoadOptions options;
+    options.data_dir = ".";
+    options.gallery_size = 10000;
+    options.qps = 0.0;
+    options.concurrency = 1;
+    options.duration = 10.0;
+    options.cascade_top_m = 0;
+    options.threads = 0;
+    options.max_gallery_mb = 8192.0;
+    options.stats = false;
+    options.trace_path = NULL;
+    options.perf = false;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--data") == 0 && has_value) {
+            options.data_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--gallery") == 0 && has_value) {
+            options.gallery_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--qps") == 0 && has_value) {
+            options.qps = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--concurrency") == 0 && has_value) {
+            options.concurrency = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duration") == 0 && has_value) {
+            options.duration = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cascade") == 0 && has_value) {
+            options.cascade_top_m = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-gallery-mb") == 0 && has_value) {
+            options.max_gallery_mb = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            options.stats = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            options.trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--perf") == 0) {
+            options.perf = true;
+        }
+        else {
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (options.gallery_size < 0 || options.concurrency < 1 || options.duration <= 0.0 || options.qps < 0.0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    if (options.threads > 0) {
+        parallel_set_threads(options.threads);
+    }
+
+    // The corpus: every bundled image stb_image can decode (input.jpg is WebP and is skipped)
+    std::vector<CorpusImage> corpus;
+    for (int i = 0; i < LOAD_FACE_IMAGES + 1; i++) {
+        CorpusImage image;
+        if (i < LOAD_FACE_IMAGES) {
+            snprintf(image.path, sizeof(image.path), "face/face%d.jpg", i + 1);
+        }
+        else {
+            snprintf(image.path, sizeof(image.path), "image.png");
+        }
+        char full_path[1024];
+        snprintf(full_path, sizeof(full_path), "%s/%s", options.data_dir, image.path);
+        if (!read_file(full_path, image.bytes)) {
+            printf("Failed to read %s!\n", full_path);
+            return -1;
+        }
+        corpus.push_back(image);
+    }
+
+    int total = options.gallery_size + (int)corpus.size();
+    double gallery_mb = (double)total * (GALLERY_ENTRY_SIZE + COARSE_ENTRY_SIZE) / 1048576.0;
+    if (gallery_mb > options.max_gallery_mb) {
+        printf("A gallery of %d entries needs %.0f MB (%d bytes per entry), more than --max-gallery-mb %.0f.\n",
+               total, gallery_mb, GALLERY_ENTRY_SIZE + COARSE_ENTRY_SIZE, options.max_gallery_mb);
+        return -1;
+    }
+
+    // Synthetic entries first, then the corpus is enrolled through the real decode and extraction
+    typedef std::chrono::steady_clock Clock;
+    Gallery gallery;
+    if (!gallery_init(&gallery, total)) {
+        printf("Failed to allocate a gallery of %d entries (%.0f MB)!\n", total, gallery_mb);
+        return -1;
+    }
+    unsigned char* faces[LOAD_FACE_IMAGES];
+    int widths[LOAD_FACE_IMAGES];
+    int heights[LOAD_FACE_IMAGES];
+    for (int f = 0; f < LOAD_FACE_IMAGES; f++) {
+        int channels;
+        faces[f] = stbi_load_from_memory(corpus[f].bytes.data(), (int)corpus[f].bytes.size(), &widths[f], &heights[f], &channels, 1);
+        if (!faces[f]) {
+            printf("Failed to decode %s!\n", corpus[f].path);
+            return -1;
+        }
+    }
+    Clock::time_point start = Clock::now();
+    fill_synthetic_gallery(&gallery, faces, widths, heights, LOAD_FACE_IMAGES, options.gallery_size);
+    double generate_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (int f = 0; f < LOAD_FACE_IMAGES; f++) {
+        stbi_image_free(faces[f]);
+    }
+
+    start = Clock::now();
+    for (CorpusImage& image : corpus) {
+        int width, height, channels;
+        unsigned char* gray = stbi_load_from_memory(image.bytes.data(), (int)image.bytes.size(), &width, &height, &channels, 1);
+        if (!gray) {
+            printf("Failed to decode %s!\n", image.path);
+            return -1;
+        }
+        unsigned char grad[4][SIZE * SIZE];
+        extract_gradients(gray, width, height, width, grad[0], grad[1], grad[2], grad[3]);
+        stbi_image_free(gray);
+        image.entry = gallery_add(&gallery, grad[0], grad[1], grad[2], grad[3]);
+    }
+    double enroll_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("Gallery: %d entries (%.0f MB), %d synthetic generated in %.2f s, %d enrolled at %.1f images/s\n",
+           gallery.count, gallery_mb, options.gallery_size, generate_seconds, (int)corpus.size(),
+           enroll_seconds > 0.0 ? corpus.size() / enroll_seconds : 0.0);
+    printf("Kernels: %s (detected %s)\n", cpu_level_name(cpu_level()), cpu_level_name(cpu_detect()));
+    if (options.qps > 0.0) {
+        printf("Load: open loop at %.1f requests/s, %d workers, %.0f s, %s scan\n", options.qps, options.concurrency,
+               options.duration, options.cascade_top_m > 0 ? "cascade" : "exact");
+    }
+    else {
+        printf("Load: closed loop with %d clients, %.0f s, %s scan\n", options.concurrency, options.duration,
+               options.cascade_top_m > 0 ? "cascade" : "exact");
+    }
+
+    std::vector<WorkerResult> results(options.concurrency);
+    for (WorkerResult& result : results) {
+        result.self_matches = 0;
+        result.failures = 0;
+    }
+    std::atomic<long long> next_image(0);
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Clock::time_point> scheduled; // Open loop: issue times of the requests waiting for a worker
+    bool done = false;
+
+    stage_reset(); // Only the load itself goes into the stage histograms, memory peaks and the trace
+    mem_reset_peaks();
+    trace_enable(options.trace_path != NULL);
+    if (options.perf && !perf_counters_enable()) {
+        printf("Hardware counters unavailable: %s\n", perf_counters_error());
+    }
+    double cpu_start = cpu_seconds();
+    start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration));
+    std::vector<std::thread> workers;
+    for (int w = 0; w < options.concurrency; w++) {
+        workers.push_back(std::thread([&, w]() {
+            char name[32];
+            snprintf(name, sizeof(name), "client %d", w);
+            trace_set_thread_name(name);
+            WorkerResult* result = &results[w];
+            for (;;) {
+                Clock::time_point issued;
+                if (options.qps > 0.0) {
+                    // Latency counts from the scheduled issue time, so queueing behind slow requests shows up
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&] { return !scheduled.empty() || done; });
+                    if (scheduled.empty()) {
+                        return;
+                    }
+                    issued = scheduled.front();
+                    scheduled.pop_front();
+                }
+                else {
+                    issued = Clock::now();
+                    if (issued >= deadline) {
+                        return;
+                    }
+                }
+                const CorpusImage& image = corpus[next_image++ % corpus.size()];
+                run_request(options, &gallery, image, result);
+                result->latencies_ms.push_back(std::chrono::duration<double, std::milli>(Clock::now() - issued).count());
+            }
+        }));
+    }
+    if (options.qps > 0.0) {
+        // Requests are issued on a fixed schedule whether or not the workers keep up
+        long long issued = 0;
+        for (;;) {
+            Clock::time_point due = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(issued / options.qps));
+            if (due >= deadline) {
+                break;
+            }
+            std::this_thread::sleep_until(due);
+            std::lock_guard<std::mutex> lock(mutex);
+            scheduled.push_back(due);
+            changed.notify_one();
+            issued++;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        changed.notify_all();
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double cpu_used = cpu_seconds() - cpu_start;
+
+    std::vector<double> latencies;
+    long long self_matches = 0;
+    long long failures = 0;
+    for (const WorkerResult& result : results) {
+        latencies.insert(latencies.end(), result.latencies_ms.begin(), result.latencies_ms.end());
+        self_matches += result.self_matches;
+        failures += result.failures;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    printf("Requests: %lld in %.2f s, %.1f requests/s", (long long)latencies.size(), seconds,
+           seconds > 0.0 ? latencies.size() / seconds : 0.0);
+    if (options.qps > 0.0) {
+        printf(" (%.0f%% of the target)", seconds > 0.0 ? 100.0 * latencies.size() / seconds / options.qps : 0.0);
+    }
+    printf(", %lld matched their enrolled image, %lld failed\n", self_matches, failures);
+    printf("Latency ms: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", percentile(latencies, 0.50),
+           percentile(latencies, 0.90), percentile(latencies, 0.99), percentile(latencies, 0.999),
+           latencies.empty() ? 0.0 : latencies.back());
+    if (cpu_used >= 0.0) {
+        int cores = (int)std::thread::hardware_concurrency();
+        printf("CPU: %.2f s, %.0f%% of one core, %.0f%% of %d cores; peak RSS %.1f MB\n", cpu_used,
+               100.0 * cpu_used / seconds, 100.0 * cpu_used / seconds / (cores > 0 ? cores : 1), cores > 0 ? cores : 1,
+               mem_peak_rss() / 1048576.0);
+    }
+    if (options.stats) {
+        printf("\n");
+        stage_report(stdout);
+        printf("\n");
+        mem_report(stdout);
+    }
+    if (options.perf) {
+        printf("\n");
+        perf_report(stdout);
+    }
+    if (options.trace_path) {
+        trace_enable(false);
+        if (!trace_write(options.trace_path)) {
+            printf("Failed to write trace %s\n", options.trace_path);
+        }
+    }
+
+    gallery_free(&gallery);
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include "binary_hash.h"
+#include "cpu_dispatch.h"
+#include "rng.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+/**
+ * Average-pools a gradient plane into a grid x grid array of cells.
+ *
+ * @param plane The gradient plane.
+ * @param size The width and height of the plane.
+ * @param grid The number of cells per axis, must divide size.
+ * @param pooled The output array of grid*grid cell means.
+ */
+static void pool_plane(const unsigned char* plane, int size, int grid, float* pooled) {
+    int cell = size / grid;
+    float inv_area = 1.0f / (float)(cell * cell);
+
+    for (int gy = 0; gy < grid; gy++) {
+        for (int gx = 0; gx < grid; gx++) {
+            int sum = 0;
+            for (int y = gy * cell; y < (gy + 1) * cell; y++) {
+                const unsigned char* row = plane + y * size + gx * cell;
+                for (int x = 0; x < cell; x++) {
+                    sum += row[x];
+                }
+            }
+            pooled[gy * grid + gx] = sum * inv_area;
+        }
+    }
+}
+
+bool hash_bits_supported(HashMethod method, int bits) {
+    if (bits <= 0 || bits > HASH_MAX_BITS || bits % 64 != 0) {
+        return false;
+    }
+    if (method == HASH_METHOD_POOLED) {
+        // One bit per cell: 4 planes of g x g cells with g a divisor of the plane size
+        return bits == 4 * 4 * 4 || bits == 4 * 8 * 8 || bits == 4 * 16 * 16;
+    }
+    return true;
+}
+
+bool compute_binary_hash(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                         const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                         HashMethod method, int bits, uint64_t seed, uint64_t* code) {
+    if (!hash_bits_supported(method, bits) || size % HASH_GRID != 0) {
+        return false;
+    }
+
+    const unsigned char* planes[4] = { grad_horizontal, grad_vertical, grad_45, grad_minus_45 };
+    float pooled[HASH_POOLED_SIZE];
+    memset(code, 0, hash_words(bits) * sizeof(uint64_t));
+
+    if (method == HASH_METHOD_POOLED) {
+        int grid = 4;
+        while (4 * grid * grid < bits) {
+            grid *= 2;
+        }
+        int cells = grid * grid;
+        float sorted[HASH_GRID * HASH_GRID];
+
+        for (int p = 0; p < 4; p++) {
+            float* plane_pooled = pooled + p * cells;
+            pool_plane(planes[p], size, grid, plane_pooled);
+
+            // Threshold each cell against the plane's median so every plane contributes balanced bits
+            memcpy(sorted, plane_pooled, cells * sizeof(float));
+            std::nth_element(sorted, sorted + cells / 2, sorted + cells);
+            float median = sorted[cells / 2];
+
+            for (int i = 0; i < cells; i++) {
+                if (plane_pooled[i] > median) {
+                    int bit = p * cells + i;
+                    code[bit >> 6] |= 1ULL << (bit & 63);
+                }
+            }
+        }
+        return true;
+    }
+
+    // LSH: centre every pooled plane on its own mean, then keep the sign of random +/-1 projections
+    const int cells = HASH_GRID * HASH_GRID;
+    for (int p = 0; p < 4; p++) {
+        float* plane_pooled = pooled + p * cells;
+        pool_plane(planes[p], size, HASH_GRID, plane_pooled);
+
+        float mean = 0.0f;
+        for (int i = 0; i < cells; i++) {
+            mean += plane_pooled[i];
+        }
+        mean /= cells;
+        for (int i = 0; i < cells; i++) {
+            plane_pooled[i] -= mean;
+        }
+    }
+
+    Rng rng;
+    for (int bit = 0; bit < bits; bit++) {
+        // Each hyperplane is derived from (seed, bit) only, so codes never depend on call order
+        rng_seed(&rng, seed ^ (0xA24BAED4963EE407ULL * (uint64_t)(bit + 1)));
+        float dot = 0.0f;
+        for (int i = 0; i < HASH_POOLED_SIZE; i += 64) {
+            uint64_t signs = rng_next_u64(&rng);
+            for (int j = 0; j < 64; j++) {
+                dot += ((signs >> j) & 1) ? pooled[i + j] : -pooled[i + j];
+            }
+        }
+        if (dot > 0.0f) {
+            code[bit >> 6] |= 1ULL << (bit & 63);
+        }
+    }
+    return true;
+}
+
+int hamming_distance(const uint64_t* a, const uint64_t* b, int words) {
+    return cpu_kernels()->hamming_distance(a, b, words);
+}
+
+int hamming_top_k(const uint64_t* query, const uint64_t* codes, int count, int words, int k,
+                  int* out_index, int* out_distance) {
+    if (k > count) {
+        k = count;
+    }
+    if (k <= 0) {
+        return 0;
+    }
+
+    // Distances are bounded by the code length, so a counting pass selects the top-k in O(count)
+    int max_distance = words * 64;
+    std::vector<unsigned short> distances(count);
+    std::vector<int> histogram(max_distance + 1, 0);
+
+    const CpuKernels* kernels = cpu_kernels();
+    for (int i = 0; i < count; i++) {
+        int d = kernels->hamming_distance(query, codes + (size_t)i * words, words);
+        distances[i] = (unsigned short)d;
+        histogram[d]++;
+    }
+
+    // Find the cut-off distance and the first output slot of every distance up to it
+    int cutoff = 0;
+    int accumulated = 0;
+    while (accumulated + histogram[cutoff] < k) {
+        accumulated += histogram[cutoff];
+        cutoff++;
+    }
+    std::vector<int> slot(cutoff + 1);
+    int start = 0;
+    for (int d = 0; d <= cutoff; d++) {
+        slot[d] = start;
+        start += histogram[d];
+    }
+
+    for (int i = 0; i < count; i++) {
+        int d = distances[i];
+        if (d > cutoff || slot[d] >= k) {
+            continue;
+        }
+        int position = slot[d]++;
+        out_index[position] = i;
+        if (out_distance) {
+            out_distance[position] = d;
+        }
+    }
+    return k;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#define HASH_MAX_BITS 1024 // Largest supported code length
+#define HASH_GRID 16 // Pooling grid per gradient plane (16x16 cells of 4x4 pixels)
+#define HASH_POOLED_SIZE (4 * HASH_GRID * HASH_GRID) // Pooled values over the four planes
+
+enum HashMethod {
+    HASH_METHOD_POOLED, // One bit per pooled cell: cell response above the plane's median
+    HASH_METHOD_LSH     // Sign of random hyperplane projections of the centred pooled vector
+};
+
+/**
+ * Returns the number of 64-bit words needed to store a code of the given length.
+ *
+ * @param bits The code length in bits.
+ * @return Returns the number of words.
+ */
+inline int hash_words(int bits) {
+    return (bits + 63) / 64;
+}
+
+/**
+ * Checks whether a code length can be produced by the given method.
+ * Pooled codes need 4*g*g bits where g divides the image size (64, 256 or 1024 bits);
+ * LSH codes accept any multiple of 64 up to HASH_MAX_BITS.
+ *
+ * @param method The hashing method.
+ * @param bits The requested code length.
+ * @return Returns true if the combination is supported, false otherwise.
+ */
+bool hash_bits_supported(HashMethod method, int bits);
+
+/**
+ * Turns the four gradient planes of an image into a compact binary code.
+ *
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @param size The width and height of the planes.
+ * @param method The hashing method.
+ * @param bits The code length in bits.
+ * @param seed The seed of the LSH hyperplanes (ignored by the pooled method).
+ * @param code The output array of hash_words(bits) words.
+ * @return Returns true if the code is computed, false if the parameters are not supported.
+ */
+bool compute_binary_hash(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                         const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                         HashMethod method, int bits, uint64_t seed, uint64_t* code);
+
+/**
+ * Counts the differing bits between two codes.
+ *
+ * @param a The first code.
+ * @param b The second code.
+ * @param words The number of 64-bit words in each code.
+ * @return Returns the Hamming distance.
+ */
+int hamming_distance(const uint64_t* a, const uint64_t* b, int words);
+
+/**
+ * Finds the k gallery codes closest to the query in Hamming distance.
+ * Results are ordered by increasing distance, ties by increasing index.
+ *
+ * @param query The query code.
+ * @param codes The gallery codes, stored contiguously (count * words words).
+ * @param count The number of gallery codes.
+ * @param words The number of 64-bit words in each code.
+ * @param k The number of candidates to return.
+ * @param out_index The output array of candidate indices (at least k entries).
+ * @param out_distance The output array of candidate distances (at least k entries, may be NULL).
+ * @return Returns the number of candidates written, min(k, count).
+ */
+int hamming_top_k(const uint64_t* query, const uint64_t* codes, int count, int words, int k,
+                  int* out_index, int* out_distance);
@@ -0,0 +1,236 @@
+#include "cpu_dispatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "simd_kernels.h"
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define CPU_LEVEL_VARIABLE "IMAGEDETECTION_CPU"
+
+static const char* level_names[CPU_LEVEL_COUNT] = {"scalar", "sse2", "sse41", "avx2", "avx512", "neon"};
+
+static CpuKernels level_kernels[CPU_LEVEL_COUNT];
+static CpuLevel detected_level = CPU_SCALAR;
+static bool detected_popcnt = false;
+static std::atomic<int> selected_level(CPU_SCALAR);
+static std::atomic<const CpuKernels*> selected_kernels(NULL);
+
+/**
+ * Fills the kernel table of a level. Kernels without a variant of their own at the level use the
+ * one of the level below. Needs the detected features.
+ *
+ * @param level The level.
+ * @param kernels The output table.
+ */
+static void bind_kernels(CpuLevel level, CpuKernels* kernels) {
+    kernels->squared_distance_u8 = squared_distance_u8_scalar;
+    kernels->absolute_distance_u8 = absolute_distance_u8_scalar;
+    kernels->squared_distance_f32 = squared_distance_f32_scalar;
+    kernels->convolve_row = convolve_row_scalar;
+    kernels->hamming_distance = hamming_distance_scalar;
+    kernels->dot_int8 = dot_int8_scalar;
+    kernels->dot_int4 = dot_int4_scalar;
+    kernels->dot4_f32 = dot4_f32_scalar;
+    kernels->decimate_row_2x = decimate_row_2x_scalar;
+    kernels->squared_distance_tiles_u8 = squared_distance_tiles_u8_scalar;
+    kernels->haar_stage = haar_stage_scalar;
+
+#ifdef SIMD_X86
+    if (level >= CPU_SSE2 && level <= CPU_AVX512) {
+        kernels->squared_distance_u8 = squared_distance_u8_sse2;
+        kernels->absolute_distance_u8 = absolute_distance_u8_sse2;
+        kernels->squared_distance_f32 = squared_distance_f32_sse2;
+        kernels->convolve_row = convolve_row_sse2;
+        kernels->dot_int8 = dot_int8_sse2;
+        kernels->dot_int4 = dot_int4_sse2;
+        kernels->dot4_f32 = dot4_f32_sse2;
+        kernels->decimate_row_2x = decimate_row_2x_sse2;
+        kernels->squared_distance_tiles_u8 = squared_distance_tiles_u8_sse2;
+        kernels->haar_stage = haar_stage_sse2;
+    }
+    if (level >= CPU_SSE41 && level <= CPU_AVX512) {
+        kernels->convolve_row = convolve_row_sse41;
+        if (detected_popcnt) {
+            kernels->hamming_distance = hamming_distance_popcnt;
+        }
+    }
+    if (level >= CPU_AVX2 && level <= CPU_AVX512) {
+        kernels->squared_distance_u8 = squared_distance_u8_avx2;
+        kernels->absolute_distance_u8 = absolute_distance_u8_avx2;
+        kernels->squared_distance_f32 = squared_distance_f32_avx2;
+        kernels->convolve_row = convolve_row_avx2;
+    }
+    if (level == CPU_AVX512) {
+        kernels->squared_distance_u8 = squared_distance_u8_avx512;
+        kernels->absolute_distance_u8 = absolute_distance_u8_avx512;
+        kernels->squared_distance_f32 = squared_distance_f32_avx512;
+        kernels->convolve_row = convolve_row_avx512;
+    }
+#endif
+
+#ifdef SIMD_NEON
+    if (level == CPU_NEON) {
+        kernels->squared_distance_u8 = squared_distance_u8_neon;
+        kernels->absolute_distance_u8 = absolute_distance_u8_neon;
+        kernels->squared_distance_f32 = squared_distance_f32_neon;
+        kernels->convolve_row = convolve_row_neon;
+    }
+#endif
+}
+
+CpuLevel cpu_detect() {
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    // The compiler runtime also checks that the OS saves the AVX and AVX-512 registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+        return CPU_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return CPU_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return CPU_SSE41;
+    }
+    return CPU_SSE2;
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int leaves = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] >> 19) & 1;
+    bool os_saves_avx = false;
+    bool os_saves_avx512 = false;
+    if (((info[2] >> 27) & 1) && ((info[2] >> 28) & 1)) { // OSXSAVE and AVX
+        unsigned long long xcr0 = _xgetbv(0);
+        os_saves_avx = (xcr0 & 0x6) == 0x6;       // XMM and YMM state
+        os_saves_avx512 = (xcr0 & 0xe6) == 0xe6;  // And opmask, ZMM state
+    }
+    bool avx2 = false;
+    bool avx512 = false;
+    if (leaves >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = os_saves_avx && ((info[1] >> 5) & 1);
+        avx512 = os_saves_avx512 && ((info[1] >> 16) & 1) && ((info[1] >> 30) & 1); // F and BW
+    }
+    if (avx512) {
+        return CPU_AVX512;
+    }
+    if (avx2) {
+        return CPU_AVX2;
+    }
+    return sse41 ? CPU_SSE41 : CPU_SSE2;
+#elif defined(SIMD_NEON)
+    // Advanced SIMD is part of every AArch64 core, and a 32-bit build only enables it when targeting it
+    return CPU_NEON;
+#else
+    return CPU_SCALAR;
+#endif
+}
+
+/**
+ * Detects the POPCNT instruction, which x86 reports apart from the vector extensions.
+ *
+ * @return Returns true if the processor has POPCNT.
+ */
+static bool detect_popcnt() {
+#if defined(SIMD_X86) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+#elif defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 23) & 1;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Returns whether the detected level covers a level: the x86 levels imply the ones below them.
+ *
+ * @param level The level.
+ * @return Returns true if kernels of the level can run here.
+ */
+static bool level_supported(CpuLevel level) {
+    if (level == CPU_SCALAR) {
+        return true;
+    }
+    if (detected_level == CPU_NEON || level == CPU_NEON) {
+        return level == detected_level;
+    }
+    return level <= detected_level;
+}
+
+/**
+ * Detects the level, applies IMAGEDETECTION_CPU and binds the kernels, once.
+ *
+ * @return Returns true.
+ */
+static bool init_dispatch() {
+    detected_level = cpu_detect();
+    detected_popcnt = detect_popcnt();
+    for (int level = 0; level < CPU_LEVEL_COUNT; level++) {
+        bind_kernels((CpuLevel)level, &level_kernels[level]);
+    }
+
+    CpuLevel level = detected_level;
+    const char* requested = getenv(CPU_LEVEL_VARIABLE);
+    if (requested && requested[0]) {
+        int match = -1;
+        for (int l = 0; l < CPU_LEVEL_COUNT; l++) {
+            if (strcmp(requested, level_names[l]) == 0) {
+                match = l;
+            }
+        }
+        if (match >= 0 && level_supported((CpuLevel)match)) {
+            level = (CpuLevel)match;
+        }
+        else {
+            fprintf(stderr, "%s=%s is not supported here, using %s\n", CPU_LEVEL_VARIABLE, requested,
+                    level_names[detected_level]);
+        }
+    }
+
+    selected_level.store(level);
+    selected_kernels.store(&level_kernels[level]);
+    return true;
+}
+
+CpuLevel cpu_level() {
+    static bool initialised = init_dispatch();
+    (void)initialised;
+    return (CpuLevel)selected_level.load(std::memory_order_relaxed);
+}
+
+bool cpu_supports(CpuLevel level) {
+    cpu_level();
+    return level >= 0 && level < CPU_LEVEL_COUNT && level_supported(level);
+}
+
+bool cpu_set_level(CpuLevel level) {
+    if (!cpu_supports(level)) {
+        return false;
+    }
+    selected_level.store(level);
+    selected_kernels.store(&level_kernels[level]);
+    return true;
+}
+
+const char* cpu_level_name(CpuLevel level) {
+    return level >= 0 && level < CPU_LEVEL_COUNT ? level_names[level] : "unknown";
+}
+
+const CpuKernels* cpu_kernels() {
+    const CpuKernels* kernels = selected_kernels.load(std::memory_order_acquire);
+    if (!kernels) {
+        cpu_level();
+        kernels = selected_kernels.load(std::memory_order_acquire);
+    }
+    return kernels;
+}
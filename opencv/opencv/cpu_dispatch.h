@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+
+struct HaarFeature;
+struct HaarRectOffsets;
+
+/**
+ * Instruction set levels the kernels have variants for. The x86 levels are ordered, each one
+ * implying the ones before it; NEON is the ARM level.
+ */
+enum CpuLevel {
+    CPU_SCALAR, // Plain C++, runs anywhere
+    CPU_SSE2,
+    CPU_SSE41,
+    CPU_AVX2,
+    CPU_AVX512, // AVX-512 F and BW
+    CPU_NEON,
+    CPU_LEVEL_COUNT
+};
+
+/**
+ * The kernels bound to the selected level. Every variant returns exactly the result of the
+ * scalar kernel, except squared_distance_f32 and dot4_f32, which accumulate floats in a different
+ * order.
+ */
+struct CpuKernels {
+    /**
+     * Computes the exact sum of squared differences between two byte arrays.
+     */
+    unsigned long long (*squared_distance_u8)(const unsigned char* a, const unsigned char* b, int length);
+
+    /**
+     * Computes the exact sum of absolute differences between two byte arrays.
+     */
+    unsigned long long (*absolute_distance_u8)(const unsigned char* a, const unsigned char* b, int length);
+
+    /**
+     * Computes the sum of squared differences between two float arrays.
+     */
+    float (*squared_distance_f32)(const float* a, const float* b, int length);
+
+    /**
+     * Convolves a run of pixels of one row: out[i] is the sum of weights[t] * center[i + offsets[t]]
+     * over the taps, clamped to 0..255 and truncated.
+     */
+    void (*convolve_row)(const unsigned char* center, int count, const int* offsets, const float* weights,
+                         int taps, unsigned char* out);
+
+    /**
+     * Counts the differing bits between two arrays of 64-bit words. Uses POPCNT from the SSE41
+     * level up on processors that have it (every one since SSE4.2).
+     */
+    int (*hamming_distance)(const uint64_t* a, const uint64_t* b, int words);
+
+    /**
+     * Computes the dot product of two byte arrays.
+     */
+    long long (*dot_int8)(const unsigned char* a, const unsigned char* b, int length);
+
+    /**
+     * Computes the dot product of two arrays of packed 4-bit values, low nibbles with low nibbles
+     * and high with high.
+     */
+    long long (*dot_int4)(const unsigned char* a, const unsigned char* b, int length);
+
+    /**
+     * Computes the dot products of four matrix rows, stride floats apart, with a vector.
+     */
+    void (*dot4_f32)(const float* rows, int stride, const float* x, int length, float* sums);
+
+    /**
+     * Halves a pair of rows: out[x] is the rounded mean of the 2x2 block at column 2x.
+     */
+    void (*decimate_row_2x)(const unsigned char* top, const unsigned char* bottom, int out_width, unsigned char* out);
+
+    /**
+     * Computes the exact sums of squared differences of a row of tile x tile tiles, for images
+     * with the given row stride.
+     */
+    void (*squared_distance_tiles_u8)(const unsigned char* a, const unsigned char* b, int stride, int tile, int tiles,
+                                      unsigned long long* sums);
+
+    /**
+     * Evaluates the features of a Haar stage on a list of windows, given by their origins and
+     * normalisations, into their stage sums.
+     */
+    void (*haar_stage)(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count, const unsigned int* table,
+                       const int* origins, const float* norms, int windows, float* stage_sums);
+};
+
+/**
+ * Detects the highest level the processor and the operating system support.
+ *
+ * @return Returns the detected level.
+ */
+CpuLevel cpu_detect();
+
+/**
+ * Returns the level the kernels run at. On first use this is the detected level, lowered to
+ * the IMAGEDETECTION_CPU environment variable (scalar, sse2, sse41, avx2, avx512 or neon) when
+ * it is set, so the slower paths can be tested and compared on any machine.
+ *
+ * @return Returns the selected level.
+ */
+CpuLevel cpu_level();
+
+/**
+ * Binds the kernels of another level, e.g. for tests running every variant in turn.
+ * Must not be called while other threads run kernels.
+ *
+ * @param level The level.
+ * @return Returns true if the level is selected, false if the processor does not support it.
+ */
+bool cpu_set_level(CpuLevel level);
+
+/**
+ * Returns whether the processor supports a level.
+ *
+ * @param level The level.
+ * @return Returns true if kernels of the level can run here.
+ */
+bool cpu_supports(CpuLevel level);
+
+/**
+ * Returns the name of a level, as accepted by IMAGEDETECTION_CPU.
+ *
+ * @param level The level.
+ * @return Returns the name.
+ */
+const char* cpu_level_name(CpuLevel level);
+
+/**
+ * Returns the kernels bound to the selected level.
+ *
+ * @return Returns the kernel table.
+ */
+const CpuKernels* cpu_kernels();
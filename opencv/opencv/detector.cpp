@@ -0,0 +1,473 @@
+#include "detector.h"
+#include "distance.h"
+#include "integral_image.h"
+#include "mem_stats.h"
+#include "parallel.h"
+#include "pyramid.h"
+#include "tiled_convolution.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+void detector_default_options(DetectorOptions* options) {
+    options->stride = 8;
+    options->scale_step = 1.25f;
+    options->threshold = 3000.0;
+    options->use_gallery = false;
+    options->min_energy = 0.25;
+    options->cache_kb = DETECTOR_CACHE_KB;
+}
+
+void gallery_mean_entry(const Gallery* gallery, unsigned char* entry) {
+    for (int i = 0; i < GALLERY_ENTRY_SIZE; i++) {
+        unsigned int sum = 0;
+        for (int e = 0; e < gallery->count; e++) {
+            sum += gallery->planes[(size_t)e * GALLERY_ENTRY_SIZE + i];
+        }
+        entry[i] = gallery->count > 0 ? (unsigned char)((sum + gallery->count / 2) / gallery->count) : 0;
+    }
+}
+
+double window_distance(const unsigned char* const planes[4], int stride, int x, int y, const unsigned char* entry) {
+    const int offset = FILTER_SIZE / 2;
+    double distance = 0.0;
+    for (int p = 0; p < 4; p++) {
+        const unsigned char* plane_entry = entry + p * GALLERY_PLANE_SIZE;
+        unsigned long long sum = 0;
+        for (int row = offset; row < SIZE - offset; row++) {
+            sum += squared_distance_u8(planes[p] + (size_t)(y + row) * stride + x + offset,
+                                       plane_entry + row * SIZE + offset, SIZE - 2 * offset);
+        }
+        distance += sqrt((double)sum);
+    }
+    return distance / 4.0;
+}
+
+/**
+ * What every window is scored against, shared by all levels and threads.
+ */
+struct ScoringTargets {
+    const Gallery* gallery;
+    const DetectorOptions* options;
+    unsigned char* template_entry;
+    WindowStats template_stats;
+    double template_energy;
+    std::vector<WindowStats> entry_stats; // Per gallery entry, with --detect-gallery only
+};
+
+/**
+ * Scores a range of windows of one pyramid level from gradient planes covering them.
+ *
+ * @param targets The scoring targets.
+ * @param planes The four gradient planes of the covered region.
+ * @param integrals The integral images of the four planes.
+ * @param plane_width The width of the planes.
+ * @param origin_x The level column of the first plane pixel.
+ * @param origin_y The level row of the first plane pixel.
+ * @param row_begin The first window row.
+ * @param row_end The end of the window rows (exclusive).
+ * @param col_begin The first window column.
+ * @param col_end The end of the window columns (exclusive).
+ * @param level The pyramid level.
+ * @param scale The scale of the level.
+ * @param found The output detections, appended to.
+ * @param pruned The number of windows rejected without a full distance, added to.
+ * @param exact The number of full distances computed, added to.
+ */
+static void score_windows(const ScoringTargets* targets, const unsigned char* const planes[4], const IntegralImage integrals[4],
+                          int plane_width, int origin_x, int origin_y, int row_begin, int row_end, int col_begin, int col_end,
+                          int level, float scale, std::vector<Detection>& found, long long* pruned, long long* exact) {
+    const DetectorOptions* options = targets->options;
+    const Gallery* gallery = targets->gallery;
+    for (int r = row_begin; r < row_end; r++) {
+        int y = r * options->stride;
+        for (int c = col_begin; c < col_end; c++) {
+            int x = c * options->stride;
+            int local_x = x - origin_x;
+            int local_y = y - origin_y;
+            WindowStats window;
+            window_stats_from_integrals(integrals, local_x, local_y, &window);
+
+            // Flat background has little gradient energy and would otherwise match a smooth template
+            double energy = window.energy[0] + window.energy[1] + window.energy[2] + window.energy[3];
+            if (energy < options->min_energy * targets->template_energy) {
+                (*pruned)++;
+                continue;
+            }
+
+            double best = INFINITY;
+            int match = -1;
+            if (options->use_gallery) {
+                for (int e = 0; e < gallery->count; e++) {
+                    double limit = best < options->threshold ? best : options->threshold;
+                    if (window_distance_lower_bound(&window, &targets->entry_stats[e]) >= limit) {
+                        continue;
+                    }
+                    (*exact)++;
+                    double distance = window_distance(planes, plane_width, local_x, local_y, gallery->planes + (size_t)e * GALLERY_ENTRY_SIZE);
+                    if (distance < best) {
+                        best = distance;
+                        match = e;
+                    }
+                }
+                if (match < 0) {
+                    (*pruned)++;
+                }
+            }
+            else if (window_distance_lower_bound(&window, &targets->template_stats) >= options->threshold) {
+                (*pruned)++;
+            }
+            else {
+                (*exact)++;
+                best = window_distance(planes, plane_width, local_x, local_y, targets->template_entry);
+            }
+
+            if (best < options->threshold) {
+                Detection detection;
+                detection.x = x * scale;
+                detection.y = y * scale;
+                detection.width = SIZE * scale;
+                detection.height = SIZE * scale;
+                detection.distance = best;
+                detection.match = match;
+                detection.level = level;
+                found.push_back(detection);
+            }
+        }
+    }
+}
+
+/**
+ * Work memory of one strip task: a band of the level image, its gradient planes and the integral
+ * images of the strip of windows being scored.
+ */
+struct StripBuffers {
+    unsigned char* image;
+    unsigned char* planes[4];
+    IntegralImage integrals[4];
+    ResizeScratch scratch;
+};
+
+/**
+ * Allocates the buffers of a band of up to width x height pixels.
+ *
+ * @param width The largest band width in pixels.
+ * @param height The largest band height in pixels.
+ * @param strip_height The largest strip height in pixels.
+ * @return Returns the buffers, or NULL if memory runs out.
+ */
+static StripBuffers* strip_buffers_create(int width, int height, int strip_height) {
+    size_t pixels = (size_t)width * height;
+    size_t table = ((size_t)width + 1) * (strip_height + 1) * sizeof(unsigned int);
+    StripBuffers* buffers = (StripBuffers*)calloc(1, sizeof(StripBuffers));
+    if (!buffers) {
+        return NULL;
+    }
+    bool ok = (buffers->image = (unsigned char*)mem_alloc(STAGE_DETECT, pixels)) != NULL;
+    for (int p = 0; p < 4; p++) {
+        ok = ok && (buffers->planes[p] = (unsigned char*)mem_alloc(STAGE_DETECT, pixels)) != NULL;
+        ok = ok && (buffers->integrals[p].sum = (unsigned int*)mem_alloc(STAGE_DETECT, table)) != NULL;
+        ok = ok && (buffers->integrals[p].squared = (unsigned int*)mem_alloc(STAGE_DETECT, table)) != NULL;
+    }
+    if (!ok) {
+        mem_free(buffers->image);
+        for (int p = 0; p < 4; p++) {
+            mem_free(buffers->planes[p]);
+            integral_free(&buffers->integrals[p]);
+        }
+        free(buffers);
+        return NULL;
+    }
+    return buffers;
+}
+
+/**
+ * Releases the buffers of a strip task.
+ *
+ * @param buffers The buffers.
+ */
+static void strip_buffers_free(StripBuffers* buffers) {
+    mem_free(buffers->image);
+    for (int p = 0; p < 4; p++) {
+        mem_free(buffers->planes[p]);
+        integral_free(&buffers->integrals[p]);
+    }
+    resize_scratch_free(&buffers->scratch);
+    free(buffers);
+}
+
+/**
+ * Geometry of the strips a level is scanned in, sized so the buffers of one task fit the cache budget.
+ */
+struct StripLayout {
+    int strip_windows; // Window rows per strip
+    int band_windows;  // Window columns per band
+    int band_width;    // Largest band width in pixels, halo included
+    int band_height;   // Largest band height in pixels: one strip plus the halo above and below it
+    int strip_height;  // Largest strip height in pixels, the rows its integral images cover
+};
+
+/**
+ * Sizes the strips from the cache budget. A strip advances about DETECTOR_STRIP_ROWS rows, and the
+ * band is as wide as its image, planes and integral tables allow within the budget.
+ *
+ * @param options The detector settings.
+ * @param layout The output layout.
+ */
+static void strip_layout_plan(const DetectorOptions* options, StripLayout* layout) {
+    const int halo = FILTER_SIZE / 2;
+    int stride = options->stride;
+    layout->strip_windows = DETECTOR_STRIP_ROWS / stride > 1 ? DETECTOR_STRIP_ROWS / stride : 1;
+    layout->strip_height = (layout->strip_windows - 1) * stride + SIZE;
+    layout->band_height = layout->strip_height + 2 * halo;
+
+    // Per band column: the image and four planes, and eight 32-bit integral tables
+    size_t column_bytes = (size_t)layout->band_height * 5 + ((size_t)layout->strip_height + 1) * 8 * sizeof(unsigned int);
+    int width = (int)((size_t)options->cache_kb * 1024 / column_bytes);
+    layout->band_windows = width > SIZE + 2 * halo ? (width - SIZE - 2 * halo) / stride + 1 : 1;
+    layout->band_width = (layout->band_windows - 1) * stride + SIZE + 2 * halo;
+}
+
+bool detect_faces(const unsigned char* gray, int width, int height, const Gallery* gallery,
+                  const DetectorOptions* options, std::vector<Detection>& detections, DetectorStats* stats) {
+    detections.clear();
+    stats->windows = 0;
+    stats->pruned = 0;
+    stats->exact = 0;
+    if (options->scale_step <= 1.0f || options->stride < 1 || gallery->count == 0) {
+        return true;
+    }
+
+    // Statistics of the mean template (energy gate, and the scoring target without --detect-gallery)
+    ScoringTargets targets;
+    targets.gallery = gallery;
+    targets.options = options;
+    targets.template_entry = (unsigned char*)malloc(GALLERY_ENTRY_SIZE);
+    if (!targets.template_entry) {
+        return false;
+    }
+    gallery_mean_entry(gallery, targets.template_entry);
+    window_stats_from_entry(targets.template_entry, &targets.template_stats);
+    targets.template_energy = 0.0;
+    for (int p = 0; p < 4; p++) {
+        targets.template_energy += targets.template_stats.energy[p];
+    }
+    targets.entry_stats.resize(options->use_gallery ? gallery->count : 0);
+    for (size_t e = 0; e < targets.entry_stats.size(); e++) {
+        window_stats_from_entry(gallery->planes + e * GALLERY_ENTRY_SIZE, &targets.entry_stats[e]);
+    }
+    std::atomic<long long> pruned(0);
+    std::atomic<long long> exact(0);
+    std::atomic<bool> ok(true);
+
+    float* filters[4] = { filter_horizontal, filter_vertical, filter_45, filter_minus_45 };
+    std::mutex detections_mutex;
+
+    // Strip mode only keeps the 2:1 octaves: every band resizes its own rows from them
+    const int halo = FILTER_SIZE / 2;
+    bool streamed = options->cache_kb > 0;
+    StripLayout layout;
+    if (streamed) {
+        strip_layout_plan(options, &layout);
+    }
+    std::vector<StripBuffers*> spare_buffers;
+
+    Pyramid pyramid;
+    bool built = streamed ? pyramid_build_octaves(&pyramid, gray, width, height, options->scale_step, SIZE, SIZE)
+                          : pyramid_build(&pyramid, gray, width, height, options->scale_step, SIZE, SIZE);
+    if (!built) {
+        free(targets.template_entry);
+        return false;
+    }
+
+    for (int level = 0; level < pyramid.level_count && ok; level++) {
+        int level_width = pyramid.levels[level].width;
+        int level_height = pyramid.levels[level].height;
+        float scale = pyramid.levels[level].scale;
+
+        int rows = (level_height - SIZE) / options->stride + 1;
+        int cols = (level_width - SIZE) / options->stride + 1;
+        stats->windows += (long long)rows * cols;
+
+        if (streamed) {
+            // A task is a band of window columns over a run of window rows, walked down one strip at
+            // a time: the rows a strip shares with the last one are kept, and only the new ones are
+            // resized, convolved and integrated while the whole band is cache-resident
+            int bands = (cols + layout.band_windows - 1) / layout.band_windows;
+            int strips = (rows + layout.strip_windows - 1) / layout.strip_windows;
+            int runs = (2 * parallel_threads() + bands - 1) / bands;
+            runs = runs < strips ? runs : strips;
+            int run_strips = (strips + runs - 1) / runs;
+            runs = (strips + run_strips - 1) / run_strips;
+
+            parallel_for(bands * runs, 1, [&](int begin, int end) {
+                StripBuffers* buffers = NULL;
+                {
+                    std::lock_guard<std::mutex> lock(detections_mutex);
+                    if (!spare_buffers.empty()) {
+                        buffers = spare_buffers.back();
+                        spare_buffers.pop_back();
+                    }
+                }
+                if (!buffers && !(buffers = strip_buffers_create(layout.band_width, layout.band_height, layout.strip_height))) {
+                    ok = false;
+                    return;
+                }
+
+                std::vector<Detection> found;
+                long long local_pruned = 0;
+                long long local_exact = 0;
+                for (int task = begin; task < end && ok; task++) {
+                    int col_begin = (task % bands) * layout.band_windows;
+                    int col_end = col_begin + layout.band_windows < cols ? col_begin + layout.band_windows : cols;
+                    int run_begin = (task / bands) * run_strips * layout.strip_windows;
+                    int run_end = run_begin + run_strips * layout.strip_windows < rows ? run_begin + run_strips * layout.strip_windows : rows;
+
+                    // Columns under the windows plus the halo, clipped to the level
+                    int left = col_begin * options->stride - halo;
+                    int right = (col_end - 1) * options->stride + SIZE + halo;
+                    left = left > 0 ? left : 0;
+                    right = right < level_width ? right : level_width;
+                    int band_width = right - left;
+
+                    // Level rows held by the band: image rows from band_top to filled, final planes up to valid
+                    int band_top = 0;
+                    int filled = 0;
+                    int valid = 0;
+                    for (int row_begin = run_begin; row_begin < run_end; row_begin += layout.strip_windows) {
+                        int row_end = row_begin + layout.strip_windows < run_end ? row_begin + layout.strip_windows : run_end;
+                        int top = row_begin * options->stride - halo;
+                        int bottom = (row_end - 1) * options->stride + SIZE + halo;
+                        top = top > 0 ? top : 0;
+                        bottom = bottom < level_height ? bottom : level_height;
+
+                        // Slide the band down, keeping the rows this strip shares with the last one
+                        if (row_begin == run_begin || top >= filled) {
+                            filled = top;
+                            valid = top;
+                        }
+                        else {
+                            // Image rows may still overlap when no final plane row does (strides above SIZE)
+                            valid = valid > top ? valid : top;
+                            size_t shift = (size_t)(top - band_top) * band_width;
+                            memmove(buffers->image, buffers->image + shift, (size_t)(filled - top) * band_width);
+                            for (int p = 0; p < 4; p++) {
+                                memmove(buffers->planes[p], buffers->planes[p] + shift, (size_t)(valid - top) * band_width);
+                            }
+                        }
+                        band_top = top;
+
+                        if (!pyramid_level_rect(&pyramid, level, left, filled, right, bottom,
+                                                buffers->image + (size_t)(filled - band_top) * band_width, band_width, &buffers->scratch)) {
+                            ok = false;
+                            break;
+                        }
+                        filled = bottom;
+
+                        // Plane rows within the halo of the band bottom are only final at the level bottom
+                        int band_height = bottom - band_top;
+                        for (int p = 0; p < 4; p++) {
+                            convolve_rect(buffers->image, band_width, band_height, filters[p], FILTER_SIZE,
+                                          0, valid - band_top, band_width, band_height, buffers->planes[p]);
+                        }
+                        valid = bottom < level_height ? bottom - halo : bottom;
+
+                        // Integral images of the strip alone, from its first window row down
+                        int strip_top = row_begin * options->stride;
+                        int strip_height = (row_end - 1) * options->stride + SIZE - strip_top;
+                        const unsigned char* strip_planes[4];
+                        for (int p = 0; p < 4; p++) {
+                            strip_planes[p] = buffers->planes[p] + (size_t)(strip_top - band_top) * band_width;
+                            integral_compute(&buffers->integrals[p], strip_planes[p], band_width, strip_height);
+                        }
+                        score_windows(&targets, strip_planes, buffers->integrals, band_width, left, strip_top, row_begin, row_end,
+                                      col_begin, col_end, level, scale, found, &local_pruned, &local_exact);
+                    }
+                }
+                pruned += local_pruned;
+                exact += local_exact;
+                std::lock_guard<std::mutex> lock(detections_mutex);
+                detections.insert(detections.end(), found.begin(), found.end());
+                spare_buffers.push_back(buffers);
+            });
+            continue;
+        }
+
+        // Gradients are computed once per level and shared by all overlapping windows
+        unsigned char* level_image = pyramid.levels[level].pixels;
+        size_t level_size = (size_t)level_width * level_height;
+        unsigned char* planes[4] = { NULL, NULL, NULL, NULL };
+        IntegralImage integrals[4] = {};
+        bool allocated = true;
+        for (int p = 0; p < 4; p++) {
+            planes[p] = (unsigned char*)mem_alloc(STAGE_DETECT, level_size);
+            allocated = allocated && planes[p];
+        }
+        if (allocated) {
+            convolution_tiled(level_image, level_width, level_height, filters, 4, FILTER_SIZE, planes);
+            std::atomic<bool> integrated(true);
+            parallel_for(4, 1, [&](int begin, int end) {
+                for (int p = begin; p < end; p++) {
+                    if (!integral_init(&integrals[p], planes[p], level_width, level_height)) {
+                        integrated = false;
+                    }
+                }
+            });
+            allocated = integrated;
+        }
+        if (!allocated) {
+            for (int p = 0; p < 4; p++) {
+                integral_free(&integrals[p]);
+                mem_free(planes[p]);
+            }
+            ok = false;
+            break;
+        }
+        const unsigned char* const level_planes[4] = { planes[0], planes[1], planes[2], planes[3] };
+
+        parallel_for(rows, 1, [&](int begin, int end) {
+            std::vector<Detection> found;
+            long long local_pruned = 0;
+            long long local_exact = 0;
+            score_windows(&targets, level_planes, integrals, level_width, 0, 0, begin, end, 0, cols, level, scale,
+                          found, &local_pruned, &local_exact);
+            pruned += local_pruned;
+            exact += local_exact;
+            std::lock_guard<std::mutex> lock(detections_mutex);
+            detections.insert(detections.end(), found.begin(), found.end());
+        });
+
+        for (int p = 0; p < 4; p++) {
+            integral_free(&integrals[p]);
+            mem_free(planes[p]);
+        }
+    }
+    pyramid_free(&pyramid);
+    for (StripBuffers* buffers : spare_buffers) {
+        strip_buffers_free(buffers);
+    }
+    if (!ok) {
+        detections.clear();
+        free(targets.template_entry);
+        return false;
+    }
+
+    // Windows are collected in thread order; sort with full tie-breaking so output is reproducible
+    std::sort(detections.begin(), detections.end(), [](const Detection& a, const Detection& b) {
+        if (a.distance != b.distance) {
+            return a.distance < b.distance;
+        }
+        if (a.level != b.level) {
+            return a.level < b.level;
+        }
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    free(targets.template_entry);
+    stats->pruned = pruned;
+    stats->exact = exact;
+    return true;
+}
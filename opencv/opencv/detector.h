@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+
+#include "gallery.h"
+
+#define DETECTOR_CACHE_KB 512   // Default working set of one detector task, within a typical per-core L2
+#define DETECTOR_STRIP_ROWS 32  // Level rows a detector strip advances by (rounded to whole window rows)
+
+/**
+ * Settings of the sliding-window detector.
+ */
+struct DetectorOptions {
+    int stride;          // Window step in pixels at every pyramid level
+    float scale_step;    // Downscale factor between pyramid levels (> 1)
+    double threshold;    // Windows closer than this distance are reported
+    bool use_gallery;    // Score against every gallery entry instead of the mean template
+    double min_energy;   // Skip windows with less gradient energy than this fraction of the template's
+    int cache_kb;        // Working set of one strip task in KB, 0 to process whole levels
+};
+
+/**
+ * Work counters of one detector run.
+ */
+struct DetectorStats {
+    long long windows; // Windows visited over all pyramid levels
+    long long pruned;  // Windows rejected from integral-image statistics alone
+    long long exact;   // Full window distances computed
+};
+
+/**
+ * A detected window, in the coordinates of the original image.
+ */
+struct Detection {
+    float x;
+    float y;
+    float width;
+    float height;
+    double distance; // Four-plane distance of the window to the template or closest gallery entry
+    int match;       // Closest gallery entry, or -1 when scored against the template
+    int level;       // Pyramid level the window was found on
+};
+
+/**
+ * Fills the detector options with their defaults.
+ *
+ * @param options The options.
+ */
+void detector_default_options(DetectorOptions* options);
+
+/**
+ * Computes the mean of all gallery entries, used as a single face template.
+ *
+ * @param gallery The gallery.
+ * @param entry The output packed entry of GALLERY_ENTRY_SIZE bytes.
+ */
+void gallery_mean_entry(const Gallery* gallery, unsigned char* entry);
+
+/**
+ * Computes the four-plane distance between a SIZE x SIZE window of full-image gradient planes and
+ * a packed entry. Only the window interior is compared, because entries are computed on
+ * pre-cropped faces and have an empty border where the filter does not fit.
+ *
+ * @param planes The four gradient planes of the image (horizontal, vertical, 45, -45).
+ * @param stride The row stride of the planes.
+ * @param x The left edge of the window.
+ * @param y The top edge of the window.
+ * @param entry The packed entry.
+ * @return Returns the mean of the per-plane Euclidean distances.
+ */
+double window_distance(const unsigned char* const planes[4], int stride, int x, int y, const unsigned char* entry);
+
+/**
+ * Scans a grayscale image for faces: builds an image pyramid, computes the four directional
+ * gradients once per level, slides a SIZE x SIZE window over every level and scores each
+ * window against the gallery (or its mean template). Integral images of the gradient planes
+ * give every window a lower bound of its distance in O(1), so most windows are rejected
+ * without comparing their pixels.
+ *
+ * With a cache budget, only the 2:1 octaves of the pyramid are stored. Each level is scanned in
+ * bands of window columns, walked down in strips of about DETECTOR_STRIP_ROWS rows: each strip
+ * resizes its new rows from the octave straight into the band, convolves only those, integrates
+ * the strip and scores it, all within cache_kb of buffers, so no full level, gradient plane or
+ * integral table is ever written to memory. Results are identical in both modes.
+ *
+ * @param gray The grayscale image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param gallery The enrolled gallery.
+ * @param options The detector settings.
+ * @param detections The output detections, sorted by increasing distance.
+ * @param stats The output work counters.
+ * @return Returns true if the image is scanned, false if memory runs out.
+ */
+bool detect_faces(const unsigned char* gray, int width, int height, const Gallery* gallery,
+                  const DetectorOptions* options, std::vector<Detection>& detections, DetectorStats* stats);
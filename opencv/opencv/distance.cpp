@@ -0,0 +1,19 @@
+#include "distance.h"
+
+#include <math.h>
+
+#include "cpu_dispatch.h"
+
+// The kernels themselves live in simd_kernels.cpp, one variant per instruction set
+
+double descriptor_distance(const float* a, const float* b, int length) {
+    return sqrt((double)cpu_kernels()->squared_distance_f32(a, b, length));
+}
+
+unsigned long long squared_distance_u8(const unsigned char* a, const unsigned char* b, int length) {
+    return cpu_kernels()->squared_distance_u8(a, b, length);
+}
+
+unsigned long long absolute_distance_u8(const unsigned char* a, const unsigned char* b, int length) {
+    return cpu_kernels()->absolute_distance_u8(a, b, length);
+}
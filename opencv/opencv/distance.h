@@ -0,0 +1,31 @@
+#pragma once
+
+/**
+ * Computes the Euclidean distance between two float descriptors.
+ *
+ * @param a The first descriptor.
+ * @param b The second descriptor.
+ * @param length The number of floats in each descriptor.
+ * @return Returns the Euclidean distance.
+ */
+double descriptor_distance(const float* a, const float* b, int length);
+
+/**
+ * Computes the squared Euclidean distance between two byte arrays.
+ *
+ * @param a The first array.
+ * @param b The second array.
+ * @param length The number of bytes in each array.
+ * @return Returns the exact sum of squared differences.
+ */
+unsigned long long squared_distance_u8(const unsigned char* a, const unsigned char* b, int length);
+
+/**
+ * Computes the sum of absolute differences between two byte arrays.
+ *
+ * @param a The first array.
+ * @param b The second array.
+ * @param length The number of bytes in each array.
+ * @return Returns the exact sum of absolute differences.
+ */
+unsigned long long absolute_distance_u8(const unsigned char* a, const unsigned char* b, int length);
@@ -0,0 +1,162 @@
+#include "gallery.h"
+#include "distance.h"
+#include "mem_stats.h"
+#include "parallel.h"
+#include "perf_counters.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define SEARCH_GRAIN 256 // Entries per parallel chunk
+
+bool gallery_init(Gallery* gallery, int capacity) {
+    gallery->count = 0;
+    gallery->capacity = capacity;
+    gallery->planes = (unsigned char*)mem_alloc(STAGE_MATCH, (size_t)capacity * GALLERY_ENTRY_SIZE);
+    gallery->coarse = (unsigned char*)mem_alloc(STAGE_MATCH, (size_t)capacity * COARSE_ENTRY_SIZE);
+    if (!gallery->planes || !gallery->coarse) {
+        gallery_free(gallery);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Downsamples a gradient plane to COARSE_GRID x COARSE_GRID by block averaging.
+ *
+ * @param plane The gradient plane.
+ * @param coarse The output array of COARSE_PLANE_SIZE bytes.
+ */
+static void downsample_plane(const unsigned char* plane, unsigned char* coarse) {
+    const int block = SIZE / COARSE_GRID;
+    for (int gy = 0; gy < COARSE_GRID; gy++) {
+        for (int gx = 0; gx < COARSE_GRID; gx++) {
+            int sum = 0;
+            for (int y = gy * block; y < (gy + 1) * block; y++) {
+                for (int x = gx * block; x < (gx + 1) * block; x++) {
+                    sum += plane[y * SIZE + x];
+                }
+            }
+            coarse[gy * COARSE_GRID + gx] = (unsigned char)((sum + block * block / 2) / (block * block));
+        }
+    }
+}
+
+void gallery_pack_entry(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                        const unsigned char* grad_45, const unsigned char* grad_minus_45,
+                        unsigned char* entry, unsigned char* coarse) {
+    const unsigned char* planes[4] = { grad_horizontal, grad_vertical, grad_45, grad_minus_45 };
+    for (int p = 0; p < 4; p++) {
+        memcpy(entry + p * GALLERY_PLANE_SIZE, planes[p], GALLERY_PLANE_SIZE);
+        downsample_plane(planes[p], coarse + p * COARSE_PLANE_SIZE);
+    }
+}
+
+int gallery_add(Gallery* gallery, const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                const unsigned char* grad_45, const unsigned char* grad_minus_45) {
+    if (gallery->count >= gallery->capacity) {
+        return -1;
+    }
+    int index = gallery->count++;
+    gallery_pack_entry(grad_horizontal, grad_vertical, grad_45, grad_minus_45,
+                       gallery->planes + (size_t)index * GALLERY_ENTRY_SIZE,
+                       gallery->coarse + (size_t)index * COARSE_ENTRY_SIZE);
+    return index;
+}
+
+double gallery_entry_distance(const unsigned char* a, const unsigned char* b) {
+    double distance = 0.0;
+    for (int p = 0; p < 4; p++) {
+        distance += sqrt((double)squared_distance_u8(a + p * GALLERY_PLANE_SIZE, b + p * GALLERY_PLANE_SIZE, GALLERY_PLANE_SIZE));
+    }
+    return distance / 4.0;
+}
+
+/**
+ * Orders matches by increasing distance, ties by increasing index.
+ */
+static bool match_less(const GalleryMatch& a, const GalleryMatch& b) {
+    return a.distance < b.distance || (a.distance == b.distance && a.index < b.index);
+}
+
+/**
+ * Scores the given entries with the full distance in parallel and keeps the k best.
+ *
+ * @param gallery The gallery.
+ * @param query The packed query entry.
+ * @param indices The entries to score, or NULL for all of them.
+ * @param count The number of entries to score.
+ * @param k The number of matches to return.
+ * @param matches The output array of at least k matches.
+ * @return Returns the number of matches written.
+ */
+static int rank_exact(const Gallery* gallery, const unsigned char* query, const int* indices, int count, int k, GalleryMatch* matches) {
+    std::vector<GalleryMatch> scored(count);
+    parallel_for(count, SEARCH_GRAIN, [&](int begin, int end) {
+        PerfSample counters;
+        perf_begin(&counters);
+        for (int i = begin; i < end; i++) {
+            int index = indices ? indices[i] : i;
+            scored[i].index = index;
+            scored[i].distance = gallery_entry_distance(gallery->planes + (size_t)index * GALLERY_ENTRY_SIZE, query);
+        }
+        perf_end(PERF_DISTANCE, &counters, (unsigned long long)(end - begin) * GALLERY_ENTRY_SIZE);
+    });
+
+    if (k > count) {
+        k = count;
+    }
+    std::partial_sort(scored.begin(), scored.begin() + k, scored.end(), match_less);
+    std::copy(scored.begin(), scored.begin() + k, matches);
+    return k;
+}
+
+int gallery_search_exact(const Gallery* gallery, const unsigned char* query, int k, GalleryMatch* matches) {
+    return rank_exact(gallery, query, NULL, gallery->count, k, matches);
+}
+
+int gallery_search_cascade(const Gallery* gallery, const unsigned char* query, const unsigned char* query_coarse,
+                           int top_m, int k, GalleryMatch* matches) {
+    int count = gallery->count;
+    if (top_m > count) {
+        top_m = count;
+    }
+    if (top_m <= 0) {
+        return 0;
+    }
+
+    // Stage 1: coarse distances over the whole gallery (256 bytes per entry instead of 16 KB)
+    std::vector<unsigned int> coarse_distances(count);
+    parallel_for(count, SEARCH_GRAIN * 16, [&](int begin, int end) {
+        PerfSample counters;
+        perf_begin(&counters);
+        for (int i = begin; i < end; i++) {
+            coarse_distances[i] = (unsigned int)squared_distance_u8(gallery->coarse + (size_t)i * COARSE_ENTRY_SIZE,
+                                                                   query_coarse, COARSE_ENTRY_SIZE);
+        }
+        perf_end(PERF_DISTANCE, &counters, (unsigned long long)(end - begin) * COARSE_ENTRY_SIZE);
+    });
+
+    std::vector<int> survivors(count);
+    for (int i = 0; i < count; i++) {
+        survivors[i] = i;
+    }
+    std::nth_element(survivors.begin(), survivors.begin() + (top_m - 1), survivors.end(), [&](int a, int b) {
+        return coarse_distances[a] < coarse_distances[b] || (coarse_distances[a] == coarse_distances[b] && a < b);
+    });
+
+    // Stage 2: exact four-plane distance for the survivors only
+    return rank_exact(gallery, query, survivors.data(), top_m, k, matches);
+}
+
+void gallery_free(Gallery* gallery) {
+    mem_free(gallery->planes);
+    mem_free(gallery->coarse);
+    gallery->planes = NULL;
+    gallery->coarse = NULL;
+    gallery->count = 0;
+    gallery->capacity = 0;
+}
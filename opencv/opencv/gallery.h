@@ -0,0 +1,107 @@
+#pragma once
+
+#include "image_features.h"
+
+#define GALLERY_PLANE_SIZE (SIZE * SIZE) // Bytes per gradient plane
+#define GALLERY_ENTRY_SIZE (4 * GALLERY_PLANE_SIZE) // Four planes per entry, stored back to back
+#define COARSE_GRID 8 // Coarse descriptor: every plane downsampled to 8x8
+#define COARSE_PLANE_SIZE (COARSE_GRID * COARSE_GRID)
+#define COARSE_ENTRY_SIZE (4 * COARSE_PLANE_SIZE)
+
+/**
+ * Enrolled gradient planes stored contiguously, with a tiny downsampled copy of every
+ * entry for the first stage of the cascade search.
+ */
+struct Gallery {
+    int count;
+    int capacity;
+    unsigned char* planes; // count entries of GALLERY_ENTRY_SIZE bytes
+    unsigned char* coarse; // count entries of COARSE_ENTRY_SIZE bytes
+};
+
+/**
+ * One search result.
+ */
+struct GalleryMatch {
+    int index;
+    double distance;
+};
+
+/**
+ * Allocates an empty gallery.
+ *
+ * @param gallery The gallery to initialise.
+ * @param capacity The maximum number of entries.
+ * @return Returns true if the gallery is allocated, false otherwise.
+ */
+bool gallery_init(Gallery* gallery, int capacity);
+
+/**
+ * Appends an entry and computes its coarse descriptor.
+ *
+ * @param gallery The gallery.
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @return Returns the index of the new entry, or -1 if the gallery is full.
+ */
+int gallery_add(Gallery* gallery, const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                const unsigned char* grad_45, const unsigned char* grad_minus_45);
+
+/**
+ * Packs four gradient planes into one entry and its coarse descriptor, laid out as in a gallery.
+ *
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @param entry The output array of GALLERY_ENTRY_SIZE bytes.
+ * @param coarse The output array of COARSE_ENTRY_SIZE bytes.
+ */
+void gallery_pack_entry(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                        const unsigned char* grad_45, const unsigned char* grad_minus_45,
+                        unsigned char* entry, unsigned char* coarse);
+
+/**
+ * Computes the four-plane distance of compare_images(): the mean of the per-plane Euclidean distances.
+ *
+ * @param a The first packed entry.
+ * @param b The second packed entry.
+ * @return Returns the distance.
+ */
+double gallery_entry_distance(const unsigned char* a, const unsigned char* b);
+
+/**
+ * Scores every entry with the full four-plane distance, in parallel.
+ *
+ * @param gallery The gallery.
+ * @param query The packed query entry.
+ * @param k The number of matches to return.
+ * @param matches The output array of at least k matches, closest first.
+ * @return Returns the number of matches written, min(k, count).
+ */
+int gallery_search_exact(const Gallery* gallery, const unsigned char* query, int k, GalleryMatch* matches);
+
+/**
+ * Two-stage cascade search: every entry is scored on its coarse descriptor, the top_m
+ * closest survive, and only those are re-ranked with the full four-plane distance.
+ * Both stages run in parallel.
+ *
+ * @param gallery The gallery.
+ * @param query The packed query entry.
+ * @param query_coarse The query's coarse descriptor.
+ * @param top_m The number of coarse survivors re-ranked exactly.
+ * @param k The number of matches to return.
+ * @param matches The output array of at least k matches, closest first.
+ * @return Returns the number of matches written, min(k, top_m, count).
+ */
+int gallery_search_cascade(const Gallery* gallery, const unsigned char* query, const unsigned char* query_coarse,
+                           int top_m, int k, GalleryMatch* matches);
+
+/**
+ * Releases the memory held by a gallery.
+ *
+ * @param gallery The gallery.
+ */
+void gallery_free(Gallery* gallery);
@@ -0,0 +1,232 @@
+#include "haar_cascade.h"
+#include "cpu_dispatch.h"
+#include "integral_image.h"
+#include "parallel.h"
+#include "pyramid.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#define HAAR_LINE_SIZE 256
+
+/**
+ * Reads the next line that is neither blank nor a comment.
+ *
+ * @param file The file.
+ * @param line The output buffer of HAAR_LINE_SIZE bytes.
+ * @return Returns true if a line is read, false at the end of the file.
+ */
+static bool next_line(FILE* file, char* line) {
+    while (fgets(line, HAAR_LINE_SIZE, file)) {
+        const char* p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p != '#' && *p != '\n' && *p != '\r' && *p != '\0') {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool haar_cascade_load(HaarCascade* cascade, const char* path) {
+    cascade->stages.clear();
+    cascade->features.clear();
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+
+    char line[HAAR_LINE_SIZE];
+    int stage_count = 0;
+    bool ok = next_line(file, line)
+           && sscanf(line, "haarcascade %d %d %d", &cascade->window_width, &cascade->window_height, &stage_count) == 3
+           && cascade->window_width > 0 && cascade->window_height > 0 && stage_count > 0;
+
+    for (int s = 0; ok && s < stage_count; s++) {
+        HaarStage stage;
+        ok = next_line(file, line) && sscanf(line, "stage %d %f", &stage.feature_count, &stage.threshold) == 2
+          && stage.feature_count > 0;
+        stage.first_feature = (int)cascade->features.size();
+
+        for (int f = 0; ok && f < stage.feature_count; f++) {
+            HaarFeature feature;
+            ok = next_line(file, line)
+              && sscanf(line, "feature %d %f %f %f", &feature.rect_count, &feature.threshold, &feature.left_value, &feature.right_value) == 4
+              && feature.rect_count >= 1 && feature.rect_count <= HAAR_MAX_RECTS;
+
+            for (int r = 0; ok && r < feature.rect_count; r++) {
+                ok = next_line(file, line)
+                  && sscanf(line, "rect %d %d %d %d %f", &feature.x[r], &feature.y[r], &feature.width[r], &feature.height[r], &feature.weight[r]) == 5
+                  && feature.x[r] >= 0 && feature.y[r] >= 0 && feature.width[r] > 0 && feature.height[r] > 0
+                  && feature.x[r] + feature.width[r] <= cascade->window_width
+                  && feature.y[r] + feature.height[r] <= cascade->window_height;
+            }
+            if (ok) {
+                cascade->features.push_back(feature);
+            }
+        }
+        if (ok) {
+            cascade->stages.push_back(stage);
+        }
+    }
+
+    fclose(file);
+    if (!ok) {
+        cascade->stages.clear();
+        cascade->features.clear();
+    }
+    return ok;
+}
+
+/**
+ * Runs every stage over a list of candidate windows, compacting the survivors after each stage.
+ *
+ * @param cascade The cascade.
+ * @param rects The resolved rectangles of all features.
+ * @param table The integral sum table.
+ * @param origins The window origins, replaced by the survivors.
+ * @param norms The window normalisations, replaced by those of the survivors.
+ * @param scores The output last stage sums of the survivors.
+ * @return Returns the number of window-stage evaluations.
+ */
+static long long run_stages(const HaarCascade* cascade, const HaarRectOffsets* rects, const unsigned int* table,
+                            std::vector<int>& origins, std::vector<float>& norms, std::vector<float>& scores) {
+    const CpuKernels* kernels = cpu_kernels();
+    long long evaluations = 0;
+    std::vector<float> stage_sums;
+
+    for (const HaarStage& stage : cascade->stages) {
+        int count = (int)origins.size();
+        evaluations += count;
+        stage_sums.resize(count);
+        kernels->haar_stage(&cascade->features[stage.first_feature], rects + stage.first_feature * HAAR_MAX_RECTS,
+                            stage.feature_count, table, origins.data(), norms.data(), count, stage_sums.data());
+
+        // Compact the survivors in place
+        int kept = 0;
+        for (int w = 0; w < count; w++) {
+            if (stage_sums[w] >= stage.threshold) {
+                origins[kept] = origins[w];
+                norms[kept] = norms[w];
+                stage_sums[kept] = stage_sums[w];
+                kept++;
+            }
+        }
+        origins.resize(kept);
+        norms.resize(kept);
+        stage_sums.resize(kept);
+        if (kept == 0) {
+            break;
+        }
+    }
+
+    scores = stage_sums;
+    return evaluations;
+}
+
+void haar_cascade_detect(const HaarCascade* cascade, const unsigned char* gray, int width, int height,
+                         int stride, float scale_step, std::vector<Detection>& detections, HaarStats* stats) {
+    detections.clear();
+    stats->windows = 0;
+    stats->stage_windows = 0;
+    stats->accepted = 0;
+    if (cascade->stages.empty() || stride < 1 || scale_step <= 1.0f) {
+        return;
+    }
+
+    const int window_width = cascade->window_width;
+    const int window_height = cascade->window_height;
+    const float area = (float)(window_width * window_height);
+    std::mutex detections_mutex;
+    std::atomic<long long> stage_windows(0);
+
+    Pyramid pyramid;
+    if (!pyramid_build(&pyramid, gray, width, height, scale_step, window_width, window_height)) {
+        return;
+    }
+
+    for (int level = 0; level < pyramid.level_count; level++) {
+        int level_width = pyramid.levels[level].width;
+        int level_height = pyramid.levels[level].height;
+        float scale = pyramid.levels[level].scale;
+        IntegralImage integral;
+        if (!integral_init(&integral, pyramid.levels[level].pixels, level_width, level_height)) {
+            break;
+        }
+
+        // Resolve every rectangle to corner offsets once per level
+        int table_stride = level_width + 1;
+        std::vector<HaarRectOffsets> rects(cascade->features.size() * HAAR_MAX_RECTS);
+        for (size_t f = 0; f < cascade->features.size(); f++) {
+            const HaarFeature& feature = cascade->features[f];
+            for (int r = 0; r < feature.rect_count; r++) {
+                HaarRectOffsets& rect = rects[f * HAAR_MAX_RECTS + r];
+                rect.top_left = feature.y[r] * table_stride + feature.x[r];
+                rect.top_right = rect.top_left + feature.width[r];
+                rect.bottom_left = rect.top_left + feature.height[r] * table_stride;
+                rect.bottom_right = rect.bottom_left + feature.width[r];
+                rect.weight = feature.weight[r];
+            }
+        }
+
+        int rows = (level_height - window_height) / stride + 1;
+        int cols = (level_width - window_width) / stride + 1;
+        stats->windows += (long long)rows * cols;
+
+        parallel_for(rows, 4, [&](int begin, int end) {
+            std::vector<int> origins;
+            std::vector<float> norms;
+            std::vector<float> scores;
+            for (int r = begin; r < end; r++) {
+                int y = r * stride;
+                for (int c = 0; c < cols; c++) {
+                    int x = c * stride;
+                    // Variance normalisation makes the features insensitive to lighting and contrast
+                    float mean = integral_rect_sum(&integral, x, y, window_width, window_height) / area;
+                    float variance = integral_rect_squared(&integral, x, y, window_width, window_height) / area - mean * mean;
+                    float deviation = variance > 1.0f ? sqrtf(variance) : 1.0f;
+                    origins.push_back(y * table_stride + x);
+                    norms.push_back(1.0f / (area * deviation));
+                }
+            }
+
+            long long evaluations = run_stages(cascade, rects.data(), integral.sum, origins, norms, scores);
+            stage_windows += evaluations;
+
+            std::lock_guard<std::mutex> lock(detections_mutex);
+            for (size_t w = 0; w < origins.size(); w++) {
+                Detection detection;
+                detection.x = (origins[w] % table_stride) * scale;
+                detection.y = (origins[w] / table_stride) * scale;
+                detection.width = window_width * scale;
+                detection.height = window_height * scale;
+                detection.distance = -scores[w];
+                detection.match = -1;
+                detection.level = level;
+                detections.push_back(detection);
+            }
+        });
+
+        integral_free(&integral);
+    }
+    pyramid_free(&pyramid);
+
+    std::sort(detections.begin(), detections.end(), [](const Detection& a, const Detection& b) {
+        if (a.distance != b.distance) {
+            return a.distance < b.distance;
+        }
+        if (a.level != b.level) {
+            return a.level < b.level;
+        }
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    });
+    stats->stage_windows = stage_windows;
+    stats->accepted = (long long)detections.size();
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <vector>
+
+#include "detector.h"
+
+#define HAAR_MAX_RECTS 3 // Rectangles per feature
+
+/**
+ * A Haar-like feature: a weighted sum of up to three rectangle sums, normalised by the
+ * window's standard deviation and compared with a threshold.
+ */
+struct HaarFeature {
+    int rect_count;
+    int x[HAAR_MAX_RECTS];
+    int y[HAAR_MAX_RECTS];
+    int width[HAAR_MAX_RECTS];
+    int height[HAAR_MAX_RECTS];
+    float weight[HAAR_MAX_RECTS];
+    float threshold;
+    float left_value;  // Added to the stage sum when the feature value is below the threshold
+    float right_value; // Added otherwise
+};
+
+/**
+ * A feature rectangle resolved to offsets of its corners from the window origin in the integral table.
+ */
+struct HaarRectOffsets {
+    int top_left;
+    int top_right;
+    int bottom_left;
+    int bottom_right;
+    float weight;
+};
+
+/**
+ * A boosted stage: the window passes when the sum of its feature votes reaches the threshold.
+ */
+struct HaarStage {
+    int first_feature;
+    int feature_count;
+    float threshold;
+};
+
+/**
+ * A Viola-Jones cascade evaluated on a fixed window size.
+ */
+struct HaarCascade {
+    int window_width;
+    int window_height;
+    std::vector<HaarStage> stages;
+    std::vector<HaarFeature> features;
+};
+
+/**
+ * Loads a cascade from its text description:
+ *
+ *     haarcascade <window_width> <window_height> <stage_count>
+ *     stage <feature_count> <stage_threshold>
+ *     feature <rect_count> <threshold> <left_value> <right_value>
+ *     rect <x> <y> <width> <height> <weight>
+ *
+ * with one stage line followed by its features, and each feature followed by its rectangles.
+ * Lines starting with '#' are comments.
+ *
+ * @param cascade The cascade to fill.
+ * @param path The file path.
+ * @return Returns true if the file is read and valid, false otherwise.
+ */
+bool haar_cascade_load(HaarCascade* cascade, const char* path);
+
+/**
+ * Work counters of one cascade run.
+ */
+struct HaarStats {
+    long long windows;        // Windows visited over all pyramid levels
+    long long stage_windows;  // Window-stage evaluations (windows surviving into each stage, summed)
+    long long accepted;       // Windows passing every stage
+};
+
+/**
+ * Scans a grayscale image with the cascade over an image pyramid. Windows are evaluated in
+ * batches, stage by stage: after every stage the survivors are compacted, so most windows are
+ * rejected after the first stages and later stages run on dense batches.
+ *
+ * @param cascade The cascade.
+ * @param gray The grayscale image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param stride The window step in pixels at every pyramid level.
+ * @param scale_step The downscale factor between pyramid levels (> 1).
+ * @param detections The output windows passing every stage (distance holds the negated last stage sum).
+ * @param stats The output work counters.
+ */
+void haar_cascade_detect(const HaarCascade* cascade, const unsigned char* gray, int width, int height,
+                         int stride, float scale_step, std::vector<Detection>& detections, HaarStats* stats);
@@ -0,0 +1,98 @@
+#include "hog.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * Precomputes, for every pixel coordinate, the two cells it is spread over and their weights.
+ *
+ * @param size The number of pixels along the axis.
+ * @param first The output array of first cell indices (-1 before the first cell centre).
+ * @param second_weight The output array of weights of the second cell (first + 1).
+ */
+static void bilinear_table(int size, int* first, float* second_weight) {
+    for (int i = 0; i < size; i++) {
+        // Position relative to the cell centres
+        float f = (i + 0.5f) / HOG_CELL - 0.5f;
+        int c = (int)floorf(f);
+        first[i] = c;
+        second_weight[i] = f - c;
+    }
+}
+
+void compute_hog(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                 const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                 float* descriptor) {
+    const unsigned char* planes[HOG_BINS] = { grad_horizontal, grad_vertical, grad_45, grad_minus_45 };
+    int cells = size / HOG_CELL;
+
+    int first[HOG_MAX_SIZE];
+    float second_weight[HOG_MAX_SIZE];
+    float histogram[(HOG_MAX_SIZE / HOG_CELL) * (HOG_MAX_SIZE / HOG_CELL) * HOG_BINS];
+    bilinear_table(size, first, second_weight);
+    memset(histogram, 0, cells * cells * HOG_BINS * sizeof(float));
+
+    // Cell histograms: bin b of cell (cx, cy) accumulates plane b's responses around that cell
+    for (int y = 0; y < size; y++) {
+        int cy0 = first[y];
+        float wy1 = second_weight[y];
+        float wy[2] = { 1.0f - wy1, wy1 };
+
+        for (int x = 0; x < size; x++) {
+            int cx0 = first[x];
+            float wx1 = second_weight[x];
+            float wx[2] = { 1.0f - wx1, wx1 };
+
+            for (int dy = 0; dy < 2; dy++) {
+                int cy = cy0 + dy;
+                if (cy < 0 || cy >= cells) {
+                    continue;
+                }
+                for (int dx = 0; dx < 2; dx++) {
+                    int cx = cx0 + dx;
+                    if (cx < 0 || cx >= cells) {
+                        continue;
+                    }
+                    float w = wy[dy] * wx[dx];
+                    float* bins = histogram + (cy * cells + cx) * HOG_BINS;
+                    for (int b = 0; b < HOG_BINS; b++) {
+                        bins[b] += w * planes[b][y * size + x];
+                    }
+                }
+            }
+        }
+    }
+
+    // Block normalisation (L2-Hys): normalise, clip large components, normalise again
+    int blocks = (cells - HOG_BLOCK) / HOG_BLOCK_STRIDE + 1;
+    const int block_length = HOG_BLOCK * HOG_BLOCK * HOG_BINS;
+    const float epsilon = 1e-3f;
+    float* out = descriptor;
+
+    for (int by = 0; by < blocks; by++) {
+        for (int bx = 0; bx < blocks; bx++) {
+            int n = 0;
+            for (int cy = by * HOG_BLOCK_STRIDE; cy < by * HOG_BLOCK_STRIDE + HOG_BLOCK; cy++) {
+                for (int cx = bx * HOG_BLOCK_STRIDE; cx < bx * HOG_BLOCK_STRIDE + HOG_BLOCK; cx++) {
+                    memcpy(out + n, histogram + (cy * cells + cx) * HOG_BINS, HOG_BINS * sizeof(float));
+                    n += HOG_BINS;
+                }
+            }
+
+            for (int pass = 0; pass < 2; pass++) {
+                float norm = epsilon * epsilon;
+                for (int i = 0; i < block_length; i++) {
+                    norm += out[i] * out[i];
+                }
+                float scale = 1.0f / sqrtf(norm);
+                for (int i = 0; i < block_length; i++) {
+                    out[i] *= scale;
+                    if (pass == 0 && out[i] > HOG_CLIP) {
+                        out[i] = HOG_CLIP;
+                    }
+                }
+            }
+            out += block_length;
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#define HOG_CELL 8 // Cell size in pixels
+#define HOG_BINS 4 // One orientation bin per directional gradient plane
+#define HOG_BLOCK 2 // Block size in cells
+#define HOG_BLOCK_STRIDE 2 // Block step in cells
+#define HOG_CLIP 0.2f // L2-Hys clipping threshold
+#define HOG_MAX_SIZE 128 // Largest plane size, which bounds the stack tables of compute_hog()
+
+/**
+ * Returns the number of floats in the descriptor of a size x size image.
+ *
+ * @param size The width and height of the gradient planes.
+ * @return Returns the descriptor length.
+ */
+inline int hog_descriptor_size(int size) {
+    int cells = size / HOG_CELL;
+    int blocks = (cells - HOG_BLOCK) / HOG_BLOCK_STRIDE + 1;
+    return blocks * blocks * HOG_BLOCK * HOG_BLOCK * HOG_BINS;
+}
+
+/**
+ * Pools the four directional gradient planes into cell-wise orientation histograms
+ * and normalises them per block (L2-Hys), HOG style. Every pixel is spread bilinearly
+ * over its four nearest cells, so small misalignments move weight between cells
+ * instead of changing which cell a response lands in. The 64 x 64 planes pool into 256 floats,
+ * which --quant int8 stores in 256 bytes instead of the 16 KB of the planes.
+ *
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @param size The width and height of the planes, a multiple of HOG_CELL and at most HOG_MAX_SIZE.
+ * @param descriptor The output array of hog_descriptor_size(size) floats.
+ */
+void compute_hog(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                 const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                 float* descriptor);
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "mem_stats.h"
+#include "cpu_dispatch.h"
+
+// Decoder memory is accounted to the decode stage
+#define STBI_MALLOC(size) mem_alloc(STAGE_DECODE, size)
+#define STBI_REALLOC(block, size) mem_realloc(STAGE_DECODE, block, size)
+#define STBI_FREE(block) mem_free(block)
+// The SIMD IDCT and colour conversion follow the dispatch level, with the NEON ones on ARM
+#define STBI_SIMD_ENABLED() (cpu_level() != CPU_SCALAR)
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define STBI_NEON
+#endif
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "image_features.h"
+#include "stage_timer.h"
+#include "perf_counters.h"
+
+/**
+ * Returns stbir's work memory: the scratch buffer, grown if needed, or a fresh block without one.
+ *
+ * @param size The number of bytes.
+ * @param scratch The scratch buffer, or NULL.
+ * @return Returns the memory, or NULL if it runs out.
+ */
+static void* resize_scratch_alloc(size_t size, ResizeScratch* scratch) {
+    if (!scratch) {
+        return mem_alloc(STAGE_RESIZE, size);
+    }
+    if (size > scratch->capacity) {
+        void* memory = mem_realloc(STAGE_RESIZE, scratch->memory, size);
+        if (!memory) {
+            return NULL;
+        }
+        scratch->memory = memory;
+        scratch->capacity = size;
+    }
+    return scratch->memory;
+}
+
+/**
+ * Releases stbir's work memory; scratch buffers are kept for the next resize.
+ *
+ * @param memory The memory.
+ * @param scratch The scratch buffer, or NULL.
+ */
+static void resize_scratch_release(void* memory, ResizeScratch* scratch) {
+    if (!scratch) {
+        mem_free(memory);
+    }
+}
+
+// Resizes given a ResizeScratch context reuse its buffer instead of allocating every call
+#define STBIR_MALLOC(size, context) resize_scratch_alloc(size, (ResizeScratch*)(context))
+#define STBIR_FREE(ptr, context) resize_scratch_release(ptr, (ResizeScratch*)(context))
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb_image_resize.h"
+
+// Filter definitions
+float filter_horizontal[FILTER_SIZE * FILTER_SIZE] = {
+    0,  0,  0, 0, 0,
+    1,  1,  1, 1, 1,
+    0,  0,  0, 0, 0,
+    -1,-1, -1, -1, -1,
+    0,  0,  0, 0, 0
+};
+
+float filter_vertical[FILTER_SIZE * FILTER_SIZE] = {
+    0,  1,  0,  -1,  0,
+    0,  1,  0,  -1,  0,
+    0,  1,  0,  -1,  0,
+    0,  1,  0,  -1,  0,
+    0,  1,  0,  -1,  0
+};
+
+float filter_45[FILTER_SIZE * FILTER_SIZE] = {
+    0,  0,  0,  1,  0,
+    0,  1,  1,  0,  -1,
+    0,  1,  0,  -1, 0,
+    1,  0,  -1,  -1,0,
+    0,  -1, 0,   0, 0
+};
+
+float filter_minus_45[FILTER_SIZE * FILTER_SIZE] = {
+    0, -1, 0,  0,0,
+    1, 0, -1, -1,0,
+    0, 1,  0, -1,0,
+    0, 1,  1, 0, -1,
+    0,  0, 0, 1, 0
+};
+
+void convolve_rect(const unsigned char* image, int width, int height, const float* filter, int filter_size,
+                   int left, int top, int right, int bottom, unsigned char* result) {
+    int offset = filter_size / 2;
+    const CpuKernels* kernels = cpu_kernels();
+
+    // Only the non-zero taps are visited; skipping zero products leaves every sum unchanged
+    int tap_offsets[FILTER_SIZE * FILTER_SIZE];
+    float tap_weights[FILTER_SIZE * FILTER_SIZE];
+    int taps = 0;
+    for (int fy = 0; fy < filter_size; fy++) {
+        for (int fx = 0; fx < filter_size; fx++) {
+            if (filter[fy * filter_size + fx] != 0.0f) {
+                tap_offsets[taps] = (fy - offset) * width + (fx - offset);
+                tap_weights[taps] = filter[fy * filter_size + fx];
+                taps++;
+            }
+        }
+    }
+
+    for (int y = top; y < bottom; y++) {
+        unsigned char* out = result + (size_t)y * width;
+        // Clear the border so results never carry uninitialised memory into the comparisons
+        int begin = left > offset ? left : offset;
+        int end = right < width - offset ? right : width - offset;
+        if (y < offset || y >= height - offset || begin >= end) {
+            memset(out + left, 0, right - left);
+            continue;
+        }
+        if (begin > left) {
+            memset(out + left, 0, begin - left);
+        }
+        if (end < right) {
+            memset(out + end, 0, right - end);
+        }
+
+        kernels->convolve_row(image + (size_t)y * width + begin, end - begin, tap_offsets, tap_weights, taps, out + begin);
+    }
+}
+
+void convolution(unsigned char* image, int width, int height, float* filter, int filter_size, unsigned char* result) {
+    convolve_rect(image, width, height, filter, filter_size, 0, 0, width, height, result);
+}
+
+bool process_image(const char* imagePath, unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45) {
+    int width, height, channels;
+    PerfSample counters;
+    perf_begin(&counters);
+    long long start = stage_now();
+    unsigned char* img = stbi_load(imagePath, &width, &height, &channels, 1); // Load as grayscale
+    stage_record(STAGE_DECODE, start);
+    perf_end(PERF_DECODE, &counters, img ? (unsigned long long)width * height : 0);
+
+    if (!img) {
+        printf("Failed to load image %s!\n", imagePath);
+        return false;
+    }
+
+    extract_gradients(img, width, height, width, grad_horizontal, grad_vertical, grad_45, grad_minus_45);
+
+    stbi_image_free(img);
+    return true;
+}
+
+bool process_image_roi(const char* imagePath, int roi_x, int roi_y, int roi_width, int roi_height,
+                       unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45) {
+    // The ROI decoder works on memory, so the whole file is read first
+    FILE* file = fopen(imagePath, "rb");
+    if (!file) {
+        printf("Failed to load image %s!\n", imagePath);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* data = length > 0 ? (unsigned char*)mem_alloc(STAGE_DECODE, length) : NULL;
+    bool read = data && fread(data, 1, length, file) == (size_t)length;
+    fclose(file);
+
+    int width, height, channels;
+    PerfSample counters;
+    perf_begin(&counters);
+    long long start = stage_now();
+    unsigned char* img = read ? stbi_load_from_memory_roi(data, (int)length, roi_x, roi_y, roi_width, roi_height,
+                                                          &width, &height, &channels, 1) : NULL;
+    stage_record(STAGE_DECODE, start);
+    perf_end(PERF_DECODE, &counters, img ? (unsigned long long)width * height : 0);
+    mem_free(data);
+    if (!img) {
+        printf("Failed to load region %d,%d %dx%d of image %s!\n", roi_x, roi_y, roi_width, roi_height, imagePath);
+        return false;
+    }
+
+    extract_gradients(img, width, height, width, grad_horizontal, grad_vertical, grad_45, grad_minus_45);
+
+    stbi_image_free(img);
+    return true;
+}
+
+void extract_gradients(const unsigned char* gray, int width, int height, int stride, unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45) {
+    unsigned char resized_img[SIZE * SIZE];
+    // Resize the region to a 64x64 pixel matrix
+    PerfSample counters;
+    perf_begin(&counters);
+    long long start = stage_now();
+    stbir_resize_uint8(gray, width, height, stride, resized_img, SIZE, SIZE, 0, 1);
+    stage_record(STAGE_RESIZE, start);
+    perf_end(PERF_RESIZE, &counters, (unsigned long long)width * height);
+
+    // Apply convolutions for different directions
+    perf_begin(&counters);
+    start = stage_now();
+    convolution(resized_img, SIZE, SIZE, filter_horizontal, FILTER_SIZE, grad_horizontal);
+    convolution(resized_img, SIZE, SIZE, filter_vertical, FILTER_SIZE, grad_vertical);
+    convolution(resized_img, SIZE, SIZE, filter_45, FILTER_SIZE, grad_45);
+    convolution(resized_img, SIZE, SIZE, filter_minus_45, FILTER_SIZE, grad_minus_45);
+    stage_record(STAGE_CONVOLUTION, start);
+    perf_end(PERF_CONVOLUTION, &counters, 4 * SIZE * SIZE);
+}
+
+bool resize_gray(const unsigned char* input, int input_width, int input_height, int input_stride,
+                 unsigned char* output, int output_width, int output_height, ResizeScratch* scratch) {
+    // Same filter and edge settings as stbir_resize_uint8()
+    return stbir_resize_uint8_generic(input, input_width, input_height, input_stride, output, output_width, output_height, 0, 1,
+                                      -1, 0, STBIR_EDGE_CLAMP, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, scratch) != 0;
+}
+
+bool resize_gray_rect(const unsigned char* input, int input_width, int input_height, int input_stride,
+                      unsigned char* output, int output_width, int output_height,
+                      int left, int top, int right, int bottom, ResizeScratch* scratch) {
+    return resize_gray_region(input, input_width, input_height, input_stride, output_width, output_height,
+                              left, top, right, bottom, output + (size_t)top * output_width + left, output_width, scratch);
+}
+
+bool resize_gray_region(const unsigned char* input, int input_width, int input_height, int input_stride,
+                        int output_width, int output_height, int left, int top, int right, int bottom,
+                        unsigned char* region, int region_stride, ResizeScratch* scratch) {
+    if (right <= left || bottom <= top) {
+        return true;
+    }
+    // The scale of the full resize with the output shifted to the rectangle: the sampling positions
+    // and filter weights of every pixel are the same as in resize_gray()
+    return stbir_resize_subpixel(input, input_width, input_height, input_stride,
+                                 region, right - left, bottom - top, region_stride,
+                                 STBIR_TYPE_UINT8, 1, -1, 0, STBIR_EDGE_CLAMP, STBIR_EDGE_CLAMP,
+                                 STBIR_FILTER_DEFAULT, STBIR_FILTER_DEFAULT, STBIR_COLORSPACE_LINEAR, scratch,
+                                 (float)output_width / input_width, (float)output_height / input_height,
+                                 (float)left, (float)top) != 0;
+}
+
+void resize_scratch_free(ResizeScratch* scratch) {
+    mem_free(scratch->memory);
+    scratch->memory = NULL;
+    scratch->capacity = 0;
+}
+
+double compare_images(unsigned char* img1, unsigned char* img2) {
+    double distance = 0.0;
+    for (int i = 0; i < SIZE * SIZE; i++) {
+        distance += pow((double)(img1[i] - img2[i]), 2);
+    }
+    return sqrt(distance);
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stddef.h>
+
+#define SIZE 64 // Matrix size 64x64 pixels
+#define FILTER_SIZE 5 // Filter size 5x5
+
+// Filter definitions
+extern float filter_horizontal[FILTER_SIZE * FILTER_SIZE];
+extern float filter_vertical[FILTER_SIZE * FILTER_SIZE];
+extern float filter_45[FILTER_SIZE * FILTER_SIZE];
+extern float filter_minus_45[FILTER_SIZE * FILTER_SIZE];
+
+/**
+ * Applies the convolution operation using the provided filter.
+ * Border pixels the filter cannot cover are set to zero.
+ *
+ * @param image The grayscale image data.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param filter The filter to apply.
+ * @param filter_size The size of the filter.
+ * @param result The output array for the filtered image.
+ */
+void convolution(unsigned char* image, int width, int height, float* filter, int filter_size, unsigned char* result);
+
+/**
+ * Applies the convolution to a rectangle of the output only, reading the pixels around it as
+ * needed. Output pixels of the rectangle the filter cannot cover are set to zero, so rectangles
+ * tiling the image produce exactly the result of convolution().
+ *
+ * @param image The grayscale image data.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param filter The filter to apply.
+ * @param filter_size The size of the filter (at most FILTER_SIZE).
+ * @param left The left edge of the rectangle.
+ * @param top The top edge of the rectangle.
+ * @param right The right edge of the rectangle (exclusive).
+ * @param bottom The bottom edge of the rectangle (exclusive).
+ * @param result The output array for the filtered image, of the size of the image.
+ */
+void convolve_rect(const unsigned char* image, int width, int height, const float* filter, int filter_size,
+                   int left, int top, int right, int bottom, unsigned char* result);
+
+/**
+ * Loads and processes an image, resizing and applying convolution with the filters.
+ *
+ * @param imagePath The path of the image file.
+ * @param grad_horizontal The output array for the horizontal gradient.
+ * @param grad_vertical The output array for the vertical gradient.
+ * @param grad_45 The output array for the 45-degree gradient.
+ * @param grad_minus_45 The output array for the -45-degree gradient.
+ * @return Returns true if the image is successfully processed, false otherwise.
+ */
+bool process_image(const char* imagePath, unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45);
+
+/**
+ * Loads only a rectangle of an image and processes it like process_image(). For a JPEG, the
+ * blocks away from the rectangle are never transformed or colour converted.
+ *
+ * @param imagePath The path of the image file.
+ * @param roi_x The left edge of the rectangle.
+ * @param roi_y The top edge of the rectangle.
+ * @param roi_width The width of the rectangle.
+ * @param roi_height The height of the rectangle.
+ * @param grad_horizontal The output array for the horizontal gradient.
+ * @param grad_vertical The output array for the vertical gradient.
+ * @param grad_45 The output array for the 45-degree gradient.
+ * @param grad_minus_45 The output array for the -45-degree gradient.
+ * @return Returns true if the rectangle is successfully processed, false otherwise.
+ */
+bool process_image_roi(const char* imagePath, int roi_x, int roi_y, int roi_width, int roi_height,
+                       unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45);
+
+/**
+ * Resizes a grayscale region to SIZE x SIZE and applies convolution with the filters,
+ * the same way process_image() does for a whole image file.
+ *
+ * @param gray The first pixel of the region.
+ * @param width The width of the region.
+ * @param height The height of the region.
+ * @param stride The row stride of the image holding the region, in bytes.
+ * @param grad_horizontal The output array for the horizontal gradient.
+ * @param grad_vertical The output array for the vertical gradient.
+ * @param grad_45 The output array for the 45-degree gradient.
+ * @param grad_minus_45 The output array for the -45-degree gradient.
+ */
+void extract_gradients(const unsigned char* gray, int width, int height, int stride, unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45);
+
+/**
+ * Reusable work memory for resize_gray(), so repeated resizes do not allocate every call.
+ * A scratch buffer must not be used by two threads at once.
+ */
+struct ResizeScratch {
+    void* memory;
+    size_t capacity;
+};
+
+/**
+ * Resizes a grayscale image with the same filter as stbir_resize_uint8().
+ *
+ * @param input The input image.
+ * @param input_width The width of the input.
+ * @param input_height The height of the input.
+ * @param input_stride The row stride of the input in bytes, 0 for tightly packed rows.
+ * @param output The output image, tightly packed.
+ * @param output_width The width of the output.
+ * @param output_height The height of the output.
+ * @param scratch The scratch buffer to work in (grown as needed), or NULL to allocate.
+ * @return Returns true if the image is resized, false if memory runs out.
+ */
+bool resize_gray(const unsigned char* input, int input_width, int input_height, int input_stride,
+                 unsigned char* output, int output_width, int output_height, ResizeScratch* scratch);
+
+/**
+ * Computes one rectangle of a resize_gray() output: the pixels are exactly those of the full
+ * resize, but only the input rows the rectangle depends on are read.
+ *
+ * @param input The input image.
+ * @param input_width The width of the input.
+ * @param input_height The height of the input.
+ * @param input_stride The row stride of the input in bytes, 0 for tightly packed rows.
+ * @param output The full output image, tightly packed; only the rectangle is written.
+ * @param output_width The width of the full output.
+ * @param output_height The height of the full output.
+ * @param left The left edge of the rectangle.
+ * @param top The top edge of the rectangle.
+ * @param right The right edge of the rectangle (exclusive).
+ * @param bottom The bottom edge of the rectangle (exclusive).
+ * @param scratch The scratch buffer to work in (grown as needed), or NULL to allocate.
+ * @return Returns true if the rectangle is resized, false if memory runs out.
+ */
+bool resize_gray_rect(const unsigned char* input, int input_width, int input_height, int input_stride,
+                      unsigned char* output, int output_width, int output_height,
+                      int left, int top, int right, int bottom, ResizeScratch* scratch);
+
+/**
+ * Computes one rectangle of a resize_gray() output into a buffer of its own, e.g. a few rows of a
+ * strip: the pixels are exactly those of the full resize.
+ *
+ * @param input The input image.
+ * @param input_width The width of the input.
+ * @param input_height The height of the input.
+ * @param input_stride The row stride of the input in bytes, 0 for tightly packed rows.
+ * @param output_width The width of the full output.
+ * @param output_height The height of the full output.
+ * @param left The left edge of the rectangle.
+ * @param top The top edge of the rectangle.
+ * @param right The right edge of the rectangle (exclusive).
+ * @param bottom The bottom edge of the rectangle (exclusive).
+ * @param region The output for the rectangle's first pixel.
+ * @param region_stride The row stride of the region in bytes.
+ * @param scratch The scratch buffer to work in (grown as needed), or NULL to allocate.
+ * @return Returns true if the rectangle is resized, false if memory runs out.
+ */
+bool resize_gray_region(const unsigned char* input, int input_width, int input_height, int input_stride,
+                        int output_width, int output_height, int left, int top, int right, int bottom,
+                        unsigned char* region, int region_stride, ResizeScratch* scratch);
+
+/**
+ * Releases the memory held by a scratch buffer.
+ *
+ * @param scratch The scratch buffer.
+ */
+void resize_scratch_free(ResizeScratch* scratch);
+
+/**
+ * Compares two gradient images by calculating the Euclidean distance between their pixel values.
+ *
+ * @param img1 The first image data.
+ * @param img2 The second image data.
+ * @return Returns the calculated Euclidean distance between the two images.
+ */
+double compare_images(unsigned char* img1, unsigned char* img2);
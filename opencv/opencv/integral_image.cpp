@@ -0,0 +1,116 @@
+#include "integral_image.h"
+#include "mem_stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool integral_init(IntegralImage* integral, const unsigned char* image, int width, int height) {
+    size_t table_size = ((size_t)width + 1) * (height + 1);
+    integral->sum = (unsigned int*)mem_alloc(STAGE_DETECT, table_size * sizeof(unsigned int));
+    integral->squared = (unsigned int*)mem_alloc(STAGE_DETECT, table_size * sizeof(unsigned int));
+    if (!integral->sum || !integral->squared) {
+        integral_free(integral);
+        return false;
+    }
+    integral_compute(integral, image, width, height);
+    return true;
+}
+
+void integral_compute(IntegralImage* integral, const unsigned char* image, int width, int height) {
+    size_t stride = (size_t)width + 1;
+    integral->width = width;
+    integral->height = height;
+
+    memset(integral->sum, 0, stride * sizeof(unsigned int));
+    memset(integral->squared, 0, stride * sizeof(unsigned int));
+    for (int y = 0; y < height; y++) {
+        const unsigned char* row = image + (size_t)y * width;
+        const unsigned int* sum_above = integral->sum + (size_t)y * stride;
+        const unsigned int* squared_above = integral->squared + (size_t)y * stride;
+        unsigned int* sum_out = integral->sum + (size_t)(y + 1) * stride;
+        unsigned int* squared_out = integral->squared + (size_t)(y + 1) * stride;
+
+        // Running row sums plus the table row above; overflow wraps harmlessly (see header)
+        unsigned int row_sum = 0;
+        unsigned int row_squared = 0;
+        sum_out[0] = 0;
+        squared_out[0] = 0;
+        for (int x = 0; x < width; x++) {
+            unsigned int pixel = row[x];
+            row_sum += pixel;
+            row_squared += pixel * pixel;
+            sum_out[x + 1] = sum_above[x + 1] + row_sum;
+            squared_out[x + 1] = squared_above[x + 1] + row_squared;
+        }
+    }
+}
+
+void integral_free(IntegralImage* integral) {
+    mem_free(integral->sum);
+    mem_free(integral->squared);
+    integral->sum = NULL;
+    integral->squared = NULL;
+}
+
+void window_stats_from_integrals(const IntegralImage integrals[4], int x, int y, WindowStats* stats) {
+    const int offset = FILTER_SIZE / 2;
+    for (int p = 0; p < 4; p++) {
+        double energy = 0.0;
+        for (int cy = 0; cy < WINDOW_CELLS; cy++) {
+            for (int cx = 0; cx < WINDOW_CELLS; cx++) {
+                int left = x + offset + cx * WINDOW_CELL_SIZE;
+                int top = y + offset + cy * WINDOW_CELL_SIZE;
+                int cell = cy * WINDOW_CELLS + cx;
+                stats->sum[p][cell] = (float)integral_rect_sum(&integrals[p], left, top, WINDOW_CELL_SIZE, WINDOW_CELL_SIZE);
+                stats->squared[p][cell] = (float)integral_rect_squared(&integrals[p], left, top, WINDOW_CELL_SIZE, WINDOW_CELL_SIZE);
+                energy += stats->squared[p][cell];
+            }
+        }
+        stats->energy[p] = energy;
+    }
+}
+
+void window_stats_from_entry(const unsigned char* entry, WindowStats* stats) {
+    const int offset = FILTER_SIZE / 2;
+    for (int p = 0; p < 4; p++) {
+        const unsigned char* plane = entry + p * GALLERY_PLANE_SIZE;
+        double energy = 0.0;
+        for (int cy = 0; cy < WINDOW_CELLS; cy++) {
+            for (int cx = 0; cx < WINDOW_CELLS; cx++) {
+                unsigned int sum = 0;
+                unsigned int squared = 0;
+                for (int y = 0; y < WINDOW_CELL_SIZE; y++) {
+                    const unsigned char* row = plane + (offset + cy * WINDOW_CELL_SIZE + y) * SIZE + offset + cx * WINDOW_CELL_SIZE;
+                    for (int x = 0; x < WINDOW_CELL_SIZE; x++) {
+                        sum += row[x];
+                        squared += row[x] * row[x];
+                    }
+                }
+                int cell = cy * WINDOW_CELLS + cx;
+                stats->sum[p][cell] = (float)sum;
+                stats->squared[p][cell] = (float)squared;
+                energy += squared;
+            }
+        }
+        stats->energy[p] = energy;
+    }
+}
+
+double window_distance_lower_bound(const WindowStats* window, const WindowStats* entry) {
+    const float inverse_area = 1.0f / (WINDOW_CELL_SIZE * WINDOW_CELL_SIZE);
+    double bound = 0.0;
+    for (int p = 0; p < 4; p++) {
+        float squared_bound = 0.0f;
+        for (int cell = 0; cell < WINDOW_CELLS * WINDOW_CELLS; cell++) {
+            float mean_gap = window->sum[p][cell] - entry->sum[p][cell];
+            float norm_gap = sqrtf(window->squared[p][cell]) - sqrtf(entry->squared[p][cell]);
+            float by_mean = mean_gap * mean_gap * inverse_area;
+            float by_norm = norm_gap * norm_gap;
+            squared_bound += by_mean > by_norm ? by_mean : by_norm;
+        }
+        bound += sqrt((double)squared_bound);
+    }
+    // Float rounding must never push the bound above the exact distance
+    return bound / 4.0 * (1.0 - 1e-5);
+}
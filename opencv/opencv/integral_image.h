@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "gallery.h"
+
+#define WINDOW_CELLS 4 // The window interior is split into 4x4 cells for the lower bound
+#define WINDOW_INTERIOR (SIZE - 2 * (FILTER_SIZE / 2)) // Compared part of a window (60 pixels)
+#define WINDOW_CELL_SIZE (WINDOW_INTERIOR / WINDOW_CELLS)
+
+/**
+ * Summed-area tables of an image and of its squared values, with a zero first row and column.
+ * Tables are 32-bit and wrap around: a rectangle's sum is still exact as long as the true sum
+ * fits in 32 bits, which holds for any window-sized rectangle of 8-bit data.
+ */
+struct IntegralImage {
+    int width;
+    int height;
+    unsigned int* sum;     // (width + 1) * (height + 1) values
+    unsigned int* squared; // (width + 1) * (height + 1) values
+};
+
+/**
+ * Builds the integral and squared integral images of an 8-bit image.
+ *
+ * @param integral The integral image to initialise.
+ * @param image The image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @return Returns true if the tables are built, false if memory runs out.
+ */
+bool integral_init(IntegralImage* integral, const unsigned char* image, int width, int height);
+
+/**
+ * Rebuilds the tables of an integral image in place, for reusing them across images.
+ *
+ * @param integral The integral image, with tables of at least (width + 1) * (height + 1) values.
+ * @param image The image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ */
+void integral_compute(IntegralImage* integral, const unsigned char* image, int width, int height);
+
+/**
+ * Returns the sum of the pixels in a rectangle in O(1).
+ *
+ * @param integral The integral image.
+ * @param x The left edge of the rectangle.
+ * @param y The top edge of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return Returns the pixel sum.
+ */
+inline unsigned int integral_rect_sum(const IntegralImage* integral, int x, int y, int width, int height) {
+    int stride = integral->width + 1;
+    const unsigned int* top = integral->sum + (size_t)y * stride + x;
+    const unsigned int* bottom = top + (size_t)height * stride;
+    return bottom[width] - bottom[0] - top[width] + top[0];
+}
+
+/**
+ * Returns the sum of the squared pixels (the energy) in a rectangle in O(1).
+ *
+ * @param integral The integral image.
+ * @param x The left edge of the rectangle.
+ * @param y The top edge of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return Returns the energy.
+ */
+inline unsigned int integral_rect_squared(const IntegralImage* integral, int x, int y, int width, int height) {
+    int stride = integral->width + 1;
+    const unsigned int* top = integral->squared + (size_t)y * stride + x;
+    const unsigned int* bottom = top + (size_t)height * stride;
+    return bottom[width] - bottom[0] - top[width] + top[0];
+}
+
+/**
+ * Releases the memory held by an integral image.
+ *
+ * @param integral The integral image.
+ */
+void integral_free(IntegralImage* integral);
+
+/**
+ * Per-cell sums and energies of the four gradient planes over a window interior.
+ */
+struct WindowStats {
+    float sum[4][WINDOW_CELLS * WINDOW_CELLS];
+    float squared[4][WINDOW_CELLS * WINDOW_CELLS];
+    double energy[4]; // Whole-interior energy per plane
+};
+
+/**
+ * Gathers the window statistics at (x, y) from the integral images of the four planes, in O(1).
+ *
+ * @param integrals The integral images of the four gradient planes.
+ * @param x The left edge of the window.
+ * @param y The top edge of the window.
+ * @param stats The output statistics.
+ */
+void window_stats_from_integrals(const IntegralImage integrals[4], int x, int y, WindowStats* stats);
+
+/**
+ * Gathers the same statistics from a packed gallery entry.
+ *
+ * @param entry The packed entry.
+ * @param stats The output statistics.
+ */
+void window_stats_from_entry(const unsigned char* entry, WindowStats* stats);
+
+/**
+ * Returns a lower bound of window_distance() from the statistics alone. Within every cell of n
+ * pixels, sum((w - t)^2) is at least (sum(w) - sum(t))^2 / n (Cauchy-Schwarz) and at least
+ * (|w| - |t|)^2 (triangle inequality), so windows whose bound already exceeds the detection
+ * threshold can be rejected without touching their pixels.
+ *
+ * @param window The window statistics.
+ * @param entry The template or gallery entry statistics.
+ * @return Returns the lower bound of the mean per-plane distance.
+ */
+double window_distance_lower_bound(const WindowStats* window, const WindowStats* entry);
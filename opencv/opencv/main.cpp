@@ -1,210 +1,945 @@
-﻿#include <stdio.h>
-#include <stdlib.h>
-#include <math.h>
-
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
-
-#define SIZE 64 // Matrix size 64x64 pixels
-#define FILTER_SIZE 5 // Filter size 5x5
-#define NUM_TRAIN_IMAGES 10 // Number of training images
-
-const char* image_files[] = {
-    "face/face1.jpg",
-    "face/face2.jpg",
-    "face/face3.jpg",
-    "face/face4.jpg",
-    "face/face5.jpg",
-    "face/face6.jpg",
-    "face/face7.jpg",
-    "face/face8.jpg",
-    "face/face9.jpg",
-    "face/face10.jpg"
-};
-
-// Filter definitions
-float filter_horizontal[FILTER_SIZE * FILTER_SIZE] = {
-    0,  0,  0, 0, 0,
-    1,  1,  1, 1, 1,
-    0,  0,  0, 0, 0,
-    -1,-1, -1, -1, -1,
-    0,  0,  0, 0, 0
-};
-
-float filter_vertical[FILTER_SIZE * FILTER_SIZE] = {
-    0,  1,  0,  -1,  0,
-    0,  1,  0,  -1,  0,
-    0,  1,  0,  -1,  0,
-    0,  1,  0,  -1,  0,
-    0,  1,  0,  -1,  0
-};
-
-float filter_45[FILTER_SIZE * FILTER_SIZE] = {
-    0,  0,  0,  1,  0,
-    0,  1,  1,  0,  -1,
-    0,  1,  0,  -1, 0,
-    1,  0,  -1,  -1,0,
-    0,  -1, 0,   0, 0
-};
-
-float filter_minus_45[FILTER_SIZE * FILTER_SIZE] = {
-    0, -1, 0,  0,0,
-    1, 0, -1, -1,0,
-    0, 1,  0, -1,0,
-    0, 1,  1, 0, -1,
-    0,  0, 0, 1, 0
-};
-
-/**
- * Applies the convolution operation using the provided filter.
- *
- * @param image The grayscale image data.
- * @param width The width of the image.
- * @param height The height of the image.
- * @param filter The filter to apply.
- * @param filter_size The size of the filter.
- * @param result The output array for the filtered image.
- */
-void convolution(unsigned char* image, int width, int height, float* filter, int filter_size, unsigned char* result) {
-    int offset = filter_size / 2;
-
-    for (int y = offset; y < height - offset; y++) {
-        for (int x = offset; x < width - offset; x++) {
-            float sum = 0.0;
-            for (int fy = 0; fy < filter_size; fy++) {
-                for (int fx = 0; fx < filter_size; fx++) {
-                    int pixel = image[(y + fy - offset) * width + (x + fx - offset)];
-                    sum += filter[fy * filter_size + fx] * pixel;
-                }
-            }
-            result[y * width + x] = (unsigned char)(fmin(fmax(sum, 0), 255));
-        }
-    }
-}
-
-/**
- * Loads and processes an image, resizing and applying convolution with the filters.
- *
- * @param imagePath The path of the image file.
- * @param grad_horizontal The output array for the horizontal gradient.
- * @param grad_vertical The output array for the vertical gradient.
- * @param grad_45 The output array for the 45-degree gradient.
- * @param grad_minus_45 The output array for the -45-degree gradient.
- * @return Returns true if the image is successfully processed, false otherwise.
- */
-bool process_image(const char* imagePath, unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45) {
-    int width, height, channels;
-    unsigned char* img = stbi_load(imagePath, &width, &height, &channels, 1); // Load as grayscale
-
-    if (!img) {
-        printf("Failed to load image %s!\n", imagePath);
-        return false;
-    }
-
-    unsigned char* resized_img = (unsigned char*)malloc(SIZE * SIZE);
-    // Resize the image to a 64x64 pixel matrix
-    stbir_resize_uint8(img, width, height, 0, resized_img, SIZE, SIZE, 0, 1);
-
-    // Apply convolutions for different directions
-    convolution(resized_img, SIZE, SIZE, filter_horizontal, FILTER_SIZE, grad_horizontal);
-    convolution(resized_img, SIZE, SIZE, filter_vertical, FILTER_SIZE, grad_vertical);
-    convolution(resized_img, SIZE, SIZE, filter_45, FILTER_SIZE, grad_45);
-    convolution(resized_img, SIZE, SIZE, filter_minus_45, FILTER_SIZE, grad_minus_45);
-
-    stbi_image_free(img);
-    free(resized_img);
-    return true;
-}
-
-/**
- * Compares two gradient images by calculating the Euclidean distance between their pixel values.
- *
- * @param img1 The first image data.
- * @param img2 The second image data.
- * @return Returns the calculated Euclidean distance between the two images.
- */
-double compare_images(unsigned char* img1, unsigned char* img2) {
-    double distance = 0.0;
-    for (int i = 0; i < SIZE * SIZE; i++) {
-        distance += pow((double)(img1[i] - img2[i]), 2);
-    }
-    return sqrt(distance);
-}
-
-int main() {
-    // Arrays to hold the processed training images
-    unsigned char* train_grad_horizontal[NUM_TRAIN_IMAGES];
-    unsigned char* train_grad_vertical[NUM_TRAIN_IMAGES];
-    unsigned char* train_grad_45[NUM_TRAIN_IMAGES];
-    unsigned char* train_grad_minus_45[NUM_TRAIN_IMAGES];
-
-    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
-        train_grad_horizontal[i] = (unsigned char*)malloc(SIZE * SIZE);
-        train_grad_vertical[i] = (unsigned char*)malloc(SIZE * SIZE);
-        train_grad_45[i] = (unsigned char*)malloc(SIZE * SIZE);
-        train_grad_minus_45[i] = (unsigned char*)malloc(SIZE * SIZE);
-    }
-
-    // Process and store all the training images
-    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
-        if (!process_image(image_files[i], train_grad_horizontal[i], train_grad_vertical[i], train_grad_45[i], train_grad_minus_45[i])) {
-            printf("Error processing image: %s\n", image_files[i]);
-            return -1;
-        }
-    }
-
-    // Process the test image
-    const char* test_image_path = "face/face8.jpg";
-    unsigned char* test_grad_horizontal = (unsigned char*)malloc(SIZE * SIZE);
-    unsigned char* test_grad_vertical = (unsigned char*)malloc(SIZE * SIZE);
-    unsigned char* test_grad_45 = (unsigned char*)malloc(SIZE * SIZE);
-    unsigned char* test_grad_minus_45 = (unsigned char*)malloc(SIZE * SIZE);
-
-    if (!process_image(test_image_path, test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45)) {
-        printf("Error processing test image.\n");
-        return -1;
-    }
-
-    // Compare the test gradients with each training gradient and find the closest match
-    double min_distance = INFINITY;
-    int best_match = -1;
-    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
-        double distance_grad_horizontal = compare_images(train_grad_horizontal[i], test_grad_horizontal);
-        double distance_grad_vertical = compare_images(train_grad_vertical[i], test_grad_vertical);
-        double distance_grad_45 = compare_images(train_grad_45[i], test_grad_45);
-        double distance_grad_minus_45 = compare_images(train_grad_minus_45[i], test_grad_minus_45);
-
-        double distance = (distance_grad_horizontal + distance_grad_vertical + distance_grad_45 + distance_grad_minus_45) / 4.0;
-        printf("Distance to training image %d (horizontal gradient): %f\n", i + 1, distance);
-        if (distance < min_distance) {
-            min_distance = distance;
-            best_match = i;
-        }
-    }
-
-    // Output the result
-    if (best_match != -1) {
-        printf("Best match: Training image %d\n", best_match + 1);
-    }
-    else {
-        printf("No match found.\n");
-    }
-
-    // Free the allocated memory
-    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
-        free(train_grad_horizontal[i]);
-        free(train_grad_vertical[i]);
-        free(train_grad_45[i]);
-        free(train_grad_minus_45[i]);
-    }
-
-    free(test_grad_horizontal);
-    free(test_grad_vertical);
-    free(test_grad_45);
-    free(test_grad_minus_45);
-
-    return 0;
-}
+﻿#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "stb_image.h"
+
+#include "image_features.h"
+#include "detector.h"
+#include "haar_cascade.h"
+#include "nms.h"
+#include "mjpeg_stream.h"
+#include "temporal.h"
+#include "stage_timer.h"
+#include "mem_stats.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "gallery.h"
+#include "parallel.h"
+#include "binary_hash.h"
+#include "distance.h"
+#include "hog.h"
+#include "projection.h"
+#include "quantize.h"
+
+#define NUM_TRAIN_IMAGES 10 // Number of training images
+#define HASH_SEED 0x5EEDF00DULL // Seed of the LSH hyperplanes, shared by gallery and queries
+#define PROJECTION_SEED 0x9E0C7A11ULL // Seed of the random projection matrix
+#define MAX_PRINTED_DETECTIONS 20 // Detections listed by --detect, closest first
+#define STREAM_REPORT_SECONDS 1.0 // Interval between --stream throughput reports
+
+const char* image_files[] = {
+    "face/face1.jpg",
+    "face/face2.jpg",
+    "face/face3.jpg",
+    "face/face4.jpg",
+    "face/face5.jpg",
+    "face/face6.jpg",
+    "face/face7.jpg",
+    "face/face8.jpg",
+    "face/face9.jpg",
+    "face/face10.jpg"
+};
+
+/**
+ * Command line options selecting how the test image is matched against the training images.
+ */
+struct Options {
+    const char* test_image_path;
+    int roi[4];                    // Face rectangle of the test image or stream frames (x, y, width, height), width 0 for the whole image
+    bool use_hash;
+    HashMethod hash_method;
+    int hash_bits;
+    int hash_candidates;
+    bool use_hog;
+    int projection_kind; // 0 for no projection, otherwise a ProjectionKind
+    int projection_dim;
+    const char* projection_file;
+    int quant_kind; // 0 for float descriptors, otherwise a QuantKind
+    int cascade_top_m; // 0 for a plain scan, otherwise the survivors of the coarse stage
+    int threads;
+    const char* detect_image_path; // NULL unless scanning a full scene for faces
+    DetectorOptions detector;
+    NmsOptions nms;
+    const char* haar_path;         // Haar cascade finding the faces of --detect, NULL for the sliding-window detector
+    const char* stream_path;       // MJPEG stream to match frame by frame ("-" for stdin), NULL otherwise
+    int stream_queue;              // Frames buffered between the stream reader and the matcher
+    bool stats;                    // Print the per-stage latency histograms at exit
+    const char* trace_path;        // Chrome trace JSON written at exit, NULL when not tracing
+    bool perf;                     // Count cycles, instructions and misses around the kernels, reported at exit
+    float reuse_threshold;         // Mean absolute difference under which a tile of a stream frame is reused, negative to recompute every frame
+};
+
+/**
+ * Prints the command line usage.
+ *
+ * @param program The name of the executable.
+ */
+void print_usage(const char* program) {
+    printf("Usage: %s [options] [test_image]\n", program);
+    printf("  --hash <bits>           Pre-filter the training images by binary hash (64-1024 bits)\n");
+    printf("  --hash-method <method>  Hash method: pooled (default) or lsh\n");
+    printf("  --candidates <count>    Number of hash candidates re-ranked by gradient distance (default 3)\n");
+    printf("  --hog                   Compare pooled orientation histograms instead of raw gradient planes\n");
+    printf("  --project <kind>        Reduce descriptors with a pca or random projection\n");
+    printf("  --dim <n>               Projected dimension, %d-%d (default 128)\n", PROJECTION_MIN_DIM, PROJECTION_MAX_DIM);
+    printf("  --projection-file <f>   Where the projection is persisted (default face/gallery.proj)\n");
+    printf("  --quant <kind>          Store descriptors as int8 or nibble-packed int4 codes\n");
+    printf("  --cascade <m>           Coarse 8x8 scan of the gallery, then exact re-rank of the best m\n");
+    printf("  --roi <x,y,w,h>         Decode and match only this rectangle of the test image or stream frames\n");
+    printf("  --stats                 Print per-stage latency percentiles and memory at exit\n");
+    printf("  --trace <file>          Write the stage spans of every thread as Chrome trace JSON at exit\n");
+    printf("  --perf                  Print IPC and cache/branch misses per pixel or gallery byte of each kernel at exit (Linux)\n");
+    printf("  --threads <n>           Number of threads used by parallel searches (default: all cores)\n");
+    printf("  --detect <image>        Scan a full scene for faces with a multi-scale sliding window\n");
+    printf("  --stride <pixels>       Window step of the detector (default 8)\n");
+    printf("  --scale-step <factor>   Downscale factor between pyramid levels (default 1.25)\n");
+    printf("  --detect-threshold <d>  Report windows closer than this distance (default 3000)\n");
+    printf("  --detect-gallery        Score windows against every training image instead of their mean\n");
+    printf("  --min-energy <ratio>    Skip windows with less gradient energy than this share of the template's (default 0.25)\n");
+    printf("  --cache-kb <n>          Working set of each detector task in KB, sized to the L2 cache (default 512, 0: whole levels)\n");
+    printf("  --nms-iou <t>           Suppress detections overlapping a closer one by more than this IoU (default 0.3)\n");
+    printf("  --soft-nms <sigma>      Decay overlapping detections with Gaussian soft-NMS instead of removing them\n");
+    printf("  --stream <file|->       Match every frame of an MJPEG stream (file or stdin) against the training images\n");
+    printf("  --stream-queue <n>      Frames buffered ahead of the matcher; stdin drops the oldest when full (default 4)\n");
+    printf("  --reuse <mad>           Reuse stream tiles whose mean absolute change is at most this (default 0: identical tiles only)\n");
+    printf("  --no-reuse              Recompute every stream frame from scratch\n");
+    printf("  --haar <file>           Find the faces of --detect with a Haar cascade, then match each crop\n");
+}
+
+/**
+ * Parses the command line into the options.
+ *
+ * @param argc The number of arguments.
+ * @param argv The arguments.
+ * @param options The output options, filled with defaults first.
+ * @return Returns true if the command line is valid, false otherwise.
+ */
+bool parse_options(int argc, char** argv, Options* options) {
+    options->test_image_path = "face/face8.jpg";
+    options->roi[0] = options->roi[1] = options->roi[2] = options->roi[3] = 0;
+    options->use_hash = false;
+    options->hash_method = HASH_METHOD_POOLED;
+    options->hash_bits = 256;
+    options->hash_candidates = 3;
+    options->use_hog = false;
+    options->projection_kind = 0;
+    options->projection_dim = 128;
+    options->projection_file = "face/gallery.proj";
+    options->quant_kind = 0;
+    options->cascade_top_m = 0;
+    options->threads = 0;
+    options->detect_image_path = NULL;
+    detector_default_options(&options->detector);
+    nms_default_options(&options->nms);
+    options->haar_path = NULL;
+    options->stream_path = NULL;
+    options->stream_queue = 4;
+    options->reuse_threshold = 0.0f;
+    options->stats = false;
+    options->trace_path = NULL;
+    options->perf = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--hash") == 0 && has_value) {
+            options->use_hash = true;
+            options->hash_bits = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hash-method") == 0 && has_value) {
+            const char* method = argv[++i];
+            if (strcmp(method, "pooled") == 0) {
+                options->hash_method = HASH_METHOD_POOLED;
+            }
+            else if (strcmp(method, "lsh") == 0) {
+                options->hash_method = HASH_METHOD_LSH;
+            }
+            else {
+                printf("Unknown hash method: %s\n", method);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--candidates") == 0 && has_value) {
+            options->hash_candidates = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hog") == 0) {
+            options->use_hog = true;
+        }
+        else if (strcmp(argv[i], "--project") == 0 && has_value) {
+            const char* kind = argv[++i];
+            if (strcmp(kind, "pca") == 0) {
+                options->projection_kind = PROJECTION_PCA;
+            }
+            else if (strcmp(kind, "random") == 0) {
+                options->projection_kind = PROJECTION_RANDOM;
+            }
+            else {
+                printf("Unknown projection: %s\n", kind);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--dim") == 0 && has_value) {
+            options->projection_dim = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--projection-file") == 0 && has_value) {
+            options->projection_file = argv[++i];
+        }
+        else if (strcmp(argv[i], "--quant") == 0 && has_value) {
+            const char* kind = argv[++i];
+            if (strcmp(kind, "int8") == 0) {
+                options->quant_kind = QUANT_INT8;
+            }
+            else if (strcmp(kind, "int4") == 0) {
+                options->quant_kind = QUANT_INT4;
+            }
+            else {
+                printf("Unknown quantization: %s\n", kind);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--cascade") == 0 && has_value) {
+            options->cascade_top_m = atoi(argv[++i]);
+            if (options->cascade_top_m < 1) {
+                printf("The cascade needs at least one survivor\n");
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            options->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--detect") == 0 && has_value) {
+            options->detect_image_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stride") == 0 && has_value) {
+            options->detector.stride = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--scale-step") == 0 && has_value) {
+            options->detector.scale_step = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--detect-threshold") == 0 && has_value) {
+            options->detector.threshold = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--detect-gallery") == 0) {
+            options->detector.use_gallery = true;
+        }
+        else if (strcmp(argv[i], "--min-energy") == 0 && has_value) {
+            options->detector.min_energy = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cache-kb") == 0 && has_value) {
+            options->detector.cache_kb = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--nms-iou") == 0 && has_value) {
+            options->nms.iou_threshold = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--soft-nms") == 0 && has_value) {
+            options->nms.soft = true;
+            options->nms.sigma = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--roi") == 0 && has_value) {
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &options->roi[0], &options->roi[1], &options->roi[2], &options->roi[3]) != 4 ||
+                options->roi[2] <= 0 || options->roi[3] <= 0) {
+                printf("Invalid --roi %s: expected x,y,w,h with a positive width and height\n", argv[i]);
+                return false;
+            }
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && has_value) {
+            options->stream_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream-queue") == 0 && has_value) {
+            options->stream_queue = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--reuse") == 0 && has_value) {
+            options->reuse_threshold = (float)atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stats") == 0) {
+            options->stats = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            options->trace_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--perf") == 0) {
+            options->perf = true;
+        }
+        else if (strcmp(argv[i], "--no-reuse") == 0) {
+            options->reuse_threshold = -1.0f;
+        }
+        else if (strcmp(argv[i], "--haar") == 0 && has_value) {
+            options->haar_path = argv[++i];
+        }
+        else if (argv[i][0] == '-') {
+            return false;
+        }
+        else {
+            options->test_image_path = argv[i];
+        }
+    }
+
+    if (options->use_hash && !hash_bits_supported(options->hash_method, options->hash_bits)) {
+        printf("Unsupported hash length %d for this method (pooled: 64, 256 or 1024; lsh: multiple of 64 up to %d)\n",
+               options->hash_bits, HASH_MAX_BITS);
+        return false;
+    }
+    if (options->cascade_top_m > 0 && (options->use_hash || options->use_hog || options->projection_kind || options->quant_kind)) {
+        // The cascade ranks every training image by its gradient planes, not by hash or descriptor
+        printf("--cascade searches the gradient planes and cannot be combined with --hash, --hog, --project or --quant\n");
+        return false;
+    }
+    if (options->projection_kind && (options->projection_dim < PROJECTION_MIN_DIM || options->projection_dim > PROJECTION_MAX_DIM)) {
+        printf("Projected dimension must be between %d and %d\n", PROJECTION_MIN_DIM, PROJECTION_MAX_DIM);
+        return false;
+    }
+    if (options->detector.stride < 1 || options->detector.scale_step <= 1.0f) {
+        printf("The detector needs a positive stride and a scale step above 1\n");
+        return false;
+    }
+    if (options->nms.soft && options->nms.sigma <= 0.0f) {
+        printf("Soft-NMS needs a positive sigma\n");
+        return false;
+    }
+    if (options->hash_candidates < 1) {
+        options->hash_candidates = 1;
+    }
+    return true;
+}
+
+/**
+ * Builds the float descriptor of an image from its gradient planes: either the pooled
+ * orientation histograms or the raw planes as one concatenated vector.
+ *
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @param use_hog Whether to pool the planes into orientation histograms.
+ * @param descriptor The output array of descriptor_size(use_hog) floats.
+ */
+void compute_descriptor(unsigned char* grad_horizontal, unsigned char* grad_vertical, unsigned char* grad_45, unsigned char* grad_minus_45,
+                        bool use_hog, float* descriptor) {
+    if (use_hog) {
+        compute_hog(grad_horizontal, grad_vertical, grad_45, grad_minus_45, SIZE, descriptor);
+    }
+    else {
+        gradients_to_vector(grad_horizontal, grad_vertical, grad_45, grad_minus_45, SIZE, descriptor);
+    }
+}
+
+/**
+ * Loads the persisted projection if it matches the requested one (kind, dimensions, seed and, for
+ * PCA, the fingerprint of the gallery descriptors it was trained on), otherwise creates
+ * (random) or trains (PCA on the gallery descriptors) a new one and persists it.
+ *
+ * @param options The command line options.
+ * @param train_descriptors The gallery descriptors, NUM_TRAIN_IMAGES rows of input_dim floats.
+ * @param input_dim The descriptor dimension.
+ * @param projection The output projection.
+ * @return Returns true if a projection is available, false otherwise.
+ */
+bool prepare_projection(const Options& options, const float* train_descriptors, int input_dim, Projection* projection) {
+    uint64_t fingerprint = options.projection_kind == PROJECTION_PCA
+        ? projection_fingerprint(train_descriptors, NUM_TRAIN_IMAGES, input_dim) : 0;
+    if (projection_load(projection, options.projection_file)) {
+        if (projection->kind == options.projection_kind && projection->input_dim == input_dim
+            && projection->output_dim == options.projection_dim && projection->seed == PROJECTION_SEED
+            && projection->fingerprint == fingerprint) {
+            printf("Loaded projection from %s\n", options.projection_file);
+            return true;
+        }
+        projection_free(projection);
+    }
+
+    bool ok = options.projection_kind == PROJECTION_PCA
+        ? projection_train_pca(projection, train_descriptors, NUM_TRAIN_IMAGES, input_dim, options.projection_dim, PROJECTION_SEED)
+        : projection_init_random(projection, input_dim, options.projection_dim, PROJECTION_SEED);
+    if (!ok) {
+        return false;
+    }
+    if (projection_save(projection, options.projection_file)) {
+        printf("Saved projection to %s\n", options.projection_file);
+    }
+    else {
+        printf("Could not save projection to %s\n", options.projection_file);
+    }
+    return true;
+}
+
+/**
+ * Matches the test gradients with the two-stage cascade over a packed gallery.
+ *
+ * @param options The command line options.
+ * @param train_grad The four arrays of training gradient planes (horizontal, vertical, 45, -45).
+ * @param test_grad The four test gradient planes.
+ * @param min_distance The output distance of the best match.
+ * @return Returns the index of the best match, or -1 if the gallery is empty.
+ */
+int match_cascade(const Options& options, unsigned char** train_grad[4], unsigned char* test_grad[4], double* min_distance) {
+    Gallery gallery;
+    if (!gallery_init(&gallery, NUM_TRAIN_IMAGES)) {
+        return -1;
+    }
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        gallery_add(&gallery, train_grad[0][i], train_grad[1][i], train_grad[2][i], train_grad[3][i]);
+    }
+
+    unsigned char* query = (unsigned char*)malloc(GALLERY_ENTRY_SIZE);
+    unsigned char query_coarse[COARSE_ENTRY_SIZE];
+    gallery_pack_entry(test_grad[0], test_grad[1], test_grad[2], test_grad[3], query, query_coarse);
+
+    GalleryMatch matches[NUM_TRAIN_IMAGES];
+    int found = gallery_search_cascade(&gallery, query, query_coarse, options.cascade_top_m, NUM_TRAIN_IMAGES, matches);
+    for (int m = 0; m < found; m++) {
+        printf("Distance to training image %d (cascade re-rank): %f\n", matches[m].index + 1, matches[m].distance);
+    }
+
+    free(query);
+    gallery_free(&gallery);
+    if (found == 0) {
+        return -1;
+    }
+    *min_distance = matches[0].distance;
+    return matches[0].index;
+}
+
+/**
+ * Finds faces with the Haar cascade, then crops every accepted window and matches it against the
+ * gallery through the same resize and convolution path as the test image.
+ *
+ * @param options The command line options.
+ * @param gray The grayscale detection image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param gallery The enrolled gallery.
+ * @param detections The output detections, sorted by increasing gallery distance.
+ * @return Returns true if the cascade is loaded, false otherwise.
+ */
+bool run_haar_cascade(const Options& options, const unsigned char* gray, int width, int height,
+                      const Gallery* gallery, std::vector<Detection>& detections) {
+    HaarCascade cascade;
+    if (!haar_cascade_load(&cascade, options.haar_path)) {
+        printf("Failed to load Haar cascade %s!\n", options.haar_path);
+        return false;
+    }
+
+    HaarStats stats;
+    long long start = stage_now();
+    haar_cascade_detect(&cascade, gray, width, height, options.detector.stride, options.detector.scale_step, detections, &stats);
+    stage_record(STAGE_DETECT, start);
+    printf("Scanned %lld windows in %s (%dx%d) with %d cascade stages: %lld stage evaluations (%.2f per window), %lld accepted\n",
+           stats.windows, options.detect_image_path, width, height, (int)cascade.stages.size(), stats.stage_windows,
+           stats.windows > 0 ? (double)stats.stage_windows / stats.windows : 0.0, stats.accepted);
+
+    // Match every crop against the gallery, replacing the cascade score by the gallery distance
+    unsigned char grad[4][SIZE * SIZE];
+    unsigned char* entry = (unsigned char*)malloc(GALLERY_ENTRY_SIZE);
+    unsigned char coarse[COARSE_ENTRY_SIZE];
+    for (Detection& detection : detections) {
+        int x = (int)detection.x;
+        int y = (int)detection.y;
+        int crop_width = (int)detection.width < width - x ? (int)detection.width : width - x;
+        int crop_height = (int)detection.height < height - y ? (int)detection.height : height - y;
+        extract_gradients(gray + (size_t)y * width + x, crop_width, crop_height, width, grad[0], grad[1], grad[2], grad[3]);
+        gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+
+        GalleryMatch match;
+        start = stage_now();
+        int found = gallery_search_exact(gallery, entry, 1, &match);
+        stage_record(STAGE_MATCH, start);
+        if (found == 1) {
+            detection.distance = match.distance;
+            detection.match = match.index;
+        }
+    }
+    free(entry);
+
+    std::sort(detections.begin(), detections.end(), [](const Detection& a, const Detection& b) {
+        return a.distance < b.distance;
+    });
+    return true;
+}
+
+/**
+ * Scans the detection image for faces resembling the training images and prints the windows found.
+ *
+ * @param options The command line options.
+ * @param train_grad The four arrays of training gradient planes (horizontal, vertical, 45, -45).
+ * @return Returns true if the image is scanned, false otherwise.
+ */
+bool run_detection(const Options& options, unsigned char** train_grad[4]) {
+    int width, height, channels;
+    long long start = stage_now();
+    unsigned char* img = stbi_load(options.detect_image_path, &width, &height, &channels, 1); // Load as grayscale
+    stage_record(STAGE_DECODE, start);
+    if (!img) {
+        printf("Failed to load image %s!\n", options.detect_image_path);
+        return false;
+    }
+
+    Gallery gallery;
+    if (!gallery_init(&gallery, NUM_TRAIN_IMAGES)) {
+        stbi_image_free(img);
+        return false;
+    }
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        gallery_add(&gallery, train_grad[0][i], train_grad[1][i], train_grad[2][i], train_grad[3][i]);
+    }
+
+    std::vector<Detection> detections;
+    if (options.haar_path) {
+        if (!run_haar_cascade(options, img, width, height, &gallery, detections)) {
+            gallery_free(&gallery);
+            stbi_image_free(img);
+            return false;
+        }
+    }
+    else {
+        DetectorStats stats;
+        start = stage_now();
+        if (!detect_faces(img, width, height, &gallery, &options.detector, detections, &stats)) {
+            printf("Not enough memory to scan %s\n", options.detect_image_path);
+            gallery_free(&gallery);
+            stbi_image_free(img);
+            return false;
+        }
+        stage_record(STAGE_DETECT, start);
+        printf("Scanned %lld windows in %s (%dx%d): %lld rejected from integral images, %lld compared, %d below the threshold\n",
+               stats.windows, options.detect_image_path, width, height, stats.pruned, stats.exact, (int)detections.size());
+    }
+    int candidates = (int)detections.size();
+    suppress_detections(detections, &options.nms);
+    printf("%d of %d detections left after %s\n", (int)detections.size(), candidates,
+           options.nms.soft ? "soft non-maximum suppression" : "non-maximum suppression");
+    for (size_t d = 0; d < detections.size() && d < MAX_PRINTED_DETECTIONS; d++) {
+        const Detection& detection = detections[d];
+        printf("Face at x=%.0f y=%.0f size=%.0fx%.0f (distance %f", detection.x, detection.y, detection.width, detection.height, detection.distance);
+        if (detection.match >= 0) {
+            printf(", closest training image %d", detection.match + 1);
+        }
+        printf(")\n");
+    }
+    if (detections.empty()) {
+        printf("No face found.\n");
+    }
+
+    gallery_free(&gallery);
+    stbi_image_free(img);
+    return true;
+}
+
+/**
+ * Matches every frame of an MJPEG stream against the training images. A reader thread splits
+ * the stream into frames while this thread decodes and matches them; throughput, drops and
+ * latency (from the arrival of a frame's last byte to its match) are reported every second.
+ * Unless disabled, only the tiles of a frame that changed since the previous ones are recomputed.
+ *
+ * @param options The command line options.
+ * @param train_grad The four arrays of training gradient planes (horizontal, vertical, 45, -45).
+ * @return Returns true if the stream is read to its end, false if it cannot be opened.
+ */
+bool run_stream(const Options& options, unsigned char** train_grad[4]) {
+    bool from_stdin = strcmp(options.stream_path, "-") == 0;
+    FILE* file = from_stdin ? stdin : fopen(options.stream_path, "rb");
+    if (!file) {
+        printf("Failed to open stream %s!\n", options.stream_path);
+        return false;
+    }
+
+    Gallery gallery;
+    if (!gallery_init(&gallery, NUM_TRAIN_IMAGES)) {
+        if (!from_stdin) {
+            fclose(file);
+        }
+        return false;
+    }
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        gallery_add(&gallery, train_grad[0][i], train_grad[1][i], train_grad[2][i], train_grad[3][i]);
+    }
+
+    // A live source (stdin) must not fall behind, so a full queue drops frames; a file waits
+    MjpegStream stream;
+    mjpeg_stream_start(&stream, file, options.stream_queue, from_stdin);
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    Clock::time_point report_start = start;
+    long long matched = 0;
+    long long failed = 0;
+    long long report_frames = 0;
+    double report_latency = 0.0;
+    double report_max_latency = 0.0;
+    int last_match = -2;
+    long long reused = 0;
+    long long recomputed_tiles = 0;
+
+    bool reuse = options.reuse_threshold >= 0.0f;
+    TemporalCache cache;
+    if (reuse && !temporal_init(&cache, options.reuse_threshold)) {
+        reuse = false;
+    }
+
+    unsigned char grad[4][SIZE * SIZE];
+    unsigned char* entry = (unsigned char*)malloc(GALLERY_ENTRY_SIZE);
+    unsigned char coarse[COARSE_ENTRY_SIZE];
+    MjpegFrame frame;
+    while (mjpeg_stream_next(&stream, &frame)) {
+        int width, height, channels;
+        // With a known face rectangle, the rest of the frame is never transformed or converted
+        PerfSample counters;
+        perf_begin(&counters);
+        long long stage_start = stage_now();
+        unsigned char* img = options.roi[2] > 0
+            ? stbi_load_from_memory_roi(frame.data, (int)frame.size, options.roi[0], options.roi[1], options.roi[2], options.roi[3],
+                                        &width, &height, &channels, 1)
+            : stbi_load_from_memory(frame.data, (int)frame.size, &width, &height, &channels, 1);
+        stage_record(STAGE_DECODE, stage_start);
+        perf_end(PERF_DECODE, &counters, img ? (unsigned long long)width * height : 0);
+        if (!img) {
+            failed++;
+            continue;
+        }
+        GalleryMatch match;
+        TemporalStats temporal;
+        if (reuse && temporal_match(&cache, &gallery, img, width, height, &match, &temporal)) {
+            reused += temporal.reused;
+            recomputed_tiles += temporal.recomputed_tiles;
+        }
+        else {
+            extract_gradients(img, width, height, width, grad[0], grad[1], grad[2], grad[3]);
+            gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+            stage_start = stage_now();
+            gallery_search_exact(&gallery, entry, 1, &match);
+            stage_record(STAGE_MATCH, stage_start);
+            recomputed_tiles += TEMPORAL_TILES;
+        }
+        stbi_image_free(img);
+        matched++;
+
+        // Only changes of the best match are printed, to keep the output readable on long streams
+        if (match.index != last_match) {
+            printf("Frame %lld: training image %d (distance %f)\n", frame.index, match.index + 1, match.distance);
+            last_match = match.index;
+        }
+
+        Clock::time_point now = Clock::now();
+        double latency = std::chrono::duration<double, std::milli>(now - frame.arrival).count();
+        report_frames++;
+        report_latency += latency;
+        report_max_latency = latency > report_max_latency ? latency : report_max_latency;
+        double interval = std::chrono::duration<double>(now - report_start).count();
+        if (interval >= STREAM_REPORT_SECONDS) {
+            long long dropped;
+            {
+                std::lock_guard<std::mutex> lock(stream.mutex);
+                dropped = stream.frames_dropped;
+            }
+            printf("[stream] %.1f frames/s, latency mean %.2f ms max %.2f ms, %lld matched, %lld reused, %lld dropped\n",
+                   report_frames / interval, report_latency / report_frames, report_max_latency, matched, reused, dropped);
+            report_start = now;
+            report_frames = 0;
+            report_latency = 0.0;
+            report_max_latency = 0.0;
+        }
+    }
+    mjpeg_stream_stop(&stream);
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("Stream done: %lld frames read (%.1f MB), %lld matched, %lld dropped, %lld undecodable, %.1f frames/s\n",
+           stream.frames_read, stream.bytes_read / 1048576.0, matched, stream.frames_dropped, failed,
+           seconds > 0.0 ? matched / seconds : 0.0);
+    if (reuse && matched > 0) {
+        printf("Temporal reuse: %lld frames unchanged, %.1f of %d tiles recomputed per frame\n",
+               reused, (double)recomputed_tiles / matched, TEMPORAL_TILES);
+    }
+
+    if (reuse) {
+        temporal_free(&cache);
+    }
+
+    free(entry);
+    gallery_free(&gallery);
+    if (!from_stdin) {
+        fclose(file);
+    }
+    return true;
+}
+
+/**
+ * Prints the per-stage latency histograms and memory to stdout, registered with atexit() by --stats.
+ */
+void print_stage_report() {
+    printf("\n");
+    stage_report(stdout);
+    printf("\n");
+    mem_report(stdout);
+}
+
+/**
+ * Prints the hardware counters of every kernel to stdout, registered with atexit() by --perf.
+ */
+void print_perf_report() {
+    printf("\n");
+    perf_report(stdout);
+}
+
+static const char* trace_path = NULL;
+
+/**
+ * Writes the recorded trace to trace_path, registered with atexit() by --trace.
+ */
+void write_trace() {
+    trace_enable(false);
+    if (trace_write(trace_path)) {
+        printf("Trace written to %s\n", trace_path);
+    }
+    else {
+        printf("Failed to write trace %s\n", trace_path);
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    if (options.threads > 0) {
+        parallel_set_threads(options.threads);
+    }
+    if (options.stats) {
+        atexit(print_stage_report);
+    }
+    if (options.perf) {
+        if (!perf_counters_enable()) {
+            printf("Hardware counters unavailable: %s\n", perf_counters_error());
+        }
+        else {
+            atexit(print_perf_report);
+        }
+    }
+    if (options.trace_path) {
+        trace_path = options.trace_path;
+        trace_set_thread_name("main");
+        trace_enable(true);
+        atexit(write_trace);
+    }
+
+    // Arrays to hold the processed training images
+    unsigned char* train_grad_horizontal[NUM_TRAIN_IMAGES];
+    unsigned char* train_grad_vertical[NUM_TRAIN_IMAGES];
+    unsigned char* train_grad_45[NUM_TRAIN_IMAGES];
+    unsigned char* train_grad_minus_45[NUM_TRAIN_IMAGES];
+
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        train_grad_horizontal[i] = (unsigned char*)malloc(SIZE * SIZE);
+        train_grad_vertical[i] = (unsigned char*)malloc(SIZE * SIZE);
+        train_grad_45[i] = (unsigned char*)malloc(SIZE * SIZE);
+        train_grad_minus_45[i] = (unsigned char*)malloc(SIZE * SIZE);
+    }
+
+    // Process and store all the training images
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        if (!process_image(image_files[i], train_grad_horizontal[i], train_grad_vertical[i], train_grad_45[i], train_grad_minus_45[i])) {
+            printf("Error processing image: %s\n", image_files[i]);
+            return -1;
+        }
+    }
+
+    // Match a stream of frames instead of a single test image
+    if (options.stream_path) {
+        unsigned char** train_grad[4] = { train_grad_horizontal, train_grad_vertical, train_grad_45, train_grad_minus_45 };
+        bool streamed = run_stream(options, train_grad);
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            free(train_grad_horizontal[i]);
+            free(train_grad_vertical[i]);
+            free(train_grad_45[i]);
+            free(train_grad_minus_45[i]);
+        }
+        return streamed ? 0 : -1;
+    }
+
+    // Scan a full scene instead of matching a single test image
+    if (options.detect_image_path) {
+        unsigned char** train_grad[4] = { train_grad_horizontal, train_grad_vertical, train_grad_45, train_grad_minus_45 };
+        bool detected = run_detection(options, train_grad);
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            free(train_grad_horizontal[i]);
+            free(train_grad_vertical[i]);
+            free(train_grad_45[i]);
+            free(train_grad_minus_45[i]);
+        }
+        return detected ? 0 : -1;
+    }
+
+    // Process the test image
+    const char* test_image_path = options.test_image_path;
+    unsigned char* test_grad_horizontal = (unsigned char*)malloc(SIZE * SIZE);
+    unsigned char* test_grad_vertical = (unsigned char*)malloc(SIZE * SIZE);
+    unsigned char* test_grad_45 = (unsigned char*)malloc(SIZE * SIZE);
+    unsigned char* test_grad_minus_45 = (unsigned char*)malloc(SIZE * SIZE);
+
+    bool processed = options.roi[2] > 0
+        ? process_image_roi(test_image_path, options.roi[0], options.roi[1], options.roi[2], options.roi[3],
+                            test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45)
+        : process_image(test_image_path, test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45);
+    if (!processed) {
+        printf("Error processing test image.\n");
+        return -1;
+    }
+
+    // By default every training image is a candidate; the hash pre-filter narrows the list down
+    int candidates[NUM_TRAIN_IMAGES];
+    int num_candidates = NUM_TRAIN_IMAGES;
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        candidates[i] = i;
+    }
+
+    if (options.use_hash) {
+        int words = hash_words(options.hash_bits);
+        uint64_t* train_codes = (uint64_t*)malloc(NUM_TRAIN_IMAGES * words * sizeof(uint64_t));
+        uint64_t* test_code = (uint64_t*)malloc(words * sizeof(uint64_t));
+        int hash_distances[NUM_TRAIN_IMAGES];
+
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            compute_binary_hash(train_grad_horizontal[i], train_grad_vertical[i], train_grad_45[i], train_grad_minus_45[i], SIZE,
+                                options.hash_method, options.hash_bits, HASH_SEED, train_codes + i * words);
+        }
+        compute_binary_hash(test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45, SIZE,
+                            options.hash_method, options.hash_bits, HASH_SEED, test_code);
+
+        int k = options.hash_candidates < NUM_TRAIN_IMAGES ? options.hash_candidates : NUM_TRAIN_IMAGES;
+        num_candidates = hamming_top_k(test_code, train_codes, NUM_TRAIN_IMAGES, words, k, candidates, hash_distances);
+        for (int c = 0; c < num_candidates; c++) {
+            printf("Hash candidate: Training image %d (Hamming distance %d/%d)\n", candidates[c] + 1, hash_distances[c], options.hash_bits);
+        }
+
+        free(train_codes);
+        free(test_code);
+    }
+
+    // Build float descriptors (orientation histograms and/or a projection) when requested
+    bool use_descriptors = options.use_hog || options.projection_kind || options.quant_kind;
+    int descriptor_size = options.use_hog ? hog_descriptor_size(SIZE) : 4 * SIZE * SIZE;
+    const char* descriptor_name = options.use_hog ? "orientation histograms" : "gradient vector";
+    float* train_descriptors = NULL;
+    float* test_descriptor = NULL;
+    if (use_descriptors) {
+        train_descriptors = (float*)malloc(NUM_TRAIN_IMAGES * descriptor_size * sizeof(float));
+        test_descriptor = (float*)malloc(descriptor_size * sizeof(float));
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            compute_descriptor(train_grad_horizontal[i], train_grad_vertical[i], train_grad_45[i], train_grad_minus_45[i],
+                               options.use_hog, train_descriptors + i * descriptor_size);
+        }
+        compute_descriptor(test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45, options.use_hog, test_descriptor);
+    }
+
+    if (options.projection_kind) {
+        Projection projection;
+        if (!prepare_projection(options, train_descriptors, descriptor_size, &projection)) {
+            printf("Error preparing the projection.\n");
+            return -1;
+        }
+
+        int projected_size = projection.output_dim;
+        float* train_projected = (float*)malloc(NUM_TRAIN_IMAGES * projected_size * sizeof(float));
+        float* test_projected = (float*)malloc(projected_size * sizeof(float));
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            projection_apply(&projection, train_descriptors + i * descriptor_size, train_projected + i * projected_size);
+        }
+        projection_apply(&projection, test_descriptor, test_projected);
+        projection_free(&projection);
+
+        free(train_descriptors);
+        free(test_descriptor);
+        train_descriptors = train_projected;
+        test_descriptor = test_projected;
+        descriptor_size = projected_size;
+        descriptor_name = options.projection_kind == PROJECTION_PCA ? "PCA projection" : "random projection";
+    }
+
+    // Quantize the descriptors, keeping only the packed codes and per-entry calibration
+    QuantizedSet train_quantized;
+    QuantizedSet test_quantized;
+    if (options.quant_kind) {
+        QuantKind kind = (QuantKind)options.quant_kind;
+        if (!quantized_set_init(&train_quantized, kind, descriptor_size, NUM_TRAIN_IMAGES)
+            || !quantized_set_init(&test_quantized, kind, descriptor_size, 1)) {
+            printf("Error allocating quantized descriptors.\n");
+            return -1;
+        }
+        for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+            quantize_entry(&train_quantized, i, train_descriptors + i * descriptor_size);
+        }
+        quantize_entry(&test_quantized, 0, test_descriptor);
+        printf("Quantized %s: %d bytes per entry instead of %d\n", descriptor_name,
+               quantized_bytes(kind, descriptor_size), descriptor_size * (int)sizeof(float));
+    }
+
+    // Compare the test gradients with each candidate's gradients and find the closest match
+    double min_distance = INFINITY;
+    int best_match = -1;
+    long long match_start = stage_now();
+    if (options.cascade_top_m > 0) {
+        unsigned char** train_grad[4] = { train_grad_horizontal, train_grad_vertical, train_grad_45, train_grad_minus_45 };
+        unsigned char* test_grad[4] = { test_grad_horizontal, test_grad_vertical, test_grad_45, test_grad_minus_45 };
+        best_match = match_cascade(options, train_grad, test_grad, &min_distance);
+    }
+    else {
+        for (int c = 0; c < num_candidates; c++) {
+            int i = candidates[c];
+            if (use_descriptors) {
+                double distance = options.quant_kind
+                    ? quantized_distance(&train_quantized, i, &test_quantized, 0)
+                    : descriptor_distance(train_descriptors + i * descriptor_size, test_descriptor, descriptor_size);
+                printf("Distance to training image %d (%s): %f\n", i + 1, descriptor_name, distance);
+                if (distance < min_distance) {
+                    min_distance = distance;
+                    best_match = i;
+                }
+                continue;
+            }
+
+            double distance_grad_horizontal = compare_images(train_grad_horizontal[i], test_grad_horizontal);
+            double distance_grad_vertical = compare_images(train_grad_vertical[i], test_grad_vertical);
+            double distance_grad_45 = compare_images(train_grad_45[i], test_grad_45);
+            double distance_grad_minus_45 = compare_images(train_grad_minus_45[i], test_grad_minus_45);
+
+            double distance = (distance_grad_horizontal + distance_grad_vertical + distance_grad_45 + distance_grad_minus_45) / 4.0;
+            printf("Distance to training image %d (horizontal gradient): %f\n", i + 1, distance);
+            if (distance < min_distance) {
+                min_distance = distance;
+                best_match = i;
+            }
+        }
+    }
+
+    stage_record(STAGE_MATCH, match_start);
+
+    // Output the result
+    if (best_match != -1) {
+        printf("Best match: Training image %d\n", best_match + 1);
+    }
+    else {
+        printf("No match found.\n");
+    }
+
+    // Free the allocated memory
+    for (int i = 0; i < NUM_TRAIN_IMAGES; i++) {
+        free(train_grad_horizontal[i]);
+        free(train_grad_vertical[i]);
+        free(train_grad_45[i]);
+        free(train_grad_minus_45[i]);
+    }
+
+    free(test_grad_horizontal);
+    free(test_grad_vertical);
+    free(test_grad_45);
+    free(test_grad_minus_45);
+    free(train_descriptors);
+    free(test_descriptor);
+    if (options.quant_kind) {
+        quantized_set_free(&train_quantized);
+        quantized_set_free(&test_quantized);
+    }
+
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include "mem_stats.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define MEM_HAS_RUSAGE 1
+#endif
+
+#define MEM_HEADER_SIZE 16 // Keeps the 16-byte alignment of malloc()
+#define MEM_STAGE_BITS 4   // The header packs the stage into the low bits of the size
+
+/**
+ * Byte counts of one stage.
+ */
+struct MemCounters {
+    std::atomic<unsigned long long> allocations;
+    std::atomic<unsigned long long> allocated; // Bytes ever allocated
+    std::atomic<long long> live;               // Bytes allocated and not yet freed
+    std::atomic<long long> peak;               // Highest live value
+};
+
+/**
+ * Counters of one thread, per stage.
+ */
+struct ThreadMemory {
+    MemCounters stages[STAGE_COUNT];
+    int thread_id; // Small sequential id, in registration order
+    ThreadMemory* next;
+};
+
+/**
+ * Header in front of every block.
+ */
+struct MemHeader {
+    ThreadMemory* owner;          // Thread charged with the block, NULL if it could not be registered
+    unsigned long long size_stage; // Size << MEM_STAGE_BITS | stage
+};
+
+static MemCounters process_stages[STAGE_COUNT];
+static std::atomic<ThreadMemory*> all_threads(NULL); // Every thread's counters, newest first
+static std::atomic<int> next_thread_id(1);
+static thread_local ThreadMemory* thread_memory = NULL;
+
+/**
+ * Returns the calling thread's counters, registering them on first use.
+ *
+ * @return Returns the counters, or NULL if memory runs out.
+ */
+static ThreadMemory* own_memory() {
+    if (!thread_memory) {
+        ThreadMemory* memory = new (std::nothrow) ThreadMemory();
+        if (!memory) {
+            return NULL;
+        }
+        memory->thread_id = next_thread_id++;
+        memory->next = all_threads.load();
+        while (!all_threads.compare_exchange_weak(memory->next, memory)) {
+        }
+        thread_memory = memory;
+    }
+    return thread_memory;
+}
+
+/**
+ * Adds a change of live bytes to some counters, raising their peak if needed.
+ *
+ * @param counters The counters.
+ * @param bytes The bytes allocated (positive) or freed (negative).
+ */
+static void count_bytes(MemCounters* counters, long long bytes) {
+    long long live = counters->live.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    if (bytes <= 0) {
+        return;
+    }
+    counters->allocations.fetch_add(1, std::memory_order_relaxed);
+    counters->allocated.fetch_add((unsigned long long)bytes, std::memory_order_relaxed);
+    long long peak = counters->peak.load(std::memory_order_relaxed);
+    while (live > peak && !counters->peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Charges or credits a block to its thread and stage.
+ *
+ * @param header The block's header.
+ * @param sign 1 when the block is allocated, -1 when it is freed.
+ */
+static void count_block(const MemHeader* header, long long sign) {
+    int stage = (int)(header->size_stage & ((1u << MEM_STAGE_BITS) - 1));
+    long long bytes = sign * (long long)(header->size_stage >> MEM_STAGE_BITS);
+    count_bytes(&process_stages[stage], bytes);
+    if (header->owner) {
+        count_bytes(&header->owner->stages[stage], bytes);
+    }
+}
+
+void* mem_alloc(Stage stage, size_t size) {
+    MemHeader* header = (MemHeader*)malloc(MEM_HEADER_SIZE + size);
+    if (!header) {
+        return NULL;
+    }
+    header->owner = own_memory();
+    header->size_stage = (unsigned long long)size << MEM_STAGE_BITS | (unsigned long long)stage;
+    count_block(header, 1);
+    return (unsigned char*)header + MEM_HEADER_SIZE;
+}
+
+void* mem_realloc(Stage stage, void* block, size_t size) {
+    if (!block) {
+        return mem_alloc(stage, size);
+    }
+    MemHeader* header = (MemHeader*)((unsigned char*)block - MEM_HEADER_SIZE);
+    MemHeader old = *header;
+    MemHeader* resized = (MemHeader*)realloc(header, MEM_HEADER_SIZE + size);
+    if (!resized) {
+        return NULL;
+    }
+    count_block(&old, -1);
+    resized->owner = own_memory();
+    resized->size_stage = (unsigned long long)size << MEM_STAGE_BITS | (unsigned long long)stage;
+    count_block(resized, 1);
+    return (unsigned char*)resized + MEM_HEADER_SIZE;
+}
+
+void mem_free(void* block) {
+    if (!block) {
+        return;
+    }
+    MemHeader* header = (MemHeader*)((unsigned char*)block - MEM_HEADER_SIZE);
+    count_block(header, -1);
+    free(header);
+}
+
+void mem_reset_peaks() {
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        process_stages[stage].peak.store(process_stages[stage].live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    for (ThreadMemory* memory = all_threads.load(); memory; memory = memory->next) {
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            memory->stages[stage].peak.store(memory->stages[stage].live.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+}
+
+long long mem_peak_rss() {
+#ifdef MEM_HAS_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+#ifdef __APPLE__
+    return (long long)usage.ru_maxrss;        // Bytes on macOS
+#else
+    return (long long)usage.ru_maxrss * 1024; // Kilobytes on Linux
+#endif
+#else
+    return -1;
+#endif
+}
+
+void mem_report(FILE* file) {
+    fprintf(file, "%-12s %10s %12s %10s %10s\n", "Memory", "Allocs", "Alloc MB", "Live MB", "Peak MB");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        const MemCounters* counters = &process_stages[stage];
+        unsigned long long allocations = counters->allocations.load(std::memory_order_relaxed);
+        if (allocations == 0) {
+            continue;
+        }
+        fprintf(file, "%-12s %10llu %12.1f %10.2f %10.2f\n", stage_name((Stage)stage), allocations,
+                counters->allocated.load(std::memory_order_relaxed) / 1048576.0,
+                counters->live.load(std::memory_order_relaxed) / 1048576.0,
+                counters->peak.load(std::memory_order_relaxed) / 1048576.0);
+    }
+
+    // Peak per thread and stage, where a single thread's share of a stage is what OOMs first
+    fprintf(file, "%-12s", "Peak MB");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        fprintf(file, " %11s", stage_name((Stage)stage));
+    }
+    fprintf(file, "\n");
+    for (ThreadMemory* memory = all_threads.load(); memory; memory = memory->next) {
+        fprintf(file, "thread %-5d", memory->thread_id);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            fprintf(file, " %11.2f", memory->stages[stage].peak.load(std::memory_order_relaxed) / 1048576.0);
+        }
+        fprintf(file, "\n");
+    }
+
+    long long rss = mem_peak_rss();
+    if (rss >= 0) {
+        fprintf(file, "Peak RSS: %.1f MB\n", rss / 1048576.0);
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "stage_timer.h"
+
+/**
+ * Allocates memory charged to a stage and to the calling thread. stb_image, stb_image_resize and
+ * the pipeline's own buffers allocate through here, so the bytes allocated, live and at peak of
+ * every stage are known. Blocks carry a 16-byte header and must be released with mem_free().
+ *
+ * @param stage The stage the memory is charged to.
+ * @param size The number of bytes.
+ * @return Returns the memory, or NULL if it runs out.
+ */
+void* mem_alloc(Stage stage, size_t size);
+
+/**
+ * Resizes a block from mem_alloc(), charging it to the stage from now on.
+ *
+ * @param stage The stage the memory is charged to.
+ * @param block The block, or NULL to allocate a new one.
+ * @param size The new number of bytes.
+ * @return Returns the memory, or NULL if it runs out (the block is then left as it was).
+ */
+void* mem_realloc(Stage stage, void* block, size_t size);
+
+/**
+ * Releases a block from mem_alloc(). The bytes are taken off the thread and stage that
+ * allocated it, whichever thread frees it.
+ *
+ * @param block The block, or NULL.
+ */
+void mem_free(void* block);
+
+/**
+ * Lowers every peak to the bytes live now, e.g. once a gallery is built and the load begins.
+ */
+void mem_reset_peaks();
+
+/**
+ * Returns the peak resident set size of the process.
+ *
+ * @return Returns the peak in bytes, or -1 where the system does not report it.
+ */
+long long mem_peak_rss();
+
+/**
+ * Prints the allocations, bytes allocated, live and at peak of every stage over all threads,
+ * then the peak of every thread per stage, and the peak resident set size.
+ *
+ * @param file The output file.
+ */
+void mem_report(FILE* file);
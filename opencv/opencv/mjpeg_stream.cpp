@@ -0,0 +1,303 @@
+#include "mjpeg_stream.h"
+#include "stage_timer.h"
+#include "trace.h"
+
+#include <string.h>
+
+// Parser states
+#define MJPEG_SEEK_SOI 0     // Outside a frame, looking for FF D8
+#define MJPEG_SEEK_SOI_FF 1  // Outside a frame, after an FF
+#define MJPEG_MARKER 2       // Between segments, expecting FF
+#define MJPEG_MARKER_FF 3    // Between segments, after an FF
+#define MJPEG_LENGTH_HIGH 4  // Reading a segment length
+#define MJPEG_LENGTH_LOW 5
+#define MJPEG_SEGMENT 6      // Skipping a segment payload
+#define MJPEG_ENTROPY 7      // Scanning entropy-coded data
+#define MJPEG_ENTROPY_FF 8   // Entropy-coded data, after an FF
+
+#define JPEG_SOI 0xD8
+#define JPEG_EOI 0xD9
+#define JPEG_SOS 0xDA
+
+void mjpeg_parser_init(MjpegParser* parser) {
+    parser->state = MJPEG_SEEK_SOI;
+    parser->marker = 0;
+    parser->segment_left = 0;
+    parser->in_frame = false;
+    parser->frame_start = 0;
+    parser->spill.clear();
+    parser->spilled = false;
+    parser->frames = 0;
+}
+
+/**
+ * Returns whether a marker stands alone, without a length and payload.
+ *
+ * @param marker The marker byte.
+ * @return Returns true for TEM and the restart markers.
+ */
+static bool standalone_marker(int marker) {
+    return marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7);
+}
+
+/**
+ * Emits the frame ending at the given chunk offset.
+ *
+ * @param parser The parser.
+ * @param chunk The current chunk.
+ * @param end The offset just past the EOI.
+ * @param frames The output frames.
+ */
+static void emit_frame(MjpegParser* parser, const MjpegBuffer& chunk, size_t end, std::vector<MjpegFrame>& frames) {
+    MjpegFrame frame;
+    if (parser->spilled) {
+        // The frame straddled chunks: its bytes were gathered into its own buffer
+        std::vector<unsigned char>* owned = new std::vector<unsigned char>();
+        owned->swap(parser->spill);
+        owned->insert(owned->end(), chunk->data(), chunk->data() + end);
+        frame.buffer = MjpegBuffer(owned);
+        frame.data = owned->data();
+        frame.size = owned->size();
+    }
+    else {
+        frame.buffer = chunk;
+        frame.data = chunk->data() + parser->frame_start;
+        frame.size = end - parser->frame_start;
+    }
+    frame.index = parser->frames++;
+    frame.arrival = std::chrono::steady_clock::now();
+    frames.push_back(frame);
+
+    parser->in_frame = false;
+    parser->spilled = false;
+    parser->spill.clear();
+    parser->state = MJPEG_SEEK_SOI;
+}
+
+/**
+ * Starts a frame at an SOI marker.
+ *
+ * @param parser The parser.
+ * @param position The offset of the SOI's D8 byte in the current chunk.
+ */
+static void start_frame(MjpegParser* parser, size_t position) {
+    parser->in_frame = true;
+    parser->spill.clear();
+    if (position == 0) {
+        // The FF ended the previous chunk
+        parser->spill.push_back(0xFF);
+        parser->spilled = true;
+        parser->frame_start = 0;
+    }
+    else {
+        parser->spilled = false;
+        parser->frame_start = position - 1;
+    }
+    parser->state = MJPEG_MARKER;
+}
+
+/**
+ * Handles a marker found inside a frame.
+ *
+ * @param parser The parser.
+ * @param marker The marker byte.
+ * @param chunk The current chunk.
+ * @param position The offset of the marker byte.
+ * @param frames The output frames.
+ */
+static void handle_marker(MjpegParser* parser, int marker, const MjpegBuffer& chunk, size_t position,
+                          std::vector<MjpegFrame>& frames) {
+    if (marker == JPEG_EOI) {
+        emit_frame(parser, chunk, position + 1, frames);
+    }
+    else if (marker == JPEG_SOI) {
+        // A new SOI without an EOI: the previous frame was truncated, restart here
+        start_frame(parser, position);
+    }
+    else if (standalone_marker(marker)) {
+        parser->state = parser->state == MJPEG_ENTROPY_FF ? MJPEG_ENTROPY : MJPEG_MARKER;
+    }
+    else {
+        parser->marker = marker;
+        parser->state = MJPEG_LENGTH_HIGH;
+    }
+}
+
+void mjpeg_parse_chunk(MjpegParser* parser, const MjpegBuffer& chunk, std::vector<MjpegFrame>& frames) {
+    const unsigned char* bytes = chunk->data();
+    size_t size = chunk->size();
+    size_t i = 0;
+    while (i < size) {
+        switch (parser->state) {
+        case MJPEG_SEEK_SOI: {
+            const unsigned char* ff = (const unsigned char*)memchr(bytes + i, 0xFF, size - i);
+            if (!ff) {
+                i = size;
+                break;
+            }
+            i = ff - bytes + 1;
+            parser->state = MJPEG_SEEK_SOI_FF;
+            break;
+        }
+        case MJPEG_SEEK_SOI_FF:
+            if (bytes[i] == JPEG_SOI) {
+                start_frame(parser, i);
+            }
+            else if (bytes[i] != 0xFF) {
+                parser->state = MJPEG_SEEK_SOI;
+            }
+            i++;
+            break;
+        case MJPEG_MARKER:
+            // Anything but FF here is corrupt data; keep looking for the next marker
+            parser->state = bytes[i] == 0xFF ? MJPEG_MARKER_FF : MJPEG_MARKER;
+            i++;
+            break;
+        case MJPEG_MARKER_FF:
+            if (bytes[i] != 0xFF) { // FF FF is fill
+                handle_marker(parser, bytes[i], chunk, i, frames);
+            }
+            i++;
+            break;
+        case MJPEG_LENGTH_HIGH:
+            parser->segment_left = (size_t)bytes[i] << 8;
+            parser->state = MJPEG_LENGTH_LOW;
+            i++;
+            break;
+        case MJPEG_LENGTH_LOW:
+            parser->segment_left |= bytes[i];
+            parser->segment_left = parser->segment_left >= 2 ? parser->segment_left - 2 : 0;
+            parser->state = MJPEG_SEGMENT;
+            i++;
+            break;
+        case MJPEG_SEGMENT: {
+            size_t skip = size - i < parser->segment_left ? size - i : parser->segment_left;
+            i += skip;
+            parser->segment_left -= skip;
+            if (parser->segment_left == 0) {
+                parser->state = parser->marker == JPEG_SOS ? MJPEG_ENTROPY : MJPEG_MARKER;
+            }
+            break;
+        }
+        case MJPEG_ENTROPY: {
+            const unsigned char* ff = (const unsigned char*)memchr(bytes + i, 0xFF, size - i);
+            if (!ff) {
+                i = size;
+                break;
+            }
+            i = ff - bytes + 1;
+            parser->state = MJPEG_ENTROPY_FF;
+            break;
+        }
+        case MJPEG_ENTROPY_FF:
+            if (bytes[i] == 0x00) { // Stuffed FF data byte
+                parser->state = MJPEG_ENTROPY;
+            }
+            else if (bytes[i] != 0xFF) {
+                handle_marker(parser, bytes[i], chunk, i, frames);
+            }
+            i++;
+            break;
+        }
+    }
+
+    // Keep the unfinished frame's bytes; the chunk itself is released with its last frame
+    if (parser->in_frame) {
+        size_t start = parser->spilled ? 0 : parser->frame_start;
+        parser->spill.insert(parser->spill.end(), bytes + start, bytes + size);
+        parser->spilled = true;
+    }
+}
+
+/**
+ * Reader thread: reads chunks, splits them into frames and queues the frames.
+ *
+ * @param stream The stream.
+ */
+static void reader_main(MjpegStream* stream) {
+    trace_set_thread_name("stream reader");
+    MjpegParser parser;
+    mjpeg_parser_init(&parser);
+    std::vector<MjpegFrame> frames;
+    for (;;) {
+        std::vector<unsigned char>* chunk = new std::vector<unsigned char>(MJPEG_CHUNK_SIZE);
+        size_t read = fread(chunk->data(), 1, MJPEG_CHUNK_SIZE, stream->file);
+        chunk->resize(read);
+        MjpegBuffer buffer(chunk);
+        if (read == 0) {
+            break;
+        }
+
+        frames.clear();
+        mjpeg_parse_chunk(&parser, buffer, frames);
+
+        std::unique_lock<std::mutex> lock(stream->mutex);
+        stream->bytes_read += read;
+        for (MjpegFrame& frame : frames) {
+            stream->frames_read++;
+            if (stream->queue.size() >= stream->capacity) {
+                if (stream->drop_when_full) {
+                    // Live source: the consumer is behind, so the stalest frame goes
+                    stream->queue.pop_front();
+                    stream->frames_dropped++;
+                }
+                else {
+                    stream->changed.wait(lock, [&] { return stream->queue.size() < stream->capacity || stream->stopping; });
+                }
+            }
+            if (stream->stopping) {
+                return;
+            }
+            stream->queue.push_back(frame);
+            stream->changed.notify_all();
+        }
+        if (stream->stopping) {
+            return;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    stream->finished = true;
+    stream->changed.notify_all();
+}
+
+void mjpeg_stream_start(MjpegStream* stream, FILE* file, size_t capacity, bool drop_when_full) {
+    stream->file = file;
+    stream->capacity = capacity > 0 ? capacity : 1;
+    stream->drop_when_full = drop_when_full;
+    stream->queue.clear();
+    stream->finished = false;
+    stream->stopping = false;
+    stream->frames_read = 0;
+    stream->frames_dropped = 0;
+    stream->bytes_read = 0;
+    stream->reader = std::thread(reader_main, stream);
+}
+
+bool mjpeg_stream_next(MjpegStream* stream, MjpegFrame* frame) {
+    long long start = trace_enabled() ? stage_now() : 0;
+    std::unique_lock<std::mutex> lock(stream->mutex);
+    stream->changed.wait(lock, [&] { return !stream->queue.empty() || stream->finished; });
+    if (start) {
+        trace_span("stream wait", start, stage_now());
+    }
+    if (stream->queue.empty()) {
+        return false;
+    }
+    *frame = stream->queue.front();
+    stream->queue.pop_front();
+    stream->changed.notify_all();
+    return true;
+}
+
+void mjpeg_stream_stop(MjpegStream* stream) {
+    {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        stream->stopping = true;
+        stream->changed.notify_all();
+    }
+    if (stream->reader.joinable()) {
+        stream->reader.join();
+    }
+    stream->queue.clear();
+}
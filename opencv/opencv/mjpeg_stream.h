@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdio.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define MJPEG_CHUNK_SIZE (256 * 1024) // Bytes read from the source at a time
+
+typedef std::shared_ptr<const std::vector<unsigned char>> MjpegBuffer;
+
+/**
+ * One JPEG frame of the stream. The bytes stay in the chunk they were read into (the frame
+ * holds a reference to it); only frames straddling two chunks are copied into their own buffer.
+ */
+struct MjpegFrame {
+    MjpegBuffer buffer;        // Keeps the bytes alive
+    const unsigned char* data; // SOI to EOI, inclusive
+    size_t size;
+    long long index;           // Position of the frame in the stream, counting dropped frames
+    std::chrono::steady_clock::time_point arrival; // When its last byte was read
+};
+
+/**
+ * Incremental, marker-aware frame splitter. Marker segments are skipped by their length
+ * field and entropy-coded data is scanned for real markers only (stuffed 0xFF00 bytes and
+ * restart markers are ignored), so an EOI inside an embedded EXIF thumbnail or inside
+ * compressed data cannot end a frame early.
+ */
+struct MjpegParser {
+    int state;
+    int marker;              // Marker whose segment is being read
+    size_t segment_left;     // Bytes of the segment still to skip
+    bool in_frame;
+    size_t frame_start;      // Offset of the SOI in the current chunk, when the frame started in it
+    std::vector<unsigned char> spill; // Bytes of a frame straddling chunks
+    bool spilled;
+    long long frames;        // Frames emitted so far
+};
+
+/**
+ * Resets a parser to wait for the first SOI.
+ *
+ * @param parser The parser.
+ */
+void mjpeg_parser_init(MjpegParser* parser);
+
+/**
+ * Feeds one chunk of the byte stream to the parser and appends the frames it completes.
+ *
+ * @param parser The parser.
+ * @param chunk The chunk, kept alive by the frames that point into it.
+ * @param frames The output frames, appended to.
+ */
+void mjpeg_parse_chunk(MjpegParser* parser, const MjpegBuffer& chunk, std::vector<MjpegFrame>& frames);
+
+/**
+ * A stream being read on its own thread into a bounded frame queue.
+ */
+struct MjpegStream {
+    FILE* file;
+    bool drop_when_full;     // Drop the oldest frame when the queue is full, instead of waiting
+    size_t capacity;
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<MjpegFrame> queue;
+    bool finished;           // The reader reached the end of the source
+    bool stopping;           // The consumer asked the reader to stop
+    long long frames_read;
+    long long frames_dropped;
+    long long bytes_read;
+};
+
+/**
+ * Starts reading frames from a file (or stdin) on a reader thread.
+ *
+ * @param stream The stream to start.
+ * @param file The source, read until its end.
+ * @param capacity The maximum number of frames queued for the consumer.
+ * @param drop_when_full Whether a full queue drops its oldest frame (live sources) or blocks the reader.
+ */
+void mjpeg_stream_start(MjpegStream* stream, FILE* file, size_t capacity, bool drop_when_full);
+
+/**
+ * Waits for the next frame.
+ *
+ * @param stream The stream.
+ * @param frame The output frame.
+ * @return Returns true if a frame is returned, false once the stream is exhausted.
+ */
+bool mjpeg_stream_next(MjpegStream* stream, MjpegFrame* frame);
+
+/**
+ * Stops the reader thread and releases the queued frames. The file is not closed.
+ *
+ * @param stream The stream.
+ */
+void mjpeg_stream_stop(MjpegStream* stream);
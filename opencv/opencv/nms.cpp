@@ -0,0 +1,313 @@
+#include "nms.h"
+
+#include <math.h>
+#include <algorithm>
+#include <queue>
+
+void nms_default_options(NmsOptions* options) {
+    options->iou_threshold = 0.3f;
+    options->soft = false;
+    options->sigma = 0.5f;
+    options->min_weight = 0.01f;
+}
+
+/**
+ * A detection reduced to what suppression needs.
+ */
+struct NmsBox {
+    float left;
+    float top;
+    float right;
+    float bottom;
+    float area;
+};
+
+/**
+ * Returns the intersection over union of two compact boxes.
+ *
+ * @param a The first box.
+ * @param b The second box.
+ * @return Returns the IoU, between 0 and 1.
+ */
+static inline float box_iou(const NmsBox& a, const NmsBox& b) {
+    float width = std::min(a.right, b.right) - std::max(a.left, b.left);
+    float height = std::min(a.bottom, b.bottom) - std::max(a.top, b.top);
+    if (width <= 0.0f || height <= 0.0f) {
+        return 0.0f;
+    }
+    float intersection = width * height;
+    return intersection / (a.area + b.area - intersection);
+}
+
+float detection_iou(const Detection& a, const Detection& b) {
+    NmsBox box_a = { a.x, a.y, a.x + a.width, a.y + a.height, a.width * a.height };
+    NmsBox box_b = { b.x, b.y, b.x + b.width, b.y + b.height, b.width * b.height };
+    return box_iou(box_a, box_b);
+}
+
+/**
+ * A uniform grid of the boxes of one size class, bucketed by the cell holding each box's top-left
+ * corner. Cells are at least as large as the boxes of the class, so a box overlapping a query box
+ * has its corner at most one cell left of or above the query's extent.
+ */
+struct NmsGrid {
+    float origin_x;
+    float origin_y;
+    float cell_size;
+    int columns;
+    int rows;
+    std::vector<std::vector<int>> cells;
+};
+
+/**
+ * The size classes of a box set: boxes whose larger side lies in [2^(k-1), 2^k) share a grid with
+ * cells of 2^k, so a pyramid's small windows never fall into cells sized for its largest boxes.
+ */
+struct NmsGrids {
+    std::vector<NmsGrid> grids;
+    std::vector<int> grid_of; // Grid holding each box
+    std::vector<int> cell_of; // Cell of each box within its grid
+};
+
+/**
+ * Returns the size class of a box: the exponent of the smallest power of two above its larger side.
+ *
+ * @param box The box.
+ * @return Returns the class, at least 0.
+ */
+static inline int size_class(const NmsBox& box) {
+    int exponent;
+    frexpf(std::max(box.right - box.left, box.bottom - box.top), &exponent);
+    return std::max(exponent, 0);
+}
+
+/**
+ * Returns the cell coordinates of a box's top-left corner.
+ *
+ * @param grid The grid.
+ * @param box The box.
+ * @param column The output cell column.
+ * @param row The output cell row.
+ */
+static inline void grid_cell(const NmsGrid* grid, const NmsBox& box, int* column, int* row) {
+    *column = std::min((int)((box.left - grid->origin_x) / grid->cell_size), grid->columns - 1);
+    *row = std::min((int)((box.top - grid->origin_y) / grid->cell_size), grid->rows - 1);
+}
+
+/**
+ * Sizes one grid per size class to cover the corners of its boxes and assigns every box its cell.
+ * The cells start empty.
+ *
+ * @param grids The grids to initialise.
+ * @param boxes The boxes.
+ */
+static void grids_init(NmsGrids* grids, const std::vector<NmsBox>& boxes) {
+    int count = (int)boxes.size();
+    std::vector<int> grid_of_class;
+    std::vector<float> max_x; // Far corner of every grid's boxes
+    std::vector<float> max_y;
+    grids->grid_of.resize(count);
+    for (int i = 0; i < count; i++) {
+        const NmsBox& box = boxes[i];
+        int size = size_class(box);
+        if (size >= (int)grid_of_class.size()) {
+            grid_of_class.resize(size + 1, -1);
+        }
+        int g = grid_of_class[size];
+        if (g < 0) {
+            g = grid_of_class[size] = (int)grids->grids.size();
+            grids->grids.push_back(NmsGrid());
+            grids->grids[g].origin_x = box.left;
+            grids->grids[g].origin_y = box.top;
+            grids->grids[g].cell_size = ldexpf(1.0f, size);
+            max_x.push_back(box.left);
+            max_y.push_back(box.top);
+        }
+        NmsGrid& grid = grids->grids[g];
+        grid.origin_x = std::min(grid.origin_x, box.left);
+        grid.origin_y = std::min(grid.origin_y, box.top);
+        max_x[g] = std::max(max_x[g], box.left);
+        max_y[g] = std::max(max_y[g], box.top);
+        grids->grid_of[i] = g;
+    }
+    for (size_t g = 0; g < grids->grids.size(); g++) {
+        NmsGrid& grid = grids->grids[g];
+        grid.columns = (int)((max_x[g] - grid.origin_x) / grid.cell_size) + 1;
+        grid.rows = (int)((max_y[g] - grid.origin_y) / grid.cell_size) + 1;
+        grid.cells.assign((size_t)grid.columns * grid.rows, std::vector<int>());
+    }
+
+    grids->cell_of.resize(count);
+    for (int i = 0; i < count; i++) {
+        const NmsGrid& grid = grids->grids[grids->grid_of[i]];
+        int column, row;
+        grid_cell(&grid, boxes[i], &column, &row);
+        grids->cell_of[i] = row * grid.columns + column;
+    }
+}
+
+/**
+ * Returns the cells of a grid that can hold a box overlapping the query box: its corner lies at
+ * most one cell left of or above the query's extent.
+ *
+ * @param grid The grid.
+ * @param box The query box.
+ * @param first_column The output first column.
+ * @param last_column The output last column, below first_column if no cell qualifies.
+ * @param first_row The output first row.
+ * @param last_row The output last row, below first_row if no cell qualifies.
+ */
+static inline void grid_range(const NmsGrid* grid, const NmsBox& box, int* first_column, int* last_column,
+                              int* first_row, int* last_row) {
+    *first_column = std::max((int)floorf((box.left - grid->origin_x) / grid->cell_size) - 1, 0);
+    *last_column = std::min((int)floorf((box.right - grid->origin_x) / grid->cell_size), grid->columns - 1);
+    *first_row = std::max((int)floorf((box.top - grid->origin_y) / grid->cell_size) - 1, 0);
+    *last_row = std::min((int)floorf((box.bottom - grid->origin_y) / grid->cell_size), grid->rows - 1);
+}
+
+/**
+ * Hard NMS: keeps a box unless a kept box of any size class near it overlaps it too much.
+ *
+ * @param boxes The boxes, sorted by increasing distance.
+ * @param threshold The IoU threshold.
+ * @param kept The output indices of the kept boxes, in order.
+ */
+static void suppress_hard(const std::vector<NmsBox>& boxes, float threshold, std::vector<int>& kept) {
+    NmsGrids grids;
+    grids_init(&grids, boxes);
+    for (int i = 0; i < (int)boxes.size(); i++) {
+        bool suppressed = false;
+        for (size_t g = 0; g < grids.grids.size() && !suppressed; g++) {
+            const NmsGrid& grid = grids.grids[g];
+            int first_column, last_column, first_row, last_row;
+            grid_range(&grid, boxes[i], &first_column, &last_column, &first_row, &last_row);
+            for (int r = first_row; r <= last_row && !suppressed; r++) {
+                for (int c = first_column; c <= last_column && !suppressed; c++) {
+                    for (int other : grid.cells[(size_t)r * grid.columns + c]) {
+                        if (box_iou(boxes[i], boxes[other]) > threshold) {
+                            suppressed = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        if (!suppressed) {
+            grids.grids[grids.grid_of[i]].cells[grids.cell_of[i]].push_back(i);
+            kept.push_back(i);
+        }
+    }
+}
+
+/**
+ * Soft-NMS: selects boxes best first and decays the weights of their remaining neighbours.
+ * The heap is lazy: a decayed box is pushed again with its new distance, and stale entries are
+ * skipped when popped.
+ *
+ * @param boxes The boxes.
+ * @param distances The distances of the boxes, divided by their final weights on return.
+ * @param options The NMS settings.
+ * @param kept The output indices of the kept boxes, in order of selection.
+ */
+static void suppress_soft(const std::vector<NmsBox>& boxes, std::vector<double>& distances,
+                          const NmsOptions* options, std::vector<int>& kept) {
+    int count = (int)boxes.size();
+    NmsGrids grids;
+    grids_init(&grids, boxes);
+    for (int i = 0; i < count; i++) {
+        grids.grids[grids.grid_of[i]].cells[grids.cell_of[i]].push_back(i);
+    }
+
+    std::vector<float> weights(count, 1.0f);
+    std::vector<bool> done(count, false);
+    typedef std::pair<double, int> HeapEntry; // (effective distance, box)
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    for (int i = 0; i < count; i++) {
+        heap.push(HeapEntry(distances[i], i));
+    }
+
+    while (!heap.empty()) {
+        HeapEntry top = heap.top();
+        heap.pop();
+        int i = top.second;
+        if (done[i] || top.first != distances[i] / weights[i]) {
+            continue; // Already selected, dropped or decayed since this entry was pushed
+        }
+        done[i] = true;
+        kept.push_back(i);
+
+        for (size_t g = 0; g < grids.grids.size(); g++) {
+            NmsGrid& grid = grids.grids[g];
+            int first_column, last_column, first_row, last_row;
+            grid_range(&grid, boxes[i], &first_column, &last_column, &first_row, &last_row);
+            for (int r = first_row; r <= last_row; r++) {
+                for (int c = first_column; c <= last_column; c++) {
+                    std::vector<int>& cell = grid.cells[(size_t)r * grid.columns + c];
+                    for (size_t k = 0; k < cell.size();) {
+                        int other = cell[k];
+                        if (done[other]) {
+                            // Remove selected and dropped boxes from the grid as they are met
+                            cell[k] = cell.back();
+                            cell.pop_back();
+                            continue;
+                        }
+                        float iou = box_iou(boxes[i], boxes[other]);
+                        if (iou > 0.0f) {
+                            weights[other] *= expf(-iou * iou / options->sigma);
+                            if (weights[other] < options->min_weight) {
+                                done[other] = true;
+                            }
+                            else {
+                                heap.push(HeapEntry(distances[other] / weights[other], other));
+                            }
+                        }
+                        k++;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        distances[i] /= weights[i];
+    }
+}
+
+int suppress_detections(std::vector<Detection>& detections, const NmsOptions* options) {
+    if (detections.empty()) {
+        return 0;
+    }
+
+    // Visit the detections by increasing distance, keeping the input order among ties
+    std::vector<Detection> sorted(detections);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Detection& a, const Detection& b) {
+        return a.distance < b.distance;
+    });
+
+    std::vector<NmsBox> boxes(sorted.size());
+    std::vector<double> distances(sorted.size());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        const Detection& detection = sorted[i];
+        boxes[i].left = detection.x;
+        boxes[i].top = detection.y;
+        boxes[i].right = detection.x + detection.width;
+        boxes[i].bottom = detection.y + detection.height;
+        boxes[i].area = detection.width * detection.height;
+        distances[i] = detection.distance;
+    }
+
+    std::vector<int> kept;
+    if (options->soft) {
+        suppress_soft(boxes, distances, options, kept);
+    }
+    else {
+        suppress_hard(boxes, options->iou_threshold, kept);
+    }
+
+    detections.clear();
+    for (int i : kept) {
+        detections.push_back(sorted[i]);
+        detections.back().distance = distances[i];
+    }
+    return (int)detections.size();
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include "detector.h"
+
+/**
+ * Settings of the non-maximum suppression.
+ */
+struct NmsOptions {
+    float iou_threshold; // Boxes overlapping a better box by more than this IoU are suppressed (hard NMS)
+    bool soft;           // Decay overlapping boxes instead of removing them
+    float sigma;         // Soft-NMS Gaussian width: weights decay by exp(-iou^2 / sigma)
+    float min_weight;    // Soft-NMS drops boxes whose weight falls below this
+};
+
+/**
+ * Fills the NMS options with their defaults.
+ *
+ * @param options The options.
+ */
+void nms_default_options(NmsOptions* options);
+
+/**
+ * Returns the intersection over union of two detections.
+ *
+ * @param a The first detection.
+ * @param b The second detection.
+ * @return Returns the IoU, between 0 and 1.
+ */
+float detection_iou(const Detection& a, const Detection& b);
+
+/**
+ * Suppresses overlapping detections, keeping the closest (lowest distance) box of every cluster.
+ *
+ * Boxes are copied into a compact array and split into power-of-two size classes, each bucketed
+ * in its own uniform grid with cells as large as its boxes. A box is only tested against the
+ * cells of each grid that its extent reaches, plus one cell above and to the left, instead of
+ * every other box. A pyramid's small windows thus never share cells sized for image-wide boxes.
+ *
+ * Hard NMS visits boxes by increasing distance and keeps a box unless it overlaps a kept box by
+ * more than the IoU threshold. Soft-NMS instead repeatedly selects the best remaining box from a
+ * lazy heap and multiplies the weight of its neighbours by exp(-iou^2 / sigma); a box's distance
+ * is divided by its weight, so decayed boxes sink in the ranking and drop out below min_weight.
+ *
+ * @param detections The detections, replaced by the survivors sorted by increasing distance.
+ *                   Distances must be positive for soft-NMS.
+ * @param options The NMS settings.
+ * @return Returns the number of surviving detections.
+ */
+int suppress_detections(std::vector<Detection>& detections, const NmsOptions* options);
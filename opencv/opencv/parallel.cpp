@@ -0,0 +1,197 @@
+#include "parallel.h"
+#include "stage_timer.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * One parallel_for() call. It lives on the caller's stack, so a worker only touches it while
+ * registered in active, which the caller waits on before returning.
+ */
+struct ParallelJob {
+    const std::function<void(int, int)>* body;
+    int count;
+    int grain;
+    int chunks;
+    std::atomic<int> next_chunk{ 0 };
+    int finished_chunks = 0; // Guarded by the pool mutex, like active
+    int active = 0;          // Workers that took the job and have not reported back yet
+};
+
+/**
+ * The shared worker pool. Workers sleep until a job is published, take it under the mutex,
+ * then claim chunks through the job's atomic counter until none are left.
+ */
+struct ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex busy;     // Held by the thread currently running a job
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    ParallelJob* job = nullptr; // The running job, NULL once its caller has collected it
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+static std::mutex pool_mutex;
+static ThreadPool* pool = nullptr;
+static int requested_threads = 0;
+static thread_local bool inside_job = false;
+
+/**
+ * Claims and runs chunks of a job until none are left.
+ *
+ * @param job The job.
+ * @return Returns the number of chunks this thread ran.
+ */
+static int run_chunks(ParallelJob* job) {
+    int ran = 0;
+    long long start = trace_enabled() ? stage_now() : 0;
+    for (;;) {
+        int chunk = job->next_chunk.fetch_add(1);
+        if (chunk >= job->chunks) {
+            if (ran > 0 && start) {
+                trace_span("parallel chunks", start, stage_now());
+            }
+            return ran;
+        }
+        int begin = chunk * job->grain;
+        int end = begin + job->grain < job->count ? begin + job->grain : job->count;
+        (*job->body)(begin, end);
+        ran++;
+    }
+}
+
+/**
+ * Worker thread loop.
+ *
+ * @param state The pool.
+ * @param index The worker number, from 1; the calling thread counts as 0.
+ */
+static void worker_main(ThreadPool* state, int index) {
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", index);
+    trace_set_thread_name(name);
+    inside_job = true;
+    unsigned long long seen = 0;
+    for (;;) {
+        ParallelJob* job;
+        {
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->wake.wait(lock, [&] { return state->stopping || state->generation != seen; });
+            if (state->stopping) {
+                return;
+            }
+            seen = state->generation;
+            job = state->job;
+            if (!job) {
+                continue; // Woken after the job was already finished and collected
+            }
+            job->active++;
+        }
+
+        int ran = run_chunks(job);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        job->finished_chunks += ran;
+        job->active--;
+        if (job->active == 0 && job->finished_chunks >= job->chunks) {
+            state->done.notify_one();
+        }
+    }
+}
+
+/**
+ * Returns the pool, starting its workers on first use.
+ *
+ * @return Returns the pool.
+ */
+static ThreadPool* get_pool() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool) {
+        // Destroyed at exit, which joins the workers
+        static ThreadPool instance;
+        pool = &instance;
+        int threads = requested_threads > 0 ? requested_threads : (int)std::thread::hardware_concurrency();
+        for (int i = 1; i < threads; i++) {
+            pool->workers.emplace_back(worker_main, pool, i);
+        }
+    }
+    return pool;
+}
+
+int parallel_threads() {
+    if (requested_threads > 0) {
+        return requested_threads;
+    }
+    int threads = (int)std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
+}
+
+void parallel_set_threads(int threads) {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool) {
+        requested_threads = threads;
+    }
+}
+
+void parallel_for(int count, int grain, const std::function<void(int begin, int end)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+
+    ThreadPool* state = count > grain && !inside_job ? get_pool() : nullptr;
+    if (!state || state->workers.empty() || !state->busy.try_lock()) {
+        for (int begin = 0; begin < count; begin += grain) {
+            body(begin, begin + grain < count ? begin + grain : count);
+        }
+        return;
+    }
+
+    ParallelJob job;
+    job.body = &body;
+    job.count = count;
+    job.grain = grain;
+    job.chunks = (count + grain - 1) / grain;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->job = &job;
+        state->generation++;
+    }
+    state->wake.notify_all();
+
+    inside_job = true;
+    int ran = run_chunks(&job);
+    inside_job = false;
+
+    {
+        long long start = trace_enabled() ? stage_now() : 0;
+        std::unique_lock<std::mutex> lock(state->mutex);
+        job.finished_chunks += ran;
+        state->done.wait(lock, [&] { return job.active == 0 && job.finished_chunks >= job.chunks; });
+        state->job = nullptr;
+        if (start) {
+            trace_span("parallel wait", start, stage_now());
+        }
+    }
+    state->busy.unlock();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <functional>
+
+/**
+ * Returns the number of threads parallel_for() uses, including the calling thread.
+ *
+ * @return Returns the thread count (hardware concurrency unless overridden).
+ */
+int parallel_threads();
+
+/**
+ * Sets the number of threads parallel_for() uses. Must be called before the first
+ * parallel_for(); later calls are ignored once the pool is running.
+ *
+ * @param threads The thread count, 1 runs everything on the calling thread.
+ */
+void parallel_set_threads(int threads);
+
+/**
+ * Runs body over [0, count) split into chunks of at most grain items, on a shared pool of
+ * worker threads plus the calling thread, and returns once every chunk is done. Calls made
+ * from inside a body, or while another thread is using the pool, run serially on the caller.
+ *
+ * @param count The number of items.
+ * @param grain The maximum number of items per chunk.
+ * @param body The function called with each chunk's [begin, end) range.
+ */
+void parallel_for(int count, int grain, const std::function<void(int begin, int end)>& body);
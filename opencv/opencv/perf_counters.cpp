@@ -0,0 +1,191 @@
+#include "perf_counters.h"
+
+#include <string.h>
+#include <atomic>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define PERF_SUPPORTED 1
+#else
+#define PERF_SUPPORTED 0
+#endif
+
+static const char* kernel_names[PERF_KERNEL_COUNT] = { "decode", "resize", "convolution", "distance" };
+static const char* kernel_units[PERF_KERNEL_COUNT] = { "pixel", "pixel", "pixel", "byte" };
+
+static std::atomic<bool> counting(false);
+static char error_message[128] = "hardware counters are only supported on Linux";
+
+// Totals per kernel, over all threads
+static std::atomic<unsigned long long> kernel_calls[PERF_KERNEL_COUNT];
+static std::atomic<unsigned long long> kernel_units_done[PERF_KERNEL_COUNT];
+static std::atomic<unsigned long long> kernel_totals[PERF_KERNEL_COUNT][PERF_EVENT_COUNT];
+static std::atomic<unsigned long long> kernel_unscheduled[PERF_KERNEL_COUNT]; // Calls while the counters were off the PMU
+
+#if PERF_SUPPORTED
+
+/**
+ * The counter group of one thread, closed when the thread exits.
+ */
+struct ThreadCounters {
+    int fds[PERF_EVENT_COUNT];
+    bool opened;
+    bool failed;
+
+    ThreadCounters() : opened(false), failed(false) {
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            fds[e] = -1;
+        }
+    }
+
+    ~ThreadCounters() {
+        for (int e = PERF_EVENT_COUNT - 1; e >= 0; e--) {
+            if (fds[e] >= 0) {
+                close(fds[e]);
+            }
+        }
+    }
+};
+
+static thread_local ThreadCounters thread_counters;
+
+/**
+ * Opens the counters of the calling thread as one group, so they are always scheduled together.
+ *
+ * @param counters The thread's counters.
+ * @return Returns true if all four counters are open, false otherwise.
+ */
+static bool open_counters(ThreadCounters* counters) {
+    static const unsigned long long configs[PERF_EVENT_COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[e];
+        attr.exclude_kernel = 1; // Allowed without privileges at the default perf_event_paranoid
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, e == 0 ? -1 : counters->fds[0], 0);
+        if (fd < 0) {
+            snprintf(error_message, sizeof(error_message), "perf_event_open failed: %s", strerror(errno));
+            counters->failed = true;
+            return false;
+        }
+        counters->fds[e] = fd;
+    }
+    counters->opened = true;
+    return true;
+}
+
+/**
+ * Reads the group of the calling thread, opening it on first use.
+ *
+ * @param sample The output readings.
+ * @return Returns true if the counters were read, false otherwise.
+ */
+static bool read_counters(PerfSample* sample) {
+    ThreadCounters* counters = &thread_counters;
+    if (!counters->opened && (counters->failed || !open_counters(counters))) {
+        return false;
+    }
+    // PERF_FORMAT_GROUP layout: event count, time enabled, time running, then one value per event
+    unsigned long long data[3 + PERF_EVENT_COUNT];
+    if (read(counters->fds[0], data, sizeof(data)) != (ssize_t)sizeof(data) || data[0] != PERF_EVENT_COUNT) {
+        return false;
+    }
+    sample->enabled = data[1];
+    sample->running = data[2];
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        sample->values[e] = data[3 + e];
+    }
+    return true;
+}
+
+#endif
+
+bool perf_counters_enable() {
+#if PERF_SUPPORTED
+    PerfSample sample;
+    if (!read_counters(&sample)) {
+        return false;
+    }
+    counting.store(true, std::memory_order_relaxed);
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char* perf_counters_error() {
+    return error_message;
+}
+
+void perf_begin(PerfSample* sample) {
+    sample->valid = false;
+#if PERF_SUPPORTED
+    if (counting.load(std::memory_order_relaxed)) {
+        sample->valid = read_counters(sample);
+    }
+#endif
+}
+
+void perf_end(PerfKernel kernel, const PerfSample* start, unsigned long long units) {
+#if PERF_SUPPORTED
+    PerfSample end;
+    if (!start->valid || !read_counters(&end)) {
+        return;
+    }
+    unsigned long long enabled = end.enabled - start->enabled;
+    unsigned long long running = end.running - start->running;
+    kernel_calls[kernel].fetch_add(1, std::memory_order_relaxed);
+    kernel_units_done[kernel].fetch_add(units, std::memory_order_relaxed);
+    if (running == 0) {
+        kernel_unscheduled[kernel].fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // Counters shared with other users of the PMU only ran part of the time: extrapolate
+    double scale = (double)enabled / running;
+    for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+        unsigned long long delta = end.values[e] - start->values[e];
+        kernel_totals[kernel][e].fetch_add((unsigned long long)(delta * scale + 0.5), std::memory_order_relaxed);
+    }
+#else
+    (void)kernel;
+    (void)start;
+    (void)units;
+#endif
+}
+
+void perf_report(FILE* file) {
+    if (!counting.load(std::memory_order_relaxed)) {
+        fprintf(file, "Hardware counters unavailable: %s\n", error_message);
+        return;
+    }
+    fprintf(file, "%-12s %10s %14s %6s %10s %10s %10s %12s %12s\n", "Kernel", "Calls", "Units", "Unit",
+            "IPC", "Cycles/u", "Instr/u", "CacheMiss/u", "BranchMiss/u");
+    for (int kernel = 0; kernel < PERF_KERNEL_COUNT; kernel++) {
+        unsigned long long calls = kernel_calls[kernel].load(std::memory_order_relaxed);
+        unsigned long long units = kernel_units_done[kernel].load(std::memory_order_relaxed);
+        if (calls == 0 || units == 0) {
+            continue;
+        }
+        unsigned long long totals[PERF_EVENT_COUNT];
+        for (int e = 0; e < PERF_EVENT_COUNT; e++) {
+            totals[e] = kernel_totals[kernel][e].load(std::memory_order_relaxed);
+        }
+        fprintf(file, "%-12s %10llu %14llu %6s %10.2f %10.3f %10.3f %12.5f %12.5f\n", kernel_names[kernel], calls, units,
+                kernel_units[kernel], totals[PERF_CYCLES] > 0 ? (double)totals[PERF_INSTRUCTIONS] / totals[PERF_CYCLES] : 0.0,
+                (double)totals[PERF_CYCLES] / units, (double)totals[PERF_INSTRUCTIONS] / units,
+                (double)totals[PERF_CACHE_MISSES] / units, (double)totals[PERF_BRANCH_MISSES] / units);
+        unsigned long long unscheduled = kernel_unscheduled[kernel].load(std::memory_order_relaxed);
+        if (unscheduled > 0) {
+            fprintf(file, "  (%llu calls ran while the counters were not scheduled and are not counted)\n", unscheduled);
+        }
+    }
+}
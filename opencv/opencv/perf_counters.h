@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * Kernels measured with hardware counters, each with its own unit of work.
+ */
+enum PerfKernel {
+    PERF_DECODE,      // Image decoding, per decoded pixel
+    PERF_RESIZE,      // Resize to SIZE x SIZE, per input pixel
+    PERF_CONVOLUTION, // The four gradient filters, per output pixel of all four planes
+    PERF_DISTANCE,    // Gallery distance scans, per gallery byte read
+    PERF_KERNEL_COUNT
+};
+
+/**
+ * Hardware events counted around every kernel.
+ */
+enum PerfEvent {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_EVENT_COUNT
+};
+
+/**
+ * Counter readings taken by perf_begin().
+ */
+struct PerfSample {
+    unsigned long long values[PERF_EVENT_COUNT];
+    unsigned long long enabled; // Time the counters were enabled, in ns
+    unsigned long long running; // Time they were actually counting, less when multiplexed
+    bool valid;
+};
+
+/**
+ * Starts counting cycles, instructions, cache misses and branch misses around the kernels.
+ * Every thread opens its own counters (Linux perf_event_open) the first time it runs a kernel.
+ * Other systems, or machines without hardware counters, such as most virtual machines, fail.
+ *
+ * @return Returns true if the counters of the calling thread could be opened, false otherwise.
+ */
+bool perf_counters_enable();
+
+/**
+ * Returns why perf_counters_enable() failed.
+ *
+ * @return Returns a description of the error.
+ */
+const char* perf_counters_error();
+
+/**
+ * Reads the counters of the calling thread before a kernel runs.
+ *
+ * @param sample The output readings, marked invalid when counting is off.
+ */
+void perf_begin(PerfSample* sample);
+
+/**
+ * Reads the counters again after a kernel ran and adds the difference to the kernel's totals.
+ *
+ * @param kernel The kernel.
+ * @param start The readings of perf_begin(), on the same thread.
+ * @param units The work done, in the kernel's unit (pixels or bytes).
+ */
+void perf_end(PerfKernel kernel, const PerfSample* start, unsigned long long units);
+
+/**
+ * Prints the IPC and the cycles, instructions, cache misses and branch misses per unit of every
+ * kernel that ran, over all threads.
+ *
+ * @param file The output file.
+ */
+void perf_report(FILE* file);
@@ -0,0 +1,378 @@
+#include "projection.h"
+#include "cpu_dispatch.h"
+#include "mem_stats.h"
+#include "rng.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROJECTION_MAGIC 0x4A525047u // "GPRJ"
+#define PROJECTION_VERSION 2u
+#define GEMV_TILE 2048 // Input columns per tile (8 KB of floats stays in L1)
+
+void gradients_to_vector(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                         const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                         float* vector) {
+    const unsigned char* planes[4] = { grad_horizontal, grad_vertical, grad_45, grad_minus_45 };
+    int plane_size = size * size;
+    for (int p = 0; p < 4; p++) {
+        for (int i = 0; i < plane_size; i++) {
+            vector[p * plane_size + i] = planes[p][i];
+        }
+    }
+}
+
+/**
+ * Allocates the mean and matrix of a projection.
+ *
+ * @param projection The projection.
+ * @param kind The kind of projection.
+ * @param input_dim The input dimension.
+ * @param output_dim The output dimension.
+ * @return Returns true if the dimensions are valid and the memory is allocated.
+ */
+static bool projection_alloc(Projection* projection, ProjectionKind kind, int input_dim, int output_dim) {
+    projection->mean = NULL;
+    projection->matrix = NULL;
+    if (input_dim <= 0 || output_dim < PROJECTION_MIN_DIM || output_dim > PROJECTION_MAX_DIM) {
+        return false;
+    }
+
+    projection->kind = kind;
+    projection->input_dim = input_dim;
+    projection->output_dim = output_dim;
+    projection->seed = 0;
+    projection->fingerprint = 0;
+    projection->mean = (float*)mem_alloc(STAGE_MATCH, input_dim * sizeof(float));
+    projection->matrix = (float*)mem_alloc(STAGE_MATCH, (size_t)output_dim * input_dim * sizeof(float));
+    if (!projection->mean || !projection->matrix) {
+        projection_free(projection);
+        return false;
+    }
+    memset(projection->mean, 0, input_dim * sizeof(float));
+    return true;
+}
+
+/**
+ * Fills a matrix row with N(0, 1/length) samples.
+ *
+ * @param rng The random generator.
+ * @param row The row to fill.
+ * @param length The number of values in the row.
+ */
+static void random_row(Rng* rng, float* row, int length) {
+    double scale = 1.0 / sqrt((double)length);
+    for (int i = 0; i < length; i++) {
+        row[i] = (float)(rng_next_gaussian(rng) * scale);
+    }
+}
+
+uint64_t projection_fingerprint(const float* data, int count, int input_dim) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    int dims[2] = { count, input_dim };
+    const unsigned char* bytes = (const unsigned char*)dims;
+    for (size_t i = 0; i < sizeof(dims); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    bytes = (const unsigned char*)data;
+    size_t size = (size_t)count * input_dim * sizeof(float);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool projection_init_random(Projection* projection, int input_dim, int output_dim, uint64_t seed) {
+    if (!projection_alloc(projection, PROJECTION_RANDOM, input_dim, output_dim)) {
+        return false;
+    }
+    projection->seed = seed;
+
+    Rng rng;
+    rng_seed(&rng, seed);
+    for (int r = 0; r < output_dim; r++) {
+        random_row(&rng, projection->matrix + (size_t)r * input_dim, input_dim);
+    }
+    return true;
+}
+
+/**
+ * Computes all eigenvalues and eigenvectors of a symmetric matrix with cyclic Jacobi rotations.
+ *
+ * @param a The n x n symmetric matrix, destroyed on return.
+ * @param n The matrix size.
+ * @param eigenvalues The output array of n eigenvalues.
+ * @param eigenvectors The output n x n matrix whose columns are the eigenvectors.
+ */
+static void jacobi_eigen(double* a, int n, double* eigenvalues, double* eigenvectors) {
+    for (int i = 0; i < n * n; i++) {
+        eigenvectors[i] = 0.0;
+    }
+    for (int i = 0; i < n; i++) {
+        eigenvectors[i * n + i] = 1.0;
+    }
+
+    for (int sweep = 0; sweep < 50; sweep++) {
+        double off = 0.0;
+        double total = 0.0;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                total += a[i * n + j] * a[i * n + j];
+                if (i != j) {
+                    off += a[i * n + j] * a[i * n + j];
+                }
+            }
+        }
+        if (off <= 1e-22 * total) {
+            break;
+        }
+
+        for (int p = 0; p < n - 1; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double apq = a[p * n + q];
+                if (fabs(apq) < 1e-300) {
+                    continue;
+                }
+                double theta = (a[q * n + q] - a[p * n + p]) / (2.0 * apq);
+                double t = (theta >= 0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                double c = 1.0 / sqrt(t * t + 1.0);
+                double s = t * c;
+
+                for (int k = 0; k < n; k++) {
+                    double akp = a[k * n + p];
+                    double akq = a[k * n + q];
+                    a[k * n + p] = c * akp - s * akq;
+                    a[k * n + q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < n; k++) {
+                    double apk = a[p * n + k];
+                    double aqk = a[q * n + k];
+                    a[p * n + k] = c * apk - s * aqk;
+                    a[q * n + k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < n; k++) {
+                    double vkp = eigenvectors[k * n + p];
+                    double vkq = eigenvectors[k * n + q];
+                    eigenvectors[k * n + p] = c * vkp - s * vkq;
+                    eigenvectors[k * n + q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        eigenvalues[i] = a[i * n + i];
+    }
+}
+
+bool projection_train_pca(Projection* projection, const float* data, int count, int input_dim, int output_dim, uint64_t seed) {
+    if (count < 1 || !projection_alloc(projection, PROJECTION_PCA, input_dim, output_dim)) {
+        return false;
+    }
+
+    // Subsample large galleries evenly so the Gram matrix stays small
+    int n = count < PCA_MAX_SAMPLES ? count : PCA_MAX_SAMPLES;
+    const float** samples = (const float**)mem_alloc(STAGE_MATCH, n * sizeof(float*));
+    float* centred = (float*)mem_alloc(STAGE_MATCH, (size_t)n * input_dim * sizeof(float));
+    double* gram = (double*)mem_alloc(STAGE_MATCH, (size_t)n * n * sizeof(double));
+    double* eigenvalues = (double*)mem_alloc(STAGE_MATCH, n * sizeof(double));
+    double* eigenvectors = (double*)mem_alloc(STAGE_MATCH, (size_t)n * n * sizeof(double));
+    int* order = (int*)mem_alloc(STAGE_MATCH, n * sizeof(int));
+    if (!samples || !centred || !gram || !eigenvalues || !eigenvectors || !order) {
+        mem_free(samples);
+        mem_free(centred);
+        mem_free(gram);
+        mem_free(eigenvalues);
+        mem_free(eigenvectors);
+        mem_free(order);
+        projection_free(projection);
+        return false;
+    }
+    projection->seed = seed;
+    projection->fingerprint = projection_fingerprint(data, count, input_dim);
+    for (int i = 0; i < n; i++) {
+        samples[i] = data + (size_t)((long long)i * count / n) * input_dim;
+    }
+
+    float* mean = projection->mean;
+    for (int i = 0; i < n; i++) {
+        for (int d = 0; d < input_dim; d++) {
+            mean[d] += samples[i][d];
+        }
+    }
+    for (int d = 0; d < input_dim; d++) {
+        mean[d] /= n;
+    }
+
+    // Centred samples and their Gram matrix G = X X^T
+    for (int i = 0; i < n; i++) {
+        for (int d = 0; d < input_dim; d++) {
+            centred[(size_t)i * input_dim + d] = samples[i][d] - mean[d];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        for (int j = i; j < n; j++) {
+            const float* xi = centred + (size_t)i * input_dim;
+            const float* xj = centred + (size_t)j * input_dim;
+            double dot = 0.0;
+            for (int d = 0; d < input_dim; d++) {
+                dot += (double)xi[d] * xj[d];
+            }
+            gram[i * n + j] = dot;
+            gram[j * n + i] = dot;
+        }
+    }
+
+    jacobi_eigen(gram, n, eigenvalues, eigenvectors);
+
+    // Order the components by decreasing variance
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (int i = 1; i < n; i++) {
+        int value = order[i];
+        int j = i - 1;
+        while (j >= 0 && eigenvalues[order[j]] < eigenvalues[value]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = value;
+    }
+
+    // A principal direction in input space is X^T v / sqrt(lambda), which has unit norm
+    int components = 0;
+    double largest = n > 0 ? eigenvalues[order[0]] : 0.0;
+    for (int c = 0; c < n && components < output_dim; c++) {
+        double lambda = eigenvalues[order[c]];
+        if (lambda <= 1e-9 * largest || lambda <= 0.0) {
+            break;
+        }
+        float* row = projection->matrix + (size_t)components * input_dim;
+        double scale = 1.0 / sqrt(lambda);
+        for (int d = 0; d < input_dim; d++) {
+            double value = 0.0;
+            for (int i = 0; i < n; i++) {
+                value += centred[(size_t)i * input_dim + d] * eigenvectors[i * n + order[c]];
+            }
+            row[d] = (float)(value * scale);
+        }
+        components++;
+    }
+
+    // Fill the remaining rows with random directions orthogonal to the principal components
+    Rng rng;
+    rng_seed(&rng, seed);
+    for (int r = components; r < output_dim; r++) {
+        float* row = projection->matrix + (size_t)r * input_dim;
+        random_row(&rng, row, input_dim);
+        for (int c = 0; c < components; c++) {
+            const float* pc = projection->matrix + (size_t)c * input_dim;
+            double dot = 0.0;
+            for (int d = 0; d < input_dim; d++) {
+                dot += (double)row[d] * pc[d];
+            }
+            for (int d = 0; d < input_dim; d++) {
+                row[d] -= (float)(dot * pc[d]);
+            }
+        }
+    }
+
+    mem_free(samples);
+    mem_free(centred);
+    mem_free(gram);
+    mem_free(eigenvalues);
+    mem_free(eigenvectors);
+    mem_free(order);
+    return true;
+}
+
+void projection_apply(const Projection* projection, const float* input, float* output) {
+    int input_dim = projection->input_dim;
+    int output_dim = projection->output_dim;
+    memset(output, 0, output_dim * sizeof(float));
+
+    const CpuKernels* kernels = cpu_kernels();
+    float centred[GEMV_TILE];
+    for (int tile = 0; tile < input_dim; tile += GEMV_TILE) {
+        int end = tile + GEMV_TILE < input_dim ? tile + GEMV_TILE : input_dim;
+        for (int d = tile; d < end; d++) {
+            centred[d - tile] = input[d] - projection->mean[d];
+        }
+        int r = 0;
+
+        // Four rows at a time share every load of the input tile
+        for (; r + 4 <= output_dim; r += 4) {
+            float sum[4];
+            kernels->dot4_f32(projection->matrix + (size_t)r * input_dim + tile, input_dim, centred, end - tile, sum);
+            output[r] += sum[0];
+            output[r + 1] += sum[1];
+            output[r + 2] += sum[2];
+            output[r + 3] += sum[3];
+        }
+
+        for (; r < output_dim; r++) {
+            const float* m = projection->matrix + (size_t)r * input_dim;
+            float sum = 0.0f;
+            for (int d = tile; d < end; d++) {
+                sum += m[d] * centred[d - tile];
+            }
+            output[r] += sum;
+        }
+    }
+}
+
+bool projection_save(const Projection* projection, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned int header[9] = { PROJECTION_MAGIC, PROJECTION_VERSION, (unsigned int)projection->kind,
+                               (unsigned int)projection->input_dim, (unsigned int)projection->output_dim,
+                               (unsigned int)projection->seed, (unsigned int)(projection->seed >> 32),
+                               (unsigned int)projection->fingerprint, (unsigned int)(projection->fingerprint >> 32) };
+    size_t matrix_size = (size_t)projection->output_dim * projection->input_dim;
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1
+           && fwrite(projection->mean, sizeof(float), projection->input_dim, file) == (size_t)projection->input_dim
+           && fwrite(projection->matrix, sizeof(float), matrix_size, file) == matrix_size;
+    fclose(file);
+    return ok;
+}
+
+bool projection_load(Projection* projection, const char* path) {
+    projection->mean = NULL;
+    projection->matrix = NULL;
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    unsigned int header[9];
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != PROJECTION_MAGIC || header[1] != PROJECTION_VERSION
+        || (header[2] != PROJECTION_RANDOM && header[2] != PROJECTION_PCA)
+        || !projection_alloc(projection, (ProjectionKind)header[2], (int)header[3], (int)header[4])) {
+        fclose(file);
+        return false;
+    }
+    projection->seed = header[5] | (uint64_t)header[6] << 32;
+    projection->fingerprint = header[7] | (uint64_t)header[8] << 32;
+
+    size_t matrix_size = (size_t)projection->output_dim * projection->input_dim;
+    bool ok = fread(projection->mean, sizeof(float), projection->input_dim, file) == (size_t)projection->input_dim
+           && fread(projection->matrix, sizeof(float), matrix_size, file) == matrix_size;
+    fclose(file);
+    if (!ok) {
+        projection_free(projection);
+    }
+    return ok;
+}
+
+void projection_free(Projection* projection) {
+    mem_free(projection->mean);
+    mem_free(projection->matrix);
+    projection->mean = NULL;
+    projection->matrix = NULL;
+}
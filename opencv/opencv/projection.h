@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PROJECTION_MIN_DIM 64 // Smallest supported output dimension
+#define PROJECTION_MAX_DIM 512 // Largest supported output dimension
+#define PCA_MAX_SAMPLES 256 // Gallery entries used to train PCA; larger galleries are subsampled
+
+enum ProjectionKind {
+    PROJECTION_RANDOM = 1, // Seeded random Gaussian projection
+    PROJECTION_PCA = 2     // Principal components of the enrolled gallery
+};
+
+/**
+ * Linear projection y = matrix * (x - mean) mapping descriptors to a lower dimension.
+ */
+struct Projection {
+    ProjectionKind kind;
+    int input_dim;
+    int output_dim;
+    uint64_t seed;        // Seed of the random rows
+    uint64_t fingerprint; // Checksum of the training descriptors (PCA), 0 for random projections
+    float* mean;          // input_dim values subtracted before projecting
+    float* matrix;        // output_dim rows of input_dim values
+};
+
+/**
+ * Concatenates the four gradient planes into one float vector.
+ *
+ * @param grad_horizontal The horizontal gradient plane.
+ * @param grad_vertical The vertical gradient plane.
+ * @param grad_45 The 45-degree gradient plane.
+ * @param grad_minus_45 The -45-degree gradient plane.
+ * @param size The width and height of the planes.
+ * @param vector The output array of 4 * size * size floats.
+ */
+void gradients_to_vector(const unsigned char* grad_horizontal, const unsigned char* grad_vertical,
+                         const unsigned char* grad_45, const unsigned char* grad_minus_45, int size,
+                         float* vector);
+
+/**
+ * Returns a checksum of a set of descriptors (FNV-1a over their bytes and dimensions), which
+ * identifies the gallery a PCA projection was trained on.
+ *
+ * @param data The descriptors, count rows of input_dim floats.
+ * @param count The number of descriptors.
+ * @param input_dim The descriptor dimension.
+ * @return Returns the checksum.
+ */
+uint64_t projection_fingerprint(const float* data, int count, int input_dim);
+
+/**
+ * Creates a seeded random Gaussian projection. Rows are drawn from N(0, 1/input_dim)
+ * so they have roughly unit norm, which preserves relative distances (Johnson-Lindenstrauss).
+ *
+ * @param projection The projection to initialise.
+ * @param input_dim The input dimension.
+ * @param output_dim The output dimension.
+ * @param seed The seed of the random matrix.
+ * @return Returns true if the projection is created, false on invalid dimensions.
+ */
+bool projection_init_random(Projection* projection, int input_dim, int output_dim, uint64_t seed);
+
+/**
+ * Trains a PCA projection from the enrolled gallery. The leading principal components
+ * are found from the count x count Gram matrix, which is much cheaper than the
+ * input_dim x input_dim covariance when the gallery is small. A gallery has at most
+ * count - 1 meaningful components; any remaining output rows are filled with seeded
+ * random directions orthogonal to them.
+ *
+ * @param projection The projection to initialise.
+ * @param data The gallery descriptors, count rows of input_dim floats.
+ * @param count The number of gallery descriptors.
+ * @param input_dim The input dimension.
+ * @param output_dim The output dimension.
+ * @param seed The seed of the random fill rows.
+ * @return Returns true if the projection is trained, false on invalid parameters or if memory runs out.
+ */
+bool projection_train_pca(Projection* projection, const float* data, int count, int input_dim, int output_dim, uint64_t seed);
+
+/**
+ * Applies the projection with a blocked GEMV: four output rows share each loaded input
+ * chunk, and the input is walked in L1-sized column tiles, centred one tile at a time on the stack.
+ *
+ * @param projection The projection.
+ * @param input The input descriptor of input_dim floats.
+ * @param output The output array of output_dim floats.
+ */
+void projection_apply(const Projection* projection, const float* input, float* output);
+
+/**
+ * Writes the projection to a binary file.
+ *
+ * @param projection The projection.
+ * @param path The file path.
+ * @return Returns true if the file is written, false otherwise.
+ */
+bool projection_save(const Projection* projection, const char* path);
+
+/**
+ * Reads a projection written by projection_save().
+ *
+ * @param projection The projection to initialise.
+ * @param path The file path.
+ * @return Returns true if the file is read, false if it is missing or malformed.
+ */
+bool projection_load(Projection* projection, const char* path);
+
+/**
+ * Releases the memory held by a projection.
+ *
+ * @param projection The projection.
+ */
+void projection_free(Projection* projection);
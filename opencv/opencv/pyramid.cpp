@@ -0,0 +1,175 @@
+#include "pyramid.h"
+#include "cpu_dispatch.h"
+#include "image_features.h"
+#include "mem_stats.h"
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#define PYRAMID_ALIGN 64 // Every image in the arena starts on a cache line
+
+/**
+ * Rounds a size up to the arena alignment.
+ *
+ * @param size The size in bytes.
+ * @return Returns the aligned size.
+ */
+static size_t align_size(size_t size) {
+    return (size + PYRAMID_ALIGN - 1) / PYRAMID_ALIGN * PYRAMID_ALIGN;
+}
+
+void decimate_2x(const unsigned char* input, int width, int height, unsigned char* output) {
+    const CpuKernels* kernels = cpu_kernels();
+    int out_width = width / 2;
+    int out_height = height / 2;
+    for (int y = 0; y < out_height; y++) {
+        const unsigned char* top = input + (size_t)(2 * y) * width;
+        kernels->decimate_row_2x(top, top + width, out_width, output + (size_t)y * out_width);
+    }
+}
+
+/**
+ * Plans the levels of a pyramid and builds its octaves, with or without room for the levels.
+ *
+ * @param pyramid The pyramid to build.
+ * @param gray The grayscale image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param scale_step The downscale factor between levels (> 1).
+ * @param min_width The minimum level width.
+ * @param min_height The minimum level height.
+ * @param with_levels Whether the arena also holds every level.
+ * @return Returns true if the octaves are built, false if memory runs out.
+ */
+static bool build_octaves(Pyramid* pyramid, const unsigned char* gray, int width, int height, float scale_step,
+                          int min_width, int min_height, bool with_levels) {
+    pyramid->level_count = 0;
+    pyramid->octave_count = 0;
+    pyramid->arena = NULL;
+    if (scale_step <= 1.0f) {
+        return true;
+    }
+
+    // Level sizes, and the octave each level is resized from
+    int octave_count = 1;
+    size_t arena_size = 0;
+    float scale = 1.0f;
+    for (int level = 0; level < PYRAMID_MAX_LEVELS; level++, scale *= scale_step) {
+        int level_width = (int)(width / scale);
+        int level_height = (int)(height / scale);
+        if (level_width < min_width || level_height < min_height) {
+            break;
+        }
+        PyramidLevel* out = &pyramid->levels[level];
+        out->width = level_width;
+        out->height = level_height;
+        out->scale = scale;
+        out->pixels = NULL;
+        int octave = 0;
+        while ((float)(2 << octave) <= scale) {
+            octave++;
+        }
+        out->octave = octave;
+        if (octave + 1 > octave_count) {
+            octave_count = octave + 1;
+        }
+        if (with_levels) {
+            arena_size += align_size((size_t)level_width * level_height);
+        }
+        pyramid->level_count++;
+    }
+    if (pyramid->level_count == 0) {
+        return true;
+    }
+
+    // Octave 0 is the input itself; the others follow the levels in the arena
+    pyramid->octave_count = octave_count;
+    pyramid->octave_width[0] = width;
+    pyramid->octave_height[0] = height;
+    for (int o = 1; o < octave_count; o++) {
+        pyramid->octave_width[o] = pyramid->octave_width[o - 1] / 2;
+        pyramid->octave_height[o] = pyramid->octave_height[o - 1] / 2;
+        arena_size += align_size((size_t)pyramid->octave_width[o] * pyramid->octave_height[o]);
+    }
+
+    pyramid->arena = arena_size > 0 ? (unsigned char*)mem_alloc(STAGE_DETECT, arena_size) : NULL;
+    if (arena_size > 0 && !pyramid->arena) {
+        pyramid->level_count = 0;
+        pyramid->octave_count = 0;
+        return false;
+    }
+    unsigned char* cursor = pyramid->arena;
+    for (int level = 0; with_levels && level < pyramid->level_count; level++) {
+        pyramid->levels[level].pixels = cursor;
+        cursor += align_size((size_t)pyramid->levels[level].width * pyramid->levels[level].height);
+    }
+    pyramid->octaves[0] = gray;
+    for (int o = 1; o < octave_count; o++) {
+        unsigned char* octave = cursor;
+        cursor += align_size((size_t)pyramid->octave_width[o] * pyramid->octave_height[o]);
+        decimate_2x(pyramid->octaves[o - 1], pyramid->octave_width[o - 1], pyramid->octave_height[o - 1], octave);
+        pyramid->octaves[o] = octave;
+    }
+    return true;
+}
+
+bool pyramid_build_octaves(Pyramid* pyramid, const unsigned char* gray, int width, int height, float scale_step,
+                           int min_width, int min_height) {
+    return build_octaves(pyramid, gray, width, height, scale_step, min_width, min_height, false);
+}
+
+bool pyramid_level_rect(const Pyramid* pyramid, int level, int left, int top, int right, int bottom,
+                        unsigned char* region, int region_stride, ResizeScratch* scratch) {
+    const PyramidLevel* out = &pyramid->levels[level];
+    int o = out->octave;
+    const unsigned char* octave = pyramid->octaves[o];
+    int octave_width = pyramid->octave_width[o];
+    if (out->width == octave_width && out->height == pyramid->octave_height[o]) {
+        for (int y = top; y < bottom; y++) {
+            memcpy(region + (size_t)(y - top) * region_stride, octave + (size_t)y * octave_width + left, right - left);
+        }
+        return true;
+    }
+    return resize_gray_region(octave, octave_width, pyramid->octave_height[o], 0, out->width, out->height,
+                              left, top, right, bottom, region, region_stride, scratch);
+}
+
+bool pyramid_build(Pyramid* pyramid, const unsigned char* gray, int width, int height, float scale_step,
+                   int min_width, int min_height) {
+    if (!build_octaves(pyramid, gray, width, height, scale_step, min_width, min_height, true)) {
+        return false;
+    }
+    if (pyramid->level_count == 0) {
+        return true;
+    }
+
+    // Levels are dealt round-robin so every thread gets a mix of large and small ones
+    int tasks = parallel_threads() < pyramid->level_count ? parallel_threads() : pyramid->level_count;
+    std::atomic<bool> ok(true);
+    parallel_for(tasks, 1, [&](int begin, int end) {
+        for (int task = begin; task < end; task++) {
+            ResizeScratch scratch = { NULL, 0 };
+            for (int level = task; level < pyramid->level_count; level += tasks) {
+                PyramidLevel* out = &pyramid->levels[level];
+                if (!pyramid_level_rect(pyramid, level, 0, 0, out->width, out->height, out->pixels, out->width, &scratch)) {
+                    ok = false;
+                }
+            }
+            resize_scratch_free(&scratch);
+        }
+    });
+    if (!ok) {
+        pyramid_free(pyramid);
+        return false;
+    }
+    return true;
+}
+
+void pyramid_free(Pyramid* pyramid) {
+    mem_free(pyramid->arena);
+    pyramid->arena = NULL;
+    pyramid->level_count = 0;
+    pyramid->octave_count = 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "image_features.h"
+
+#define PYRAMID_MAX_LEVELS 32 // Levels kept at most, enough for a 1.25 step over 1000x
+
+/**
+ * One downscaled copy of the input image.
+ */
+struct PyramidLevel {
+    int width;
+    int height;
+    float scale;           // Input pixels per level pixel
+    unsigned char* pixels; // Tightly packed, inside the pyramid arena; NULL when built by pyramid_build_octaves()
+    int octave;            // Octave the level is resized from
+};
+
+/**
+ * Successive downscaled levels of a grayscale image, all held in a single allocation.
+ */
+struct Pyramid {
+    int level_count;
+    PyramidLevel levels[PYRAMID_MAX_LEVELS];
+    int octave_count;
+    const unsigned char* octaves[PYRAMID_MAX_LEVELS]; // Octave 0 is the input image itself
+    int octave_width[PYRAMID_MAX_LEVELS];
+    int octave_height[PYRAMID_MAX_LEVELS];
+    unsigned char* arena; // Every level, followed by the 2:1 octave images they are resized from
+};
+
+/**
+ * Halves an image in both directions by averaging every 2x2 block (rounded to nearest).
+ * An odd last row or column is dropped.
+ *
+ * @param input The input image.
+ * @param width The width of the input.
+ * @param height The height of the input.
+ * @param output The output image of (width / 2) x (height / 2) pixels.
+ */
+void decimate_2x(const unsigned char* input, int width, int height, unsigned char* output);
+
+/**
+ * Builds the pyramid of an image: level k is scaled down by scale_step^k, down to the smallest
+ * level still holding a min_width x min_height window. Octave images (1/2, 1/4, ...) are built
+ * first with the 2:1 decimator, then every level is resized from the largest octave not smaller
+ * than itself, so no resize shrinks by 2 or more. Levels are resized in parallel, each thread
+ * reusing one resize scratch buffer.
+ *
+ * @param pyramid The pyramid to build.
+ * @param gray The grayscale image.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param scale_step The downscale factor between levels (> 1).
+ * @param min_width The minimum level width.
+ * @param min_height The minimum level height.
+ * @return Returns true if the pyramid is built (possibly with no level), false if memory runs out.
+ */
+bool pyramid_build(Pyramid* pyramid, const unsigned char* gray, int width, int height, float scale_step,
+                   int min_width, int min_height);
+
+/**
+ * Plans the same levels as pyramid_build() but only builds the octave images, about a third of
+ * the input, leaving every level unmaterialised: pyramid_level_rect() then produces any part of
+ * a level straight from its octave, e.g. the rows of a strip as it is processed.
+ *
+ * @param pyramid The pyramid to build.
+ * @param gray The grayscale image, which must outlive the pyramid.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param scale_step The downscale factor between levels (> 1).
+ * @param min_width The minimum level width.
+ * @param min_height The minimum level height.
+ * @return Returns true if the octaves are built (possibly with no level), false if memory runs out.
+ */
+bool pyramid_build_octaves(Pyramid* pyramid, const unsigned char* gray, int width, int height, float scale_step,
+                           int min_width, int min_height);
+
+/**
+ * Computes a rectangle of a level from its octave. The pixels are exactly those pyramid_build()
+ * stores for the level.
+ *
+ * @param pyramid The pyramid.
+ * @param level The level.
+ * @param left The left edge of the rectangle.
+ * @param top The top edge of the rectangle.
+ * @param right The right edge of the rectangle (exclusive).
+ * @param bottom The bottom edge of the rectangle (exclusive).
+ * @param region The output for the rectangle's first pixel.
+ * @param region_stride The row stride of the region in bytes.
+ * @param scratch The resize scratch buffer to work in (grown as needed).
+ * @return Returns true if the rectangle is computed, false if memory runs out.
+ */
+bool pyramid_level_rect(const Pyramid* pyramid, int level, int left, int top, int right, int bottom,
+                        unsigned char* region, int region_stride, ResizeScratch* scratch);
+
+/**
+ * Releases the memory held by a pyramid.
+ *
+ * @param pyramid The pyramid.
+ */
+void pyramid_free(Pyramid* pyramid);
@@ -0,0 +1,95 @@
+#include "quantize.h"
+#include "cpu_dispatch.h"
+#include "mem_stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define QUANT_MAX_LENGTH 32768 // Keeps every 32-bit code accumulator free of overflow
+
+bool quantized_set_init(QuantizedSet* set, QuantKind kind, int length, int count) {
+    memset(set, 0, sizeof(QuantizedSet));
+    if (length <= 0 || length > QUANT_MAX_LENGTH || count <= 0) {
+        return false;
+    }
+
+    set->kind = kind;
+    set->length = length;
+    set->count = count;
+    set->stride = (quantized_bytes(kind, length) + 15) & ~15;
+    set->codes = (unsigned char*)mem_alloc(STAGE_MATCH, (size_t)count * set->stride);
+    set->scales = (float*)mem_alloc(STAGE_MATCH, count * sizeof(float));
+    set->offsets = (float*)mem_alloc(STAGE_MATCH, count * sizeof(float));
+    set->code_sums = (int*)mem_alloc(STAGE_MATCH, count * sizeof(int));
+    set->code_squares = (int*)mem_alloc(STAGE_MATCH, count * sizeof(int));
+    if (!set->codes || !set->scales || !set->offsets || !set->code_sums || !set->code_squares) {
+        quantized_set_free(set);
+        return false;
+    }
+    memset(set->codes, 0, (size_t)count * set->stride);
+    return true;
+}
+
+void quantize_entry(QuantizedSet* set, int index, const float* descriptor) {
+    int length = set->length;
+    int levels = set->kind == QUANT_INT4 ? 15 : 255;
+    unsigned char* codes = set->codes + (size_t)index * set->stride;
+
+    // Calibrate the entry on its own range so every code level is usable
+    float low = descriptor[0];
+    float high = descriptor[0];
+    for (int i = 1; i < length; i++) {
+        low = descriptor[i] < low ? descriptor[i] : low;
+        high = descriptor[i] > high ? descriptor[i] : high;
+    }
+    float scale = high > low ? (high - low) / levels : 1.0f;
+    float inverse = 1.0f / scale;
+
+    memset(codes, 0, set->stride);
+    int sum = 0;
+    int squares = 0;
+    for (int i = 0; i < length; i++) {
+        int q = (int)((descriptor[i] - low) * inverse + 0.5f);
+        q = q < 0 ? 0 : (q > levels ? levels : q);
+        sum += q;
+        squares += q * q;
+        if (set->kind == QUANT_INT4) {
+            codes[i >> 1] |= (unsigned char)(q << ((i & 1) * 4));
+        }
+        else {
+            codes[i] = (unsigned char)q;
+        }
+    }
+
+    set->scales[index] = scale;
+    set->offsets[index] = low;
+    set->code_sums[index] = sum;
+    set->code_squares[index] = squares;
+}
+
+double quantized_distance(const QuantizedSet* a, int index_a, const QuantizedSet* b, int index_b) {
+    const unsigned char* codes_a = a->codes + (size_t)index_a * a->stride;
+    const unsigned char* codes_b = b->codes + (size_t)index_b * b->stride;
+    const CpuKernels* kernels = cpu_kernels();
+    long long dot = a->kind == QUANT_INT4 ? kernels->dot_int4(codes_a, codes_b, a->stride) : kernels->dot_int8(codes_a, codes_b, a->stride);
+
+    // With x = o + s*q:  |xa - xb|^2 = L*d^2 + sa^2*Qa + sb^2*Qb - 2*sa*sb*<qa,qb> + 2*d*(sa*Sa - sb*Sb), d = oa - ob
+    double sa = a->scales[index_a];
+    double sb = b->scales[index_b];
+    double d = (double)a->offsets[index_a] - b->offsets[index_b];
+    double squared = a->length * d * d
+                   + sa * sa * a->code_squares[index_a] + sb * sb * b->code_squares[index_b]
+                   - 2.0 * sa * sb * (double)dot
+                   + 2.0 * d * (sa * a->code_sums[index_a] - sb * b->code_sums[index_b]);
+    return squared > 0.0 ? sqrt(squared) : 0.0;
+}
+
+void quantized_set_free(QuantizedSet* set) {
+    mem_free(set->codes);
+    mem_free(set->scales);
+    mem_free(set->offsets);
+    mem_free(set->code_sums);
+    mem_free(set->code_squares);
+    memset(set, 0, sizeof(QuantizedSet));
+}
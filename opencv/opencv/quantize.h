@@ -0,0 +1,73 @@
+#pragma once
+
+enum QuantKind {
+    QUANT_INT8 = 1, // One byte per value
+    QUANT_INT4 = 2  // Two values per byte (low nibble first)
+};
+
+/**
+ * A set of descriptors stored as 8-bit or 4-bit codes. Every entry is calibrated on its own
+ * range: value = offset + scale * code. The per-entry sum and sum of squares of the codes are
+ * kept so distances reduce to one integer dot product on the packed codes.
+ */
+struct QuantizedSet {
+    QuantKind kind;
+    int length;          // Values per descriptor
+    int count;           // Number of entries
+    int stride;          // Bytes per entry, padded to 16 so SIMD loads never straddle entries
+    unsigned char* codes;
+    float* scales;
+    float* offsets;
+    int* code_sums;
+    int* code_squares;
+};
+
+/**
+ * Returns the number of payload bytes per descriptor (without padding or calibration data).
+ *
+ * @param kind The code width.
+ * @param length The number of values per descriptor.
+ * @return Returns the packed size in bytes.
+ */
+inline int quantized_bytes(QuantKind kind, int length) {
+    return kind == QUANT_INT4 ? (length + 1) / 2 : length;
+}
+
+/**
+ * Allocates an empty quantized set.
+ *
+ * @param set The set to initialise.
+ * @param kind The code width.
+ * @param length The number of values per descriptor (at most 32768).
+ * @param count The number of entries.
+ * @return Returns true if the set is allocated, false otherwise.
+ */
+bool quantized_set_init(QuantizedSet* set, QuantKind kind, int length, int count);
+
+/**
+ * Calibrates and stores one descriptor.
+ *
+ * @param set The set.
+ * @param index The entry to write.
+ * @param descriptor The descriptor of set->length floats.
+ */
+void quantize_entry(QuantizedSet* set, int index, const float* descriptor);
+
+/**
+ * Computes the Euclidean distance between two quantized entries of the same kind and length,
+ * unpacking the codes on the fly.
+ *
+ * @param a The first set.
+ * @param index_a The entry of the first set.
+ * @param b The second set.
+ * @param index_b The entry of the second set.
+ * @return Returns the Euclidean distance between the dequantized descriptors.
+ */
+double quantized_distance(const QuantizedSet* a, int index_a, const QuantizedSet* b, int index_b);
+
+/**
+ * Releases the memory held by a quantized set.
+ *
+ * @param set The set.
+ */
+void quantized_set_free(QuantizedSet* set);
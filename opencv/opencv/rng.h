@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+/**
+ * Small seeded random number generator (splitmix64) used wherever a descriptor
+ * stage needs reproducible random numbers, e.g. LSH hyperplanes or random projections.
+ * The same seed always produces the same sequence on every platform.
+ */
+struct Rng {
+    uint64_t state;
+    bool has_spare;
+    double spare;
+};
+
+/**
+ * Initialises the generator with the given seed.
+ *
+ * @param rng The generator to initialise.
+ * @param seed The seed value.
+ */
+inline void rng_seed(Rng* rng, uint64_t seed) {
+    rng->state = seed;
+    rng->has_spare = false;
+    rng->spare = 0.0;
+}
+
+/**
+ * Returns the next 64-bit random value.
+ *
+ * @param rng The generator.
+ * @return Returns a uniformly distributed 64-bit value.
+ */
+inline uint64_t rng_next_u64(Rng* rng) {
+    uint64_t z = (rng->state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Returns a uniformly distributed value in (0, 1).
+ *
+ * @param rng The generator.
+ * @return Returns a value strictly between 0 and 1.
+ */
+inline double rng_next_uniform(Rng* rng) {
+    return ((rng_next_u64(rng) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Returns a standard normally distributed value (Box-Muller transform).
+ *
+ * @param rng The generator.
+ * @return Returns a sample from N(0, 1).
+ */
+inline double rng_next_gaussian(Rng* rng) {
+    if (rng->has_spare) {
+        rng->has_spare = false;
+        return rng->spare;
+    }
+    double u1 = rng_next_uniform(rng);
+    double u2 = rng_next_uniform(rng);
+    double radius = sqrt(-2.0 * log(u1));
+    double angle = 6.283185307179586 * u2;
+    rng->spare = radius * sin(angle);
+    rng->has_spare = true;
+    return radius * cos(angle);
+}
@@ -0,0 +1,708 @@
+#include "simd_kernels.h"
+#include "haar_cascade.h"
+
+#include <math.h>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#ifdef SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+#define SQUARED_FLUSH_STEPS 4096 // 32-bit lanes gain at most 2 * 2 * 255^2 per step of the squared distances
+
+unsigned long long squared_distance_u8_scalar(const unsigned char* a, const unsigned char* b, int length) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < length; i++) {
+        int d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+unsigned long long absolute_distance_u8_scalar(const unsigned char* a, const unsigned char* b, int length) {
+    unsigned long long sum = 0;
+    for (int i = 0; i < length; i++) {
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sum;
+}
+
+float squared_distance_f32_scalar(const float* a, const float* b, int length) {
+    float sum = 0.0f;
+    for (int i = 0; i < length; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void convolve_row_scalar(const unsigned char* center, int count, const int* offsets, const float* weights,
+                         int taps, unsigned char* out) {
+    for (int i = 0; i < count; i++) {
+        float sum = 0.0;
+        for (int t = 0; t < taps; t++) {
+            sum += weights[t] * center[i + offsets[t]];
+        }
+        out[i] = (unsigned char)(fmin(fmax(sum, 0), 255));
+    }
+}
+
+int hamming_distance_scalar(const uint64_t* a, const uint64_t* b, int words) {
+    // Bit-parallel count: without POPCNT, __builtin_popcountll would be a library call per word
+    int distance = 0;
+    for (int i = 0; i < words; i++) {
+        uint64_t x = a[i] ^ b[i];
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        distance += (int)((x * 0x0101010101010101ULL) >> 56);
+    }
+    return distance;
+}
+
+long long dot_int8_scalar(const unsigned char* a, const unsigned char* b, int length) {
+    long long dot = 0;
+    for (int i = 0; i < length; i++) {
+        dot += a[i] * b[i];
+    }
+    return dot;
+}
+
+long long dot_int4_scalar(const unsigned char* a, const unsigned char* b, int length) {
+    long long dot = 0;
+    for (int i = 0; i < length; i++) {
+        dot += (a[i] & 0x0F) * (b[i] & 0x0F) + (a[i] >> 4) * (b[i] >> 4);
+    }
+    return dot;
+}
+
+void dot4_f32_scalar(const float* rows, int stride, const float* x, int length, float* sums) {
+    const float* m0 = rows;
+    const float* m1 = m0 + stride;
+    const float* m2 = m1 + stride;
+    const float* m3 = m2 + stride;
+    sums[0] = sums[1] = sums[2] = sums[3] = 0.0f;
+    for (int d = 0; d < length; d++) {
+        sums[0] += m0[d] * x[d];
+        sums[1] += m1[d] * x[d];
+        sums[2] += m2[d] * x[d];
+        sums[3] += m3[d] * x[d];
+    }
+}
+
+void decimate_row_2x_scalar(const unsigned char* top, const unsigned char* bottom, int out_width, unsigned char* out) {
+    for (int x = 0; x < out_width; x++) {
+        out[x] = (unsigned char)((top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) >> 2);
+    }
+}
+
+void squared_distance_tiles_u8_scalar(const unsigned char* a, const unsigned char* b, int stride, int tile, int tiles,
+                                      unsigned long long* sums) {
+    for (int t = 0; t < tiles; t++) {
+        unsigned long long sum = 0;
+        for (int row = 0; row < tile; row++) {
+            sum += squared_distance_u8_scalar(a + row * stride + t * tile, b + row * stride + t * tile, tile);
+        }
+        sums[t] = sum;
+    }
+}
+
+/**
+ * Evaluates the features of a stage on one window.
+ *
+ * @param features The features of the stage.
+ * @param rects The resolved rectangles of the features.
+ * @param feature_count The number of features.
+ * @param base The integral table at the window origin.
+ * @param inverse_norm The window normalisation.
+ * @return Returns the stage sum.
+ */
+static float haar_window_scalar(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count,
+                                const unsigned int* base, float inverse_norm) {
+    float stage_sum = 0.0f;
+    for (int f = 0; f < feature_count; f++) {
+        const HaarFeature& feature = features[f];
+        const HaarRectOffsets* rect = rects + f * HAAR_MAX_RECTS;
+        float value = 0.0f;
+        for (int r = 0; r < feature.rect_count; r++) {
+            int sum = (int)(base[rect[r].bottom_right] - base[rect[r].bottom_left] - base[rect[r].top_right] + base[rect[r].top_left]);
+            value += rect[r].weight * sum;
+        }
+        stage_sum += value * inverse_norm < feature.threshold ? feature.left_value : feature.right_value;
+    }
+    return stage_sum;
+}
+
+void haar_stage_scalar(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count, const unsigned int* table,
+                       const int* origins, const float* norms, int windows, float* stage_sums) {
+    for (int i = 0; i < windows; i++) {
+        stage_sums[i] = haar_window_scalar(features, rects, feature_count, table + origins[i], norms[i]);
+    }
+}
+
+// The vector convolutions keep one lane per output pixel and add the taps in the scalar order, so
+// every lane rounds exactly like convolve_row_scalar(). A row that is not a multiple of the vector
+// width ends with a block overlapping the previous one, which writes the same values again.
+
+#ifdef SIMD_X86
+unsigned long long squared_distance_u8_sse2(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    unsigned long long sum = 0;
+
+    // |a - b| via saturating subtraction both ways, widened to 16 bits and squared with madd
+    const __m128i zero = _mm_setzero_si128();
+    while (i + 16 <= length) {
+        int block_end = i + 16 * SQUARED_FLUSH_STEPS < length ? i + 16 * SQUARED_FLUSH_STEPS : length;
+        __m128i acc = _mm_setzero_si128();
+        for (; i + 16 <= block_end; i += 16) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i low = _mm_unpacklo_epi8(diff, zero);
+            __m128i high = _mm_unpackhi_epi8(diff, zero);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(low, low));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(high, high));
+        }
+        unsigned int lanes[4];
+        _mm_storeu_si128((__m128i*)lanes, acc);
+        sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + squared_distance_u8_scalar(a + i, b + i, length - i);
+}
+
+unsigned long long absolute_distance_u8_sse2(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+
+    // psadbw sums 8 absolute differences into each 64-bit half, which cannot overflow
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    unsigned long long halves[2];
+    _mm_storeu_si128((__m128i*)halves, acc);
+    return halves[0] + halves[1] + absolute_distance_u8_scalar(a + i, b + i, length - i);
+}
+
+float squared_distance_f32_sse2(const float* a, const float* b, int length) {
+    int i = 0;
+
+    // Two independent accumulators hide the add latency
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= length; i += 8) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < length; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void convolve_row_sse2(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out) {
+    if (count < 8) {
+        convolve_row_scalar(center, count, offsets, weights, taps, out);
+        return;
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 low = _mm_setzero_ps();
+    const __m128 high = _mm_set1_ps(255.0f);
+    for (int i = 0; i < count; i += 8) {
+        int x = i + 8 <= count ? i : count - 8;
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (int t = 0; t < taps; t++) {
+            __m128i pixels = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(center + x + offsets[t])), zero);
+            __m128 weight = _mm_set1_ps(weights[t]);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpacklo_epi16(pixels, zero))));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_unpackhi_epi16(pixels, zero))));
+        }
+        __m128i values0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum0, low), high));
+        __m128i values1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum1, low), high));
+        __m128i packed = _mm_packs_epi32(values0, values1);
+        _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(packed, packed));
+    }
+}
+
+long long dot_int8_sse2(const unsigned char* a, const unsigned char* b, int length) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_int8_scalar(a + i, b + i, length - i);
+}
+
+long long dot_int4_sse2(const unsigned char* a, const unsigned char* b, int length) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    __m128i acc = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        __m128i a_low = _mm_and_si128(va, mask);
+        __m128i b_low = _mm_and_si128(vb, mask);
+        __m128i a_high = _mm_and_si128(_mm_srli_epi16(va, 4), mask);
+        __m128i b_high = _mm_and_si128(_mm_srli_epi16(vb, 4), mask);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(a_low, zero), _mm_unpacklo_epi8(b_low, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(a_low, zero), _mm_unpackhi_epi8(b_low, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpacklo_epi8(a_high, zero), _mm_unpacklo_epi8(b_high, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_unpackhi_epi8(a_high, zero), _mm_unpackhi_epi8(b_high, zero)));
+    }
+    int lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return (long long)lanes[0] + lanes[1] + lanes[2] + lanes[3] + dot_int4_scalar(a + i, b + i, length - i);
+}
+
+void dot4_f32_sse2(const float* rows, int stride, const float* x, int length, float* sums) {
+    const float* m0 = rows;
+    const float* m1 = m0 + stride;
+    const float* m2 = m1 + stride;
+    const float* m3 = m2 + stride;
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+    __m128 acc3 = _mm_setzero_ps();
+    int d = 0;
+    for (; d + 4 <= length; d += 4) {
+        __m128 v = _mm_loadu_ps(x + d);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(m0 + d), v));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(m1 + d), v));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(m2 + d), v));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(m3 + d), v));
+    }
+    // Transpose-and-add reduces the four accumulators to one vector of row sums
+    _MM_TRANSPOSE4_PS(acc0, acc1, acc2, acc3);
+    _mm_storeu_ps(sums, _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+    for (; d < length; d++) {
+        sums[0] += m0[d] * x[d];
+        sums[1] += m1[d] * x[d];
+        sums[2] += m2[d] * x[d];
+        sums[3] += m3[d] * x[d];
+    }
+}
+
+void decimate_row_2x_sse2(const unsigned char* top, const unsigned char* bottom, int out_width, unsigned char* out) {
+    // 32 input columns give 16 outputs: even and odd bytes are split into 16-bit lanes and summed
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i rounding = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= out_width; x += 16) {
+        __m128i sums[2];
+        for (int half = 0; half < 2; half++) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(top + 2 * x + 16 * half));
+            __m128i b = _mm_loadu_si128((const __m128i*)(bottom + 2 * x + 16 * half));
+            __m128i sum = _mm_add_epi16(_mm_and_si128(a, low_bytes), _mm_srli_epi16(a, 8));
+            sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(b, low_bytes), _mm_srli_epi16(b, 8)));
+            sums[half] = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+        }
+        _mm_storeu_si128((__m128i*)(out + x), _mm_packus_epi16(sums[0], sums[1]));
+    }
+    decimate_row_2x_scalar(top + 2 * x, bottom + 2 * x, out_width - x, out + x);
+}
+
+void squared_distance_tiles_u8_sse2(const unsigned char* a, const unsigned char* b, int stride, int tile, int tiles,
+                                    unsigned long long* sums) {
+    if (tile != 8) {
+        squared_distance_tiles_u8_scalar(a, b, stride, tile, tiles, sums);
+        return;
+    }
+    // 16 bytes span two tiles: the low half of the squared differences is one, the high half the next.
+    // A tile is at most 64 * 255^2, so 32-bit lanes cannot overflow
+    const __m128i zero = _mm_setzero_si128();
+    int t = 0;
+    for (; t + 2 <= tiles; t += 2) {
+        __m128i low_sum = _mm_setzero_si128();
+        __m128i high_sum = _mm_setzero_si128();
+        for (int row = 0; row < 8; row++) {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + row * stride + t * 8));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + row * stride + t * 8));
+            __m128i diff = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+            __m128i low = _mm_unpacklo_epi8(diff, zero);
+            __m128i high = _mm_unpackhi_epi8(diff, zero);
+            low_sum = _mm_add_epi32(low_sum, _mm_madd_epi16(low, low));
+            high_sum = _mm_add_epi32(high_sum, _mm_madd_epi16(high, high));
+        }
+        unsigned int lanes[8];
+        _mm_storeu_si128((__m128i*)lanes, low_sum);
+        _mm_storeu_si128((__m128i*)(lanes + 4), high_sum);
+        sums[t] = (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        sums[t + 1] = (unsigned long long)lanes[4] + lanes[5] + lanes[6] + lanes[7];
+    }
+    squared_distance_tiles_u8_scalar(a + t * 8, b + t * 8, stride, 8, tiles - t, sums + t);
+}
+
+void haar_stage_sse2(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count, const unsigned int* table,
+                     const int* origins, const float* norms, int windows, float* stage_sums) {
+    // Four windows per batch: rectangle sums are gathered, then thresholds, votes and stage sums are vectorised
+    int i = 0;
+    for (; i + 4 <= windows; i += 4) {
+        __m128 inverse_norm = _mm_loadu_ps(norms + i);
+        __m128 stage_sum = _mm_setzero_ps();
+        for (int f = 0; f < feature_count; f++) {
+            const HaarFeature& feature = features[f];
+            const HaarRectOffsets* rect = rects + f * HAAR_MAX_RECTS;
+            __m128 value = _mm_setzero_ps();
+            for (int r = 0; r < feature.rect_count; r++) {
+                int sums[4];
+                for (int lane = 0; lane < 4; lane++) {
+                    const unsigned int* base = table + origins[i + lane];
+                    sums[lane] = (int)(base[rect[r].bottom_right] - base[rect[r].bottom_left] - base[rect[r].top_right] + base[rect[r].top_left]);
+                }
+                __m128 rect_sum = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)sums));
+                value = _mm_add_ps(value, _mm_mul_ps(rect_sum, _mm_set1_ps(rect[r].weight)));
+            }
+            __m128 below = _mm_cmplt_ps(_mm_mul_ps(value, inverse_norm), _mm_set1_ps(feature.threshold));
+            __m128 vote = _mm_or_ps(_mm_and_ps(below, _mm_set1_ps(feature.left_value)),
+                                    _mm_andnot_ps(below, _mm_set1_ps(feature.right_value)));
+            stage_sum = _mm_add_ps(stage_sum, vote);
+        }
+        _mm_storeu_ps(stage_sums + i, stage_sum);
+    }
+    haar_stage_scalar(features, rects, feature_count, table, origins + i, norms + i, windows - i, stage_sums + i);
+}
+
+SIMD_TARGET("sse4.1")
+void convolve_row_sse41(const unsigned char* center, int count, const int* offsets, const float* weights,
+                        int taps, unsigned char* out) {
+    if (count < 8) {
+        convolve_row_scalar(center, count, offsets, weights, taps, out);
+        return;
+    }
+    const __m128 low = _mm_setzero_ps();
+    const __m128 high = _mm_set1_ps(255.0f);
+    for (int i = 0; i < count; i += 8) {
+        int x = i + 8 <= count ? i : count - 8;
+        __m128 sum0 = _mm_setzero_ps();
+        __m128 sum1 = _mm_setzero_ps();
+        for (int t = 0; t < taps; t++) {
+            // pmovzxbd widens four pixels in one instruction instead of two unpacks
+            __m128i pixels = _mm_loadl_epi64((const __m128i*)(center + x + offsets[t]));
+            __m128 weight = _mm_set1_ps(weights[t]);
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(pixels))));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(weight, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_srli_si128(pixels, 4)))));
+        }
+        __m128i values0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum0, low), high));
+        __m128i values1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(sum1, low), high));
+        __m128i packed = _mm_packus_epi32(values0, values1);
+        _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(packed, packed));
+    }
+}
+
+SIMD_TARGET("popcnt")
+int hamming_distance_popcnt(const uint64_t* a, const uint64_t* b, int words) {
+    // Four independent counts per step keep the POPCNT units busy
+    int distance = 0;
+    int i = 0;
+#if defined(_MSC_VER) && defined(_M_X64)
+    for (; i + 4 <= words; i += 4) {
+        distance += (int)(__popcnt64(a[i] ^ b[i]) + __popcnt64(a[i + 1] ^ b[i + 1])
+                        + __popcnt64(a[i + 2] ^ b[i + 2]) + __popcnt64(a[i + 3] ^ b[i + 3]));
+    }
+    for (; i < words; i++) {
+        distance += (int)__popcnt64(a[i] ^ b[i]);
+    }
+#elif defined(_MSC_VER)
+    for (; i < words; i++) {
+        uint64_t x = a[i] ^ b[i];
+        distance += (int)(__popcnt((unsigned int)x) + __popcnt((unsigned int)(x >> 32)));
+    }
+#else
+    for (; i + 4 <= words; i += 4) {
+        distance += __builtin_popcountll(a[i] ^ b[i]) + __builtin_popcountll(a[i + 1] ^ b[i + 1])
+                  + __builtin_popcountll(a[i + 2] ^ b[i + 2]) + __builtin_popcountll(a[i + 3] ^ b[i + 3]);
+    }
+    for (; i < words; i++) {
+        distance += __builtin_popcountll(a[i] ^ b[i]);
+    }
+#endif
+    return distance;
+}
+
+SIMD_TARGET("avx2")
+unsigned long long squared_distance_u8_avx2(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    unsigned long long sum = 0;
+
+    const __m256i zero = _mm256_setzero_si256();
+    while (i + 32 <= length) {
+        int block_end = i + 32 * SQUARED_FLUSH_STEPS < length ? i + 32 * SQUARED_FLUSH_STEPS : length;
+        __m256i acc = _mm256_setzero_si256();
+        for (; i + 32 <= block_end; i += 32) {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i low = _mm256_unpacklo_epi8(diff, zero);
+            __m256i high = _mm256_unpackhi_epi8(diff, zero);
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(low, low));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(high, high));
+        }
+        unsigned int lanes[8];
+        _mm256_storeu_si256((__m256i*)lanes, acc);
+        for (int l = 0; l < 8; l++) {
+            sum += lanes[l];
+        }
+    }
+    return sum + squared_distance_u8_sse2(a + i, b + i, length - i);
+}
+
+SIMD_TARGET("avx2")
+unsigned long long absolute_distance_u8_avx2(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+    unsigned long long quarters[4];
+    _mm256_storeu_si256((__m256i*)quarters, acc);
+    return quarters[0] + quarters[1] + quarters[2] + quarters[3] + absolute_distance_u8_sse2(a + i, b + i, length - i);
+}
+
+SIMD_TARGET("avx2")
+float squared_distance_f32_avx2(const float* a, const float* b, int length) {
+    int i = 0;
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= length; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+        acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+    float sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+
+    for (; i < length; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+SIMD_TARGET("avx2")
+void convolve_row_avx2(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out) {
+    if (count < 8) {
+        convolve_row_scalar(center, count, offsets, weights, taps, out);
+        return;
+    }
+    const __m256 low = _mm256_setzero_ps();
+    const __m256 high = _mm256_set1_ps(255.0f);
+    for (int i = 0; i < count; i += 8) {
+        int x = i + 8 <= count ? i : count - 8;
+        __m256 sum = _mm256_setzero_ps();
+        for (int t = 0; t < taps; t++) {
+            __m128i pixels = _mm_loadl_epi64((const __m128i*)(center + x + offsets[t]));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(pixels))));
+        }
+        __m256i values = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(sum, low), high));
+        __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+        _mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(packed, packed));
+    }
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+unsigned long long squared_distance_u8_avx512(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    unsigned long long sum = 0;
+
+    const __m512i zero = _mm512_setzero_si512();
+    while (i + 64 <= length) {
+        int block_end = i + 64 * SQUARED_FLUSH_STEPS < length ? i + 64 * SQUARED_FLUSH_STEPS : length;
+        __m512i acc = _mm512_setzero_si512();
+        for (; i + 64 <= block_end; i += 64) {
+            __m512i va = _mm512_loadu_si512((const void*)(a + i));
+            __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+            __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+            __m512i low = _mm512_unpacklo_epi8(diff, zero);
+            __m512i high = _mm512_unpackhi_epi8(diff, zero);
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(low, low));
+            acc = _mm512_add_epi32(acc, _mm512_madd_epi16(high, high));
+        }
+        unsigned int lanes[16];
+        _mm512_storeu_si512((void*)lanes, acc);
+        for (int l = 0; l < 16; l++) {
+            sum += lanes[l];
+        }
+    }
+    return sum + squared_distance_u8_avx2(a + i, b + i, length - i);
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+unsigned long long absolute_distance_u8_avx512(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    __m512i acc = _mm512_setzero_si512();
+    for (; i + 64 <= length; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void*)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void*)(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+    }
+    unsigned long long eighths[8];
+    _mm512_storeu_si512((void*)eighths, acc);
+    unsigned long long sum = 0;
+    for (int l = 0; l < 8; l++) {
+        sum += eighths[l];
+    }
+    return sum + absolute_distance_u8_avx2(a + i, b + i, length - i);
+}
+
+SIMD_TARGET("avx512f")
+float squared_distance_f32_avx512(const float* a, const float* b, int length) {
+    int i = 0;
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    for (; i + 32 <= length; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_add_ps(acc0, _mm512_mul_ps(d0, d0));
+        acc1 = _mm512_add_ps(acc1, _mm512_mul_ps(d1, d1));
+    }
+    float lanes[16];
+    _mm512_storeu_ps(lanes, _mm512_add_ps(acc0, acc1));
+    for (int width = 8; width > 0; width /= 2) { // Pairwise, like the narrower variants
+        for (int l = 0; l < width; l++) {
+            lanes[l] += lanes[l + width];
+        }
+    }
+    float sum = lanes[0];
+
+    for (; i < length; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+SIMD_TARGET("avx512f")
+void convolve_row_avx512(const unsigned char* center, int count, const int* offsets, const float* weights,
+                         int taps, unsigned char* out) {
+    if (count < 16) {
+        convolve_row_avx2(center, count, offsets, weights, taps, out);
+        return;
+    }
+    const __m512 low = _mm512_setzero_ps();
+    const __m512 high = _mm512_set1_ps(255.0f);
+    for (int i = 0; i < count; i += 16) {
+        int x = i + 16 <= count ? i : count - 16;
+        __m512 sum = _mm512_setzero_ps();
+        for (int t = 0; t < taps; t++) {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(center + x + offsets[t]));
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_set1_ps(weights[t]), _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(pixels))));
+        }
+        __m512i values = _mm512_cvttps_epi32(_mm512_min_ps(_mm512_max_ps(sum, low), high));
+        _mm_storeu_si128((__m128i*)(out + x), _mm512_cvtepi32_epi8(values));
+    }
+}
+#endif
+
+#ifdef SIMD_NEON
+unsigned long long squared_distance_u8_neon(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    unsigned long long sum = 0;
+
+    // vabd gives |a - b| directly; vmull squares into 16 bits and vpadal adds pairs into 32 bits
+    while (i + 16 <= length) {
+        int block_end = i + 16 * SQUARED_FLUSH_STEPS < length ? i + 16 * SQUARED_FLUSH_STEPS : length;
+        uint32x4_t acc = vdupq_n_u32(0);
+        for (; i + 16 <= block_end; i += 16) {
+            uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+            acc = vpadalq_u16(acc, vmull_u8(vget_low_u8(diff), vget_low_u8(diff)));
+            acc = vpadalq_u16(acc, vmull_u8(vget_high_u8(diff), vget_high_u8(diff)));
+        }
+        unsigned int lanes[4];
+        vst1q_u32(lanes, acc);
+        sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + squared_distance_u8_scalar(a + i, b + i, length - i);
+}
+
+unsigned long long absolute_distance_u8_neon(const unsigned char* a, const unsigned char* b, int length) {
+    int i = 0;
+    unsigned long long sum = 0;
+
+    // 16-bit lanes gain at most 2 * 255 per step, so they are widened every 128 steps
+    while (i + 16 <= length) {
+        int block_end = i + 16 * 128 < length ? i + 16 * 128 : length;
+        uint16x8_t acc = vdupq_n_u16(0);
+        for (; i + 16 <= block_end; i += 16) {
+            acc = vpadalq_u8(acc, vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+        }
+        unsigned int lanes[4];
+        vst1q_u32(lanes, vpaddlq_u16(acc));
+        sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+    return sum + absolute_distance_u8_scalar(a + i, b + i, length - i);
+}
+
+float squared_distance_f32_neon(const float* a, const float* b, int length) {
+    int i = 0;
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= length; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vaddq_f32(acc0, vmulq_f32(d0, d0));
+        acc1 = vaddq_f32(acc1, vmulq_f32(d1, d1));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+
+    for (; i < length; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+void convolve_row_neon(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out) {
+    if (count < 8) {
+        convolve_row_scalar(center, count, offsets, weights, taps, out);
+        return;
+    }
+    const float32x4_t low = vdupq_n_f32(0.0f);
+    const float32x4_t high = vdupq_n_f32(255.0f);
+    for (int i = 0; i < count; i += 8) {
+        int x = i + 8 <= count ? i : count - 8;
+        float32x4_t sum0 = vdupq_n_f32(0.0f);
+        float32x4_t sum1 = vdupq_n_f32(0.0f);
+        for (int t = 0; t < taps; t++) {
+            uint16x8_t pixels = vmovl_u8(vld1_u8(center + x + offsets[t]));
+            float32x4_t weight = vdupq_n_f32(weights[t]);
+            sum0 = vaddq_f32(sum0, vmulq_f32(weight, vcvtq_f32_u32(vmovl_u16(vget_low_u16(pixels)))));
+            sum1 = vaddq_f32(sum1, vmulq_f32(weight, vcvtq_f32_u32(vmovl_u16(vget_high_u16(pixels)))));
+        }
+        uint32x4_t values0 = vcvtq_u32_f32(vminq_f32(vmaxq_f32(sum0, low), high));
+        uint32x4_t values1 = vcvtq_u32_f32(vminq_f32(vmaxq_f32(sum1, low), high));
+        vst1_u8(out + x, vmovn_u16(vcombine_u16(vmovn_u32(values0), vmovn_u32(values1))));
+    }
+}
+#endif
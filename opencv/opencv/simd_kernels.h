@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+
+struct HaarFeature;
+struct HaarRectOffsets;
+
+// Instruction set variants of the kernels bound by cpu_dispatch. Every variant computes the same
+// result as the _scalar one (see CpuKernels); only the SSE2 and NEON ones may run without a
+// runtime check, the others are compiled for their instruction set with SIMD_TARGET and must
+// only be called once the processor is known to support it.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define SIMD_NEON
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa) // MSVC compiles every intrinsic without a flag
+#endif
+
+unsigned long long squared_distance_u8_scalar(const unsigned char* a, const unsigned char* b, int length);
+unsigned long long absolute_distance_u8_scalar(const unsigned char* a, const unsigned char* b, int length);
+float squared_distance_f32_scalar(const float* a, const float* b, int length);
+void convolve_row_scalar(const unsigned char* center, int count, const int* offsets, const float* weights,
+                         int taps, unsigned char* out);
+int hamming_distance_scalar(const uint64_t* a, const uint64_t* b, int words);
+long long dot_int8_scalar(const unsigned char* a, const unsigned char* b, int length);
+long long dot_int4_scalar(const unsigned char* a, const unsigned char* b, int length);
+void dot4_f32_scalar(const float* rows, int stride, const float* x, int length, float* sums);
+void decimate_row_2x_scalar(const unsigned char* top, const unsigned char* bottom, int out_width, unsigned char* out);
+void squared_distance_tiles_u8_scalar(const unsigned char* a, const unsigned char* b, int stride, int tile, int tiles,
+                                      unsigned long long* sums);
+void haar_stage_scalar(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count, const unsigned int* table,
+                       const int* origins, const float* norms, int windows, float* stage_sums);
+
+#ifdef SIMD_X86
+unsigned long long squared_distance_u8_sse2(const unsigned char* a, const unsigned char* b, int length);
+unsigned long long absolute_distance_u8_sse2(const unsigned char* a, const unsigned char* b, int length);
+float squared_distance_f32_sse2(const float* a, const float* b, int length);
+void convolve_row_sse2(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out);
+long long dot_int8_sse2(const unsigned char* a, const unsigned char* b, int length);
+long long dot_int4_sse2(const unsigned char* a, const unsigned char* b, int length);
+void dot4_f32_sse2(const float* rows, int stride, const float* x, int length, float* sums);
+void decimate_row_2x_sse2(const unsigned char* top, const unsigned char* bottom, int out_width, unsigned char* out);
+void squared_distance_tiles_u8_sse2(const unsigned char* a, const unsigned char* b, int stride, int tile, int tiles,
+                                    unsigned long long* sums);
+void haar_stage_sse2(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count, const unsigned int* table,
+                     const int* origins, const float* norms, int windows, float* stage_sums);
+
+void convolve_row_sse41(const unsigned char* center, int count, const int* offsets, const float* weights,
+                        int taps, unsigned char* out);
+
+int hamming_distance_popcnt(const uint64_t* a, const uint64_t* b, int words);
+
+unsigned long long squared_distance_u8_avx2(const unsigned char* a, const unsigned char* b, int length);
+unsigned long long absolute_distance_u8_avx2(const unsigned char* a, const unsigned char* b, int length);
+float squared_distance_f32_avx2(const float* a, const float* b, int length);
+void convolve_row_avx2(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out);
+
+unsigned long long squared_distance_u8_avx512(const unsigned char* a, const unsigned char* b, int length);
+unsigned long long absolute_distance_u8_avx512(const unsigned char* a, const unsigned char* b, int length);
+float squared_distance_f32_avx512(const float* a, const float* b, int length);
+void convolve_row_avx512(const unsigned char* center, int count, const int* offsets, const float* weights,
+                         int taps, unsigned char* out);
+#endif
+
+#ifdef SIMD_NEON
+unsigned long long squared_distance_u8_neon(const unsigned char* a, const unsigned char* b, int length);
+unsigned long long absolute_distance_u8_neon(const unsigned char* a, const unsigned char* b, int length);
+float squared_distance_f32_neon(const float* a, const float* b, int length);
+void convolve_row_neon(const unsigned char* center, int count, const int* offsets, const float* weights,
+                       int taps, unsigned char* out);
+#endif
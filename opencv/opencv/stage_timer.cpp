@@ -0,0 +1,158 @@
+#include "stage_timer.h"
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+/**
+ * Histograms of one thread. Only the owning thread writes them, so plain relaxed loads and
+ * stores suffice; the reporter may read a count one record behind.
+ */
+struct StageHistograms {
+    std::atomic<unsigned long long> counts[STAGE_COUNT][STAGE_BUCKETS];
+    std::atomic<unsigned long long> total_ns[STAGE_COUNT];
+    std::atomic<unsigned long long> max_ns[STAGE_COUNT];
+    StageHistograms* next;
+};
+
+static std::atomic<StageHistograms*> all_histograms(NULL); // Every thread's histograms, newest first
+static thread_local StageHistograms* thread_histograms = NULL;
+
+static const char* stage_names[STAGE_COUNT] = { "decode", "resize", "convolution", "match", "detect" };
+
+const char* stage_name(Stage stage) {
+    return stage_names[stage];
+}
+
+long long stage_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Returns the bucket of a duration: exact below 2^STAGE_SUB_BITS ns, then STAGE_SUB_BITS
+ * significant bits per power of two.
+ *
+ * @param value The duration in nanoseconds.
+ * @return Returns the bucket index.
+ */
+static int bucket_of(unsigned long long value) {
+    const unsigned long long sub_count = 1ull << STAGE_SUB_BITS;
+    if (value >= (1ull << STAGE_MAX_BITS)) {
+        value = (1ull << STAGE_MAX_BITS) - 1;
+    }
+    int shift = 0;
+    while ((value >> shift) >= 2 * sub_count) {
+        shift++;
+    }
+    if (value < sub_count) {
+        return (int)value;
+    }
+    return (int)((shift + 1) * sub_count + ((value >> shift) - sub_count));
+}
+
+/**
+ * Returns the largest duration falling in a bucket.
+ *
+ * @param bucket The bucket index.
+ * @return Returns the duration in nanoseconds.
+ */
+static unsigned long long bucket_upper(int bucket) {
+    const int sub_count = 1 << STAGE_SUB_BITS;
+    if (bucket < sub_count) {
+        return bucket;
+    }
+    int shift = bucket / sub_count - 1;
+    unsigned long long mantissa = bucket % sub_count + sub_count;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+/**
+ * Returns the calling thread's histograms, registering them on first use. They live until the
+ * process exits, which bounds them to one per thread of the pool.
+ *
+ * @return Returns the histograms, or NULL if memory runs out.
+ */
+static StageHistograms* own_histograms() {
+    if (!thread_histograms) {
+        StageHistograms* histograms = new (std::nothrow) StageHistograms();
+        if (!histograms) {
+            return NULL;
+        }
+        histograms->next = all_histograms.load();
+        while (!all_histograms.compare_exchange_weak(histograms->next, histograms)) {
+        }
+        thread_histograms = histograms;
+    }
+    return thread_histograms;
+}
+
+void stage_record(Stage stage, long long start) {
+    long long end = stage_now();
+    trace_span(stage_names[stage], start, end);
+    StageHistograms* histograms = own_histograms();
+    if (!histograms) {
+        return;
+    }
+    long long elapsed = end - start;
+    unsigned long long value = elapsed > 0 ? (unsigned long long)elapsed : 0;
+    std::atomic<unsigned long long>& count = histograms->counts[stage][bucket_of(value)];
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    histograms->total_ns[stage].store(histograms->total_ns[stage].load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (value > histograms->max_ns[stage].load(std::memory_order_relaxed)) {
+        histograms->max_ns[stage].store(value, std::memory_order_relaxed);
+    }
+}
+
+void stage_reset() {
+    for (StageHistograms* h = all_histograms.load(); h; h = h->next) {
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            for (int b = 0; b < STAGE_BUCKETS; b++) {
+                h->counts[stage][b].store(0, std::memory_order_relaxed);
+            }
+            h->total_ns[stage].store(0, std::memory_order_relaxed);
+            h->max_ns[stage].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void stage_report(FILE* file) {
+    static unsigned long long merged[STAGE_BUCKETS];
+    fprintf(file, "%-12s %10s %10s %10s %10s %10s %10s\n", "Stage", "Count", "Mean us", "p50 us", "p90 us", "p99 us", "Max us");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        unsigned long long count = 0;
+        unsigned long long total = 0;
+        unsigned long long max = 0;
+        for (int b = 0; b < STAGE_BUCKETS; b++) {
+            merged[b] = 0;
+        }
+        for (StageHistograms* h = all_histograms.load(); h; h = h->next) {
+            for (int b = 0; b < STAGE_BUCKETS; b++) {
+                unsigned long long n = h->counts[stage][b].load(std::memory_order_relaxed);
+                merged[b] += n;
+                count += n;
+            }
+            total += h->total_ns[stage].load(std::memory_order_relaxed);
+            unsigned long long thread_max = h->max_ns[stage].load(std::memory_order_relaxed);
+            max = thread_max > max ? thread_max : max;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        // Walk the merged buckets once, picking up each percentile as its rank is reached
+        const double quantiles[3] = { 0.50, 0.90, 0.99 };
+        unsigned long long values[3] = { max, max, max };
+        unsigned long long seen = 0;
+        int q = 0;
+        for (int b = 0; b < STAGE_BUCKETS && q < 3; b++) {
+            seen += merged[b];
+            while (q < 3 && seen >= (unsigned long long)(quantiles[q] * count + 0.5) && seen > 0) {
+                unsigned long long upper = bucket_upper(b);
+                values[q++] = upper < max ? upper : max;
+            }
+        }
+        fprintf(file, "%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[stage], count,
+                total / 1000.0 / count, values[0] / 1000.0, values[1] / 1000.0, values[2] / 1000.0, max / 1000.0);
+    }
+}
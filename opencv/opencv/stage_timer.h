@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdio.h>
+
+#define STAGE_SUB_BITS 5   // 32 linear buckets per power of two: values are kept within 3%
+#define STAGE_MAX_BITS 40  // Durations are clamped to 2^40 ns (about 18 minutes)
+#define STAGE_BUCKETS ((STAGE_MAX_BITS - STAGE_SUB_BITS + 1) << STAGE_SUB_BITS)
+
+/**
+ * Pipeline stages with their own latency histogram.
+ */
+enum Stage {
+    STAGE_DECODE,      // Image file or frame decoding
+    STAGE_RESIZE,      // Resize to SIZE x SIZE
+    STAGE_CONVOLUTION, // The four gradient filters
+    STAGE_MATCH,       // Scan of the training images or gallery
+    STAGE_DETECT,      // Whole-scene detector scan
+    STAGE_COUNT
+};
+
+/**
+ * Returns the name of a stage, as printed in the reports.
+ *
+ * @param stage The stage.
+ * @return Returns the name.
+ */
+const char* stage_name(Stage stage);
+
+/**
+ * Returns the current time for stage_record().
+ *
+ * @return Returns a steady clock reading in nanoseconds.
+ */
+long long stage_now();
+
+/**
+ * Records the duration of one run of a stage, from start until now, in the calling thread's
+ * histogram. Recording takes no lock: every thread writes its own histograms, which are only
+ * summed when reported.
+ *
+ * @param stage The stage.
+ * @param start The stage_now() reading taken when the stage began.
+ */
+void stage_record(Stage stage, long long start);
+
+/**
+ * Clears every histogram, e.g. after a warmup. Records made while it runs may be lost.
+ */
+void stage_reset();
+
+/**
+ * Prints the count, mean, p50, p90, p99 and max latency of every stage that ran, over all threads.
+ * Percentiles are the upper bound of their histogram bucket, within 3% of the true value.
+ *
+ * @param file The output file.
+ */
+void stage_report(FILE* file);
@@ -0,0 +1,306 @@
+#include "temporal.h"
+#include "cpu_dispatch.h"
+#include "distance.h"
+#include "mem_stats.h"
+#include "stage_timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Same planes, in the same order, as extract_gradients()
+static float* const temporal_filters[4] = { filter_horizontal, filter_vertical, filter_45, filter_minus_45 };
+
+bool temporal_init(TemporalCache* cache, float threshold) {
+    cache->width = 0;
+    cache->height = 0;
+    cache->threshold = threshold > 0.0f ? threshold : 0.0f;
+    cache->reference = NULL;
+    cache->gallery_count = 0;
+    cache->tile_sums = NULL;
+    cache->match.index = -1;
+    cache->match.distance = 0.0;
+    cache->scratch.memory = NULL;
+    cache->scratch.capacity = 0;
+    cache->entry = (unsigned char*)mem_alloc(STAGE_MATCH, GALLERY_ENTRY_SIZE);
+    return cache->entry != NULL;
+}
+
+/**
+ * Returns the range of frame pixels a tile covers along one axis.
+ *
+ * @param tile The tile column or row.
+ * @param length The width or height of the frame.
+ * @param begin The output first pixel.
+ * @param end The output end pixel (exclusive).
+ */
+static void tile_span(int tile, int length, int* begin, int* end) {
+    *begin = (int)((long long)tile * length / TEMPORAL_GRID);
+    *end = (int)((long long)(tile + 1) * length / TEMPORAL_GRID);
+}
+
+/**
+ * Marks every tile within a distance of a marked tile.
+ *
+ * @param in The marked tiles.
+ * @param radius_x The horizontal distance, in tiles.
+ * @param radius_y The vertical distance, in tiles.
+ * @param out The output marks.
+ */
+static void dilate_tiles(const bool* in, int radius_x, int radius_y, bool* out) {
+    for (int ty = 0; ty < TEMPORAL_GRID; ty++) {
+        for (int tx = 0; tx < TEMPORAL_GRID; tx++) {
+            bool marked = false;
+            for (int y = ty - radius_y; y <= ty + radius_y && !marked; y++) {
+                for (int x = tx - radius_x; x <= tx + radius_x && !marked; x++) {
+                    marked = x >= 0 && x < TEMPORAL_GRID && y >= 0 && y < TEMPORAL_GRID && in[y * TEMPORAL_GRID + x];
+                }
+            }
+            out[ty * TEMPORAL_GRID + tx] = marked;
+        }
+    }
+}
+
+/**
+ * A rectangle of tiles, in tile units.
+ */
+struct TileRect {
+    int left;
+    int top;
+    int right;  // Exclusive
+    int bottom; // Exclusive
+};
+
+/**
+ * Covers the marked tiles with rectangles: runs of marked tiles in a row, stacked with the runs
+ * spanning the same columns in the rows below. Every call of the resize reads whole input rows
+ * and has a setup cost, so a few large rectangles are much cheaper than many tiles.
+ *
+ * @param marked The marked tiles.
+ * @param rects The output rectangles, at least TEMPORAL_TILES / 2 of them.
+ * @return Returns the number of rectangles.
+ */
+static int cover_tiles(const bool* marked, TileRect* rects) {
+    int count = 0;
+    for (int ty = 0; ty < TEMPORAL_GRID; ty++) {
+        int row_begin = count;
+        int tx = 0;
+        while (tx < TEMPORAL_GRID) {
+            if (!marked[ty * TEMPORAL_GRID + tx]) {
+                tx++;
+                continue;
+            }
+            int run_end = tx;
+            while (run_end < TEMPORAL_GRID && marked[ty * TEMPORAL_GRID + run_end]) {
+                run_end++;
+            }
+            bool extended = false;
+            for (int r = 0; r < row_begin && !extended; r++) {
+                if (rects[r].bottom == ty && rects[r].left == tx && rects[r].right == run_end) {
+                    rects[r].bottom = ty + 1;
+                    extended = true;
+                }
+            }
+            if (!extended) {
+                TileRect rect = { tx, ty, run_end, ty + 1 };
+                rects[count++] = rect;
+            }
+            tx = run_end;
+        }
+    }
+    return count;
+}
+
+/**
+ * Returns how many tiles away from a changed frame tile the resized image may change: the resize
+ * filter reaches 2 pixels of the larger of the two images, plus the rounding of the tile bounds.
+ *
+ * @param length The width or height of the frame.
+ * @return Returns the radius in tiles.
+ */
+static int resize_radius(int length) {
+    float zoom = (float)SIZE / length;
+    float reach = 2.0f * (zoom > 1.0f ? zoom : 1.0f) + zoom + 1.0f;
+    return (int)ceilf(reach / TEMPORAL_TILE);
+}
+
+/**
+ * Recomputes the squared distance of every plane to every gallery entry over one row of tiles.
+ *
+ * @param cache The cache.
+ * @param gallery The gallery.
+ * @param tile_row The row of tiles.
+ */
+static void update_tile_sums(TemporalCache* cache, const Gallery* gallery, int tile_row) {
+    int offset = tile_row * TEMPORAL_TILE * SIZE;
+    const CpuKernels* kernels = cpu_kernels();
+    for (int g = 0; g < gallery->count; g++) {
+        const unsigned char* stored = gallery->planes + (size_t)g * GALLERY_ENTRY_SIZE;
+        for (int p = 0; p < 4; p++) {
+            const unsigned char* a = cache->entry + p * GALLERY_PLANE_SIZE + offset;
+            const unsigned char* b = stored + p * GALLERY_PLANE_SIZE + offset;
+            unsigned long long* sums = cache->tile_sums + ((size_t)g * 4 + p) * TEMPORAL_TILES + tile_row * TEMPORAL_GRID;
+            kernels->squared_distance_tiles_u8(a, b, SIZE, TEMPORAL_TILE, TEMPORAL_GRID, sums);
+        }
+    }
+}
+
+/**
+ * Picks the closest gallery entry from the tile sums, with the distance of gallery_entry_distance().
+ *
+ * @param cache The cache.
+ */
+static void update_match(TemporalCache* cache) {
+    cache->match.index = -1;
+    cache->match.distance = 0.0;
+    for (int g = 0; g < cache->gallery_count; g++) {
+        double distance = 0.0;
+        for (int p = 0; p < 4; p++) {
+            const unsigned long long* sums = cache->tile_sums + ((size_t)g * 4 + p) * TEMPORAL_TILES;
+            unsigned long long plane = 0;
+            for (int t = 0; t < TEMPORAL_TILES; t++) {
+                plane += sums[t];
+            }
+            distance += sqrt((double)plane);
+        }
+        distance /= 4.0;
+        if (cache->match.index < 0 || distance < cache->match.distance) {
+            cache->match.index = g;
+            cache->match.distance = distance;
+        }
+    }
+}
+
+bool temporal_match(TemporalCache* cache, const Gallery* gallery, const unsigned char* gray, int width, int height,
+                    GalleryMatch* match, TemporalStats* stats) {
+    size_t frame_size = (size_t)width * height;
+    bool changed[TEMPORAL_TILES];
+    bool full = cache->width != width || cache->height != height || cache->gallery_count != gallery->count;
+    if (full) {
+        // First frame, or a new frame size or gallery: nothing can be reused
+        unsigned char* reference = (unsigned char*)mem_realloc(STAGE_MATCH, cache->reference, frame_size);
+        size_t sum_count = (size_t)(gallery->count > 0 ? gallery->count : 1) * 4 * TEMPORAL_TILES;
+        unsigned long long* tile_sums = (unsigned long long*)mem_realloc(STAGE_MATCH, cache->tile_sums, sum_count * sizeof(unsigned long long));
+        if (reference) {
+            cache->reference = reference;
+        }
+        if (tile_sums) {
+            cache->tile_sums = tile_sums;
+        }
+        if (!reference || !tile_sums) {
+            cache->width = 0;
+            return false;
+        }
+        memcpy(cache->reference, gray, frame_size);
+        cache->width = width;
+        cache->height = height;
+        cache->gallery_count = gallery->count;
+        for (int t = 0; t < TEMPORAL_TILES; t++) {
+            changed[t] = true;
+        }
+    }
+    else {
+        // Compare every tile with the reference, and take the pixels of those that changed
+        for (int ty = 0; ty < TEMPORAL_GRID; ty++) {
+            int y0, y1;
+            tile_span(ty, height, &y0, &y1);
+            for (int tx = 0; tx < TEMPORAL_GRID; tx++) {
+                int x0, x1;
+                tile_span(tx, width, &x0, &x1);
+                unsigned long long difference = 0;
+                for (int y = y0; y < y1; y++) {
+                    size_t row = (size_t)y * width + x0;
+                    difference += absolute_distance_u8(gray + row, cache->reference + row, x1 - x0);
+                }
+                bool tile_changed = difference > (double)cache->threshold * (x1 - x0) * (y1 - y0);
+                changed[ty * TEMPORAL_GRID + tx] = tile_changed;
+                if (tile_changed) {
+                    for (int y = y0; y < y1; y++) {
+                        size_t row = (size_t)y * width + x0;
+                        memcpy(cache->reference + row, gray + row, x1 - x0);
+                    }
+                }
+            }
+        }
+    }
+
+    int changed_tiles = 0;
+    for (int t = 0; t < TEMPORAL_TILES; t++) {
+        changed_tiles += changed[t];
+    }
+    if (stats) {
+        stats->changed_tiles = changed_tiles;
+        stats->recomputed_tiles = 0;
+        stats->reused = changed_tiles == 0;
+    }
+    if (changed_tiles == 0) {
+        *match = cache->match;
+        return true;
+    }
+
+    // A changed frame tile spreads through the resize filter, then through the convolution
+    bool resized[TEMPORAL_TILES];
+    bool recomputed[TEMPORAL_TILES];
+    dilate_tiles(changed, resize_radius(width), resize_radius(height), resized);
+    dilate_tiles(resized, 1, 1, recomputed);
+
+    // Reuse relies on the region resize matching the full one bit for bit, which holds without FMA contraction
+    TileRect rects[TEMPORAL_TILES / 2];
+    long long start = stage_now();
+    int rect_count = cover_tiles(resized, rects);
+    for (int r = 0; r < rect_count; r++) {
+        if (!resize_gray_rect(cache->reference, width, height, 0, cache->resized, SIZE, SIZE,
+                              rects[r].left * TEMPORAL_TILE, rects[r].top * TEMPORAL_TILE,
+                              rects[r].right * TEMPORAL_TILE, rects[r].bottom * TEMPORAL_TILE, &cache->scratch)) {
+            cache->width = 0; // The cached features are now incomplete
+            return false;
+        }
+    }
+
+    stage_record(STAGE_RESIZE, start);
+
+    start = stage_now();
+    rect_count = cover_tiles(recomputed, rects);
+    for (int r = 0; r < rect_count; r++) {
+        for (int p = 0; p < 4; p++) {
+            convolve_rect(cache->resized, SIZE, SIZE, temporal_filters[p], FILTER_SIZE,
+                          rects[r].left * TEMPORAL_TILE, rects[r].top * TEMPORAL_TILE,
+                          rects[r].right * TEMPORAL_TILE, rects[r].bottom * TEMPORAL_TILE, cache->entry + p * GALLERY_PLANE_SIZE);
+        }
+    }
+    stage_record(STAGE_CONVOLUTION, start);
+
+    // Unchanged tiles of a row give their old sums again, so whole rows are recomputed
+    start = stage_now();
+    int recomputed_tiles = 0;
+    for (int ty = 0; ty < TEMPORAL_GRID; ty++) {
+        bool row_recomputed = false;
+        for (int tx = 0; tx < TEMPORAL_GRID; tx++) {
+            row_recomputed |= recomputed[ty * TEMPORAL_GRID + tx];
+            recomputed_tiles += recomputed[ty * TEMPORAL_GRID + tx];
+        }
+        if (row_recomputed) {
+            update_tile_sums(cache, gallery, ty);
+        }
+    }
+    update_match(cache);
+    stage_record(STAGE_MATCH, start);
+
+    if (stats) {
+        stats->recomputed_tiles = recomputed_tiles;
+    }
+    *match = cache->match;
+    return true;
+}
+
+void temporal_free(TemporalCache* cache) {
+    mem_free(cache->reference);
+    mem_free(cache->tile_sums);
+    mem_free(cache->entry);
+    resize_scratch_free(&cache->scratch);
+    cache->reference = NULL;
+    cache->tile_sums = NULL;
+    cache->entry = NULL;
+    cache->width = 0;
+    cache->height = 0;
+}
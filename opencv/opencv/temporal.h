@@ -0,0 +1,70 @@
+#pragma once
+
+#include "gallery.h"
+
+#define TEMPORAL_GRID 8 // Frames are compared, and features recomputed, in an 8x8 grid of tiles
+#define TEMPORAL_TILES (TEMPORAL_GRID * TEMPORAL_GRID)
+#define TEMPORAL_TILE (SIZE / TEMPORAL_GRID) // Side of a tile in the resized image
+
+/**
+ * What one frame of temporal_match() recomputed.
+ */
+struct TemporalStats {
+    int changed_tiles;    // Tiles of the frame that differ from the reference
+    int recomputed_tiles; // Tiles of the gradient planes computed again
+    bool reused;          // The previous match was returned without any work
+};
+
+/**
+ * Features and match of the previous frames of a stream, kept so the next frame only recomputes
+ * the tiles that changed. A tile of the frame is unchanged when its mean absolute difference from
+ * the reference frame is at most the threshold; the reference only takes the pixels of changed
+ * tiles, so a slow drift still adds up to a change.
+ */
+struct TemporalCache {
+    int width;                // Size of the frames, 0 before the first one
+    int height;
+    float threshold;          // Mean absolute difference per pixel a tile may have and count as unchanged
+    unsigned char* reference; // Frame the cached features were computed from
+    unsigned char resized[SIZE * SIZE];
+    unsigned char* entry;     // Packed gradient planes of the reference
+    int gallery_count;
+    unsigned long long* tile_sums; // Squared plane distance to every gallery entry, per entry, plane and tile
+    GalleryMatch match;
+    ResizeScratch scratch;
+};
+
+/**
+ * Prepares an empty cache.
+ *
+ * @param cache The cache.
+ * @param threshold The mean absolute difference per pixel below which a tile is reused, 0 to reuse identical tiles only.
+ * @return Returns true if the cache is allocated, false otherwise.
+ */
+bool temporal_init(TemporalCache* cache, float threshold);
+
+/**
+ * Matches a frame against the gallery, recomputing only the tiles that changed since the reference.
+ * With a zero threshold the match is that of extract_gradients() and gallery_search_exact(), but
+ * only where float expressions are not contracted into fused multiply-adds. That is why the
+ * CMake build passes -ffp-contract=off. With contraction, the region resize can round differently
+ * from the full one, and reused tiles then drift by a few thousandths of the distance.
+ *
+ * @param cache The cache, holding the previous frames of the stream.
+ * @param gallery The gallery, the same for every frame.
+ * @param gray The grayscale frame, tightly packed.
+ * @param width The width of the frame.
+ * @param height The height of the frame.
+ * @param match The output best match.
+ * @param stats The output record of the work done, or NULL.
+ * @return Returns true if the frame is matched, false if memory runs out.
+ */
+bool temporal_match(TemporalCache* cache, const Gallery* gallery, const unsigned char* gray, int width, int height,
+                    GalleryMatch* match, TemporalStats* stats);
+
+/**
+ * Releases the memory held by a cache.
+ *
+ * @param cache The cache.
+ */
+void temporal_free(TemporalCache* cache);
@@ -0,0 +1,21 @@
+#include "tiled_convolution.h"
+#include "image_features.h"
+#include "parallel.h"
+
+void convolution_tiled(const unsigned char* image, int width, int height, float* const* filters, int filter_count,
+                       int filter_size, unsigned char* const* results) {
+    int tile_columns = (width + CONV_TILE_WIDTH - 1) / CONV_TILE_WIDTH;
+    int tile_rows = (height + CONV_TILE_HEIGHT - 1) / CONV_TILE_HEIGHT;
+
+    parallel_for(tile_columns * tile_rows, 1, [&](int begin, int end) {
+        for (int tile = begin; tile < end; tile++) {
+            int left = (tile % tile_columns) * CONV_TILE_WIDTH;
+            int top = (tile / tile_columns) * CONV_TILE_HEIGHT;
+            int right = left + CONV_TILE_WIDTH < width ? left + CONV_TILE_WIDTH : width;
+            int bottom = top + CONV_TILE_HEIGHT < height ? top + CONV_TILE_HEIGHT : height;
+            for (int f = 0; f < filter_count; f++) {
+                convolve_rect(image, width, height, filters[f], filter_size, left, top, right, bottom, results[f]);
+            }
+        }
+    });
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#define CONV_TILE_WIDTH 256 // Output tile size: the input tile plus its halo stays in L1/L2
+#define CONV_TILE_HEIGHT 32
+
+/**
+ * Applies several filters to a large image, split into CONV_TILE_WIDTH x CONV_TILE_HEIGHT
+ * output tiles processed in parallel. Each tile reads its input plus a halo of filter_size / 2
+ * pixels around it, runs every filter while that input is still in cache, and writes straight
+ * into the shared outputs; tiles never overlap in the output, so no merging is needed. The
+ * outputs are identical to calling convolution() once per filter.
+ *
+ * @param image The grayscale image data.
+ * @param width The width of the image.
+ * @param height The height of the image.
+ * @param filters The filters to apply.
+ * @param filter_count The number of filters.
+ * @param filter_size The size of the filters (at most FILTER_SIZE).
+ * @param results The output arrays, one per filter, of the size of the image.
+ */
+void convolution_tiled(const unsigned char* image, int width, int height, float* const* filters, int filter_count,
+                       int filter_size, unsigned char* const* results);
@@ -0,0 +1,127 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <new>
+
+/**
+ * One finished span.
+ */
+struct TraceEvent {
+    const char* name;
+    long long begin;
+    long long end;
+};
+
+/**
+ * Ring buffer of one thread. Only the owning thread writes it.
+ */
+struct TraceRing {
+    TraceEvent events[TRACE_RING_EVENTS];
+    unsigned long long written; // Events recorded so far, including overwritten ones
+    int thread_id;              // Small sequential id, in registration order
+    char name[32];
+    TraceRing* next;
+};
+
+static std::atomic<bool> tracing(false);
+static std::atomic<TraceRing*> all_rings(NULL); // Every thread's ring, newest first
+static std::atomic<int> next_thread_id(1);
+static thread_local TraceRing* thread_ring = NULL;
+static thread_local char pending_name[32];      // Name set before the thread's first event
+
+void trace_enable(bool enabled) {
+    tracing.store(enabled, std::memory_order_relaxed);
+}
+
+bool trace_enabled() {
+    return tracing.load(std::memory_order_relaxed);
+}
+
+/**
+ * Returns the calling thread's ring, registering it on first use.
+ *
+ * @return Returns the ring, or NULL if memory runs out.
+ */
+static TraceRing* own_ring() {
+    if (!thread_ring) {
+        TraceRing* ring = new (std::nothrow) TraceRing();
+        if (!ring) {
+            return NULL;
+        }
+        ring->thread_id = next_thread_id++;
+        if (pending_name[0]) {
+            memcpy(ring->name, pending_name, sizeof(ring->name));
+        }
+        else {
+            snprintf(ring->name, sizeof(ring->name), "thread %d", ring->thread_id);
+        }
+        ring->next = all_rings.load();
+        while (!all_rings.compare_exchange_weak(ring->next, ring)) {
+        }
+        thread_ring = ring;
+    }
+    return thread_ring;
+}
+
+void trace_set_thread_name(const char* name) {
+    snprintf(pending_name, sizeof(pending_name), "%s", name);
+    if (thread_ring) {
+        memcpy(thread_ring->name, pending_name, sizeof(thread_ring->name));
+    }
+}
+
+void trace_span(const char* name, long long begin, long long end) {
+    if (!trace_enabled()) {
+        return;
+    }
+    TraceRing* ring = own_ring();
+    if (!ring) {
+        return;
+    }
+    TraceEvent* event = &ring->events[ring->written % TRACE_RING_EVENTS];
+    event->name = name;
+    event->begin = begin;
+    event->end = end;
+    ring->written++;
+}
+
+bool trace_write(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+
+    // Timestamps are made relative to the oldest event kept
+    long long origin = 0;
+    bool have_origin = false;
+    for (TraceRing* ring = all_rings.load(); ring; ring = ring->next) {
+        unsigned long long first = ring->written > TRACE_RING_EVENTS ? ring->written - TRACE_RING_EVENTS : 0;
+        for (unsigned long long e = first; e < ring->written; e++) {
+            long long begin = ring->events[e % TRACE_RING_EVENTS].begin;
+            if (!have_origin || begin < origin) {
+                origin = begin;
+                have_origin = true;
+            }
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first_event = true;
+    for (TraceRing* ring = all_rings.load(); ring; ring = ring->next) {
+        fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}",
+                first_event ? "" : ",\n", ring->thread_id, ring->name);
+        first_event = false;
+        unsigned long long first = ring->written > TRACE_RING_EVENTS ? ring->written - TRACE_RING_EVENTS : 0;
+        for (unsigned long long e = first; e < ring->written; e++) {
+            const TraceEvent* event = &ring->events[e % TRACE_RING_EVENTS];
+            // Complete ("X") events: a begin and an end in one record, in microseconds
+            fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"name\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}",
+                    ring->thread_id, event->name, (event->begin - origin) / 1000.0, (event->end - event->begin) / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    bool written = ferror(file) == 0;
+    return fclose(file) == 0 && written;
+}
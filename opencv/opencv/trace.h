@@ -0,0 +1,43 @@
+#pragma once
+
+#define TRACE_RING_EVENTS 65536 // Events kept per thread; older ones are overwritten
+
+/**
+ * Starts or stops recording trace events. Recording is off until enabled, and then costs
+ * one store into the calling thread's ring buffer per event.
+ *
+ * @param enabled Whether events are recorded.
+ */
+void trace_enable(bool enabled);
+
+/**
+ * Returns whether trace events are being recorded.
+ *
+ * @return Returns true while tracing is enabled.
+ */
+bool trace_enabled();
+
+/**
+ * Names the calling thread in the trace.
+ *
+ * @param name The name, copied (at most 31 characters are kept).
+ */
+void trace_set_thread_name(const char* name);
+
+/**
+ * Records a finished span of the calling thread, if tracing is enabled.
+ *
+ * @param name The span name, a string literal or other string that outlives the trace.
+ * @param begin The stage_now() reading when the span began.
+ * @param end The stage_now() reading when the span ended.
+ */
+void trace_span(const char* name, long long begin, long long end);
+
+/**
+ * Writes every recorded event as Chrome trace JSON, loadable in chrome://tracing or Perfetto.
+ * Threads must not record while it runs.
+ *
+ * @param path The output file.
+ * @return Returns true if the file is written, false otherwise.
+ */
+bool trace_write(const char* path);
@@ -0,0 +1,49 @@
+#!/bin/sh
+# Profile-guided, link-time optimised release build.
+#
+# 1. Builds a plain Release + LTO baseline in build-lto/.
+# 2. Builds an instrumented copy in build-pgo/ and trains it on the bundled face corpus with the
+#    kernel benchmarks and the command line tool.
+# 3. Rebuilds build-pgo/ with the profiles and LTO, then runs the kernel benchmarks of both
+#    builds and reports the speedup of every benchmark over the baseline.
+#
+# Usage: scripts/pgo_build.sh [extra cmake arguments, e.g. -DIMAGEDETECTION_ARCH=native]
+# BENCH_ARGS holds extra bench_kernels arguments for the comparison, e.g. BENCH_ARGS="--filter decode".
+set -e
+
+source_dir=$(cd "$(dirname "$0")/.." && pwd)
+base_dir="$source_dir/build-lto"
+pgo_dir="$source_dir/build-pgo"
+profile_dir="$pgo_dir/pgo-profiles"
+jobs=$(nproc 2>/dev/null || echo 4)
+
+echo "== Baseline: Release + LTO in $base_dir"
+cmake -S "$source_dir" -B "$base_dir" -DCMAKE_BUILD_TYPE=Release -DIMAGEDETECTION_LTO=ON -DIMAGEDETECTION_PGO=OFF "$@"
+cmake --build "$base_dir" -j"$jobs"
+
+echo "== Instrumented build in $pgo_dir"
+rm -rf "$profile_dir"
+cmake -S "$source_dir" -B "$pgo_dir" -DCMAKE_BUILD_TYPE=Release -DIMAGEDETECTION_LTO=ON -DIMAGEDETECTION_PGO=GENERATE \
+      -DIMAGEDETECTION_PGO_DIR="$profile_dir" "$@"
+cmake --build "$pgo_dir" -j"$jobs"
+
+# The tools read face/, input.jpg and image.png from the working directory
+echo "== Training on the bundled corpus"
+cd "$source_dir"
+"$pgo_dir/bench_kernels" --reps 1 --min-time 0.02 --warmup 0 > /dev/null
+"$pgo_dir/opencv" > /dev/null
+"$pgo_dir/opencv" --cascade 3 > /dev/null
+"$pgo_dir/opencv" --detect image.png > /dev/null
+if ls "$profile_dir"/*.profraw > /dev/null 2>&1; then
+    # Clang writes raw profiles, merged into the one file it reads
+    llvm-profdata merge -o "$profile_dir/default.profdata" "$profile_dir"/*.profraw
+fi
+
+echo "== Optimised build in $pgo_dir"
+cmake -S "$source_dir" -B "$pgo_dir" -DIMAGEDETECTION_PGO=USE
+cmake --build "$pgo_dir" -j"$jobs"
+
+echo "== Baseline benchmarks"
+"$base_dir/bench_kernels" $BENCH_ARGS --save "$pgo_dir/baseline.txt"
+echo "== PGO + LTO benchmarks"
+"$pgo_dir/bench_kernels" $BENCH_ARGS --baseline "$pgo_dir/baseline.txt"
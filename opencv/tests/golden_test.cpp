@@ -0,0 +1,988 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "stb_image.h"
+#include "stb_image_resize.h"
+#include "image_features.h"
+#include "cpu_dispatch.h"
+#include "detector.h"
+#include "tiled_convolution.h"
+#include "binary_hash.h"
+#include "distance.h"
+#include "gallery.h"
+#include "haar_cascade.h"
+#include "integral_image.h"
+#include "nms.h"
+#include "projection.h"
+#include "pyramid.h"
+#include "quantize.h"
+#include "temporal.h"
+#include "rng.h"
+
+#define GOLDEN_SEED 20240917u
+#define GOLDEN_FACES 10       // face/face1.jpg ... face/face10.jpg, the training images of the tool
+#define GOLDEN_RANDOM_CASES 200
+
+// Run from the directory holding face/, as ctest does
+static const char* golden_queries[] = { "face/face8.jpg", "face/image.jpg", "face/image2.jpg" };
+#define GOLDEN_QUERIES (int)(sizeof(golden_queries) / sizeof(golden_queries[0]))
+
+// Training images from closest to farthest for every query (1-based, as the tool prints them),
+// recorded from the original float convolution and double compare_images()
+static const int golden_rankings[GOLDEN_QUERIES][GOLDEN_FACES] = {
+    { 8, 10, 7, 6, 4, 5, 3, 9, 2, 1 },
+    { 10, 7, 8, 6, 4, 2, 5, 1, 9, 3 },
+    { 8, 10, 2, 7, 6, 5, 9, 4, 3, 1 },
+};
+
+static float* golden_filters[4] = { filter_horizontal, filter_vertical, filter_45, filter_minus_45 };
+static int failures = 0;
+static const char* golden_level = NULL; // Dispatch level under test, printed with the failures
+
+/**
+ * Records the outcome of one check, printing the failures.
+ *
+ * @param passed Whether the check passed.
+ * @param test The test the check belongs to.
+ * @param detail What was checked, printed on failure.
+ * @return Returns passed.
+ */
+static bool check(bool passed, const char* test, const char* detail) {
+    if (!passed) {
+        printf("FAIL %s%s%s: %s\n", test, golden_level ? " at " : "", golden_level ? golden_level : "", detail);
+        failures++;
+    }
+    return passed;
+}
+
+/**
+ * Fills a buffer with random bytes.
+ *
+ * @param rng The random generator.
+ * @param data The buffer.
+ * @param length The number of bytes.
+ */
+static void fill_random(Rng* rng, unsigned char* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (unsigned char)rng_next_u64(rng);
+    }
+}
+
+/**
+ * Returns a random integer in [low, high].
+ *
+ * @param rng The random generator.
+ * @param low The smallest value.
+ * @param high The largest value.
+ * @return Returns the value.
+ */
+static int random_between(Rng* rng, int low, int high) {
+    return low + (int)(rng_next_u64(rng) % (unsigned long long)(high - low + 1));
+}
+
+/**
+ * The original convolution: every tap of the filter, float sums, clamped; the border is left alone.
+ */
+static void reference_convolution(const unsigned char* image, int width, int height, const float* filter, int filter_size,
+                                  unsigned char* result) {
+    int offset = filter_size / 2;
+    for (int y = offset; y < height - offset; y++) {
+        for (int x = offset; x < width - offset; x++) {
+            float sum = 0.0;
+            for (int fy = 0; fy < filter_size; fy++) {
+                for (int fx = 0; fx < filter_size; fx++) {
+                    int pixel = image[(y + fy - offset) * width + (x + fx - offset)];
+                    sum += filter[fy * filter_size + fx] * pixel;
+                }
+            }
+            result[y * width + x] = (unsigned char)(fmin(fmax(sum, 0), 255));
+        }
+    }
+}
+
+/**
+ * The original compare_images(): a double sum of pow() squares.
+ */
+static double reference_compare(const unsigned char* a, const unsigned char* b, int length) {
+    double distance = 0.0;
+    for (int i = 0; i < length; i++) {
+        distance += pow((double)(a[i] - b[i]), 2);
+    }
+    return sqrt(distance);
+}
+
+/**
+ * The original feature extraction: stbi_load(), stbir_resize_uint8() and the reference convolution.
+ *
+ * @param path The image file.
+ * @param entry The output packed entry of GALLERY_ENTRY_SIZE bytes, zero on the border.
+ * @return Returns true if the image is decoded, false otherwise.
+ */
+static bool reference_features(const char* path, unsigned char* entry) {
+    int width, height, channels;
+    unsigned char* gray = stbi_load(path, &width, &height, &channels, 1);
+    if (!gray) {
+        return false;
+    }
+    unsigned char resized[SIZE * SIZE];
+    stbir_resize_uint8(gray, width, height, 0, resized, SIZE, SIZE, 0, 1);
+    stbi_image_free(gray);
+    memset(entry, 0, GALLERY_ENTRY_SIZE);
+    for (int p = 0; p < 4; p++) {
+        reference_convolution(resized, SIZE, SIZE, golden_filters[p], FILTER_SIZE, entry + p * GALLERY_PLANE_SIZE);
+    }
+    return true;
+}
+
+/**
+ * convolution() and convolve_rect() against the original loop, on random images and rectangles.
+ */
+static void test_convolution(Rng* rng) {
+    const char* test = "convolution";
+    char detail[160];
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int width = c == 0 ? SIZE : random_between(rng, 1, 97);
+        int height = c == 0 ? SIZE : random_between(rng, 1, 97);
+        std::vector<unsigned char> image((size_t)width * height);
+        fill_random(rng, image.data(), image.size());
+        const float* filter = golden_filters[c % 4];
+        std::vector<unsigned char> expected(image.size(), 0);
+        std::vector<unsigned char> actual(image.size(), 0xCD);
+        reference_convolution(image.data(), width, height, filter, FILTER_SIZE, expected.data());
+        convolution(image.data(), width, height, (float*)filter, FILTER_SIZE, actual.data());
+        snprintf(detail, sizeof(detail), "%dx%d image, filter %d differs", width, height, c % 4);
+        if (!check(expected == actual, test, detail)) {
+            continue;
+        }
+
+        // One rectangle must come out as in the full result, and nothing else may be written
+        int left = random_between(rng, 0, width - 1);
+        int top = random_between(rng, 0, height - 1);
+        int right = random_between(rng, left + 1, width);
+        int bottom = random_between(rng, top + 1, height);
+        std::vector<unsigned char> rect(image.size(), 0xCD);
+        convolve_rect(image.data(), width, height, filter, FILTER_SIZE, left, top, right, bottom, rect.data());
+        bool same = true;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                bool inside = x >= left && x < right && y >= top && y < bottom;
+                unsigned char want = inside ? expected[(size_t)y * width + x] : 0xCD;
+                same &= rect[(size_t)y * width + x] == want;
+            }
+        }
+        snprintf(detail, sizeof(detail), "%dx%d image, rectangle %d,%d-%d,%d differs", width, height, left, top, right, bottom);
+        check(same, test, detail);
+    }
+}
+
+/**
+ * convolution_tiled() against the original loop, on images spanning several tiles.
+ */
+static void test_tiled_convolution(Rng* rng) {
+    const char* test = "tiled_convolution";
+    char detail[160];
+    for (int c = 0; c < 12; c++) {
+        int width = random_between(rng, 1, 3 * CONV_TILE_WIDTH);
+        int height = random_between(rng, 1, 4 * CONV_TILE_HEIGHT);
+        std::vector<unsigned char> image((size_t)width * height);
+        fill_random(rng, image.data(), image.size());
+        std::vector<unsigned char> planes[4];
+        unsigned char* results[4];
+        for (int p = 0; p < 4; p++) {
+            planes[p].assign(image.size(), 0);
+            results[p] = planes[p].data();
+        }
+        convolution_tiled(image.data(), width, height, golden_filters, 4, FILTER_SIZE, results);
+        for (int p = 0; p < 4; p++) {
+            std::vector<unsigned char> expected(image.size(), 0);
+            reference_convolution(image.data(), width, height, golden_filters[p], FILTER_SIZE, expected.data());
+            snprintf(detail, sizeof(detail), "%dx%d image, filter %d differs", width, height, p);
+            check(expected == planes[p], test, detail);
+        }
+    }
+}
+
+/**
+ * The SIMD distance kernels against scalar sums, at every alignment and length, plus the
+ * double and float distances against their original formulas.
+ */
+static void test_distances(Rng* rng) {
+    const char* test = "distances";
+    char detail[160];
+    std::vector<unsigned char> a(GALLERY_ENTRY_SIZE + 64);
+    std::vector<unsigned char> b(GALLERY_ENTRY_SIZE + 64);
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        fill_random(rng, a.data(), a.size());
+        fill_random(rng, b.data(), b.size());
+        int length = c < 70 ? c : random_between(rng, 0, GALLERY_ENTRY_SIZE);
+        int offset_a = random_between(rng, 0, 63);
+        int offset_b = random_between(rng, 0, 63);
+        const unsigned char* pa = a.data() + offset_a;
+        const unsigned char* pb = b.data() + offset_b;
+        unsigned long long squared = 0;
+        unsigned long long absolute = 0;
+        for (int i = 0; i < length; i++) {
+            int difference = pa[i] - pb[i];
+            squared += (unsigned long long)(difference * difference);
+            absolute += (unsigned long long)(difference < 0 ? -difference : difference);
+        }
+        snprintf(detail, sizeof(detail), "length %d, offsets %d and %d", length, offset_a, offset_b);
+        check(squared_distance_u8(pa, pb, length) == squared, test, detail);
+        check(absolute_distance_u8(pa, pb, length) == absolute, test, detail);
+    }
+
+    // compare_images() and gallery_entry_distance(): integer sums are exact, so so is the result
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        fill_random(rng, a.data(), GALLERY_ENTRY_SIZE);
+        fill_random(rng, b.data(), GALLERY_ENTRY_SIZE);
+        double sum = 0.0;
+        for (int p = 0; p < 4; p++) {
+            double expected = reference_compare(a.data() + p * GALLERY_PLANE_SIZE, b.data() + p * GALLERY_PLANE_SIZE, GALLERY_PLANE_SIZE);
+            sum += expected;
+            snprintf(detail, sizeof(detail), "compare_images, case %d plane %d", c, p);
+            check(compare_images(a.data() + p * GALLERY_PLANE_SIZE, b.data() + p * GALLERY_PLANE_SIZE) == expected, test, detail);
+        }
+        snprintf(detail, sizeof(detail), "gallery_entry_distance, case %d", c);
+        check(gallery_entry_distance(a.data(), b.data()) == sum / 4.0, test, detail);
+    }
+
+    // descriptor_distance() accumulates floats: bounded relative error against a double sum
+    std::vector<float> fa(1024);
+    std::vector<float> fb(1024);
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int length = random_between(rng, 1, 1024);
+        double expected = 0.0;
+        for (int i = 0; i < length; i++) {
+            fa[i] = (float)rng_next_gaussian(rng);
+            fb[i] = (float)rng_next_gaussian(rng);
+            expected += ((double)fa[i] - fb[i]) * ((double)fa[i] - fb[i]);
+        }
+        expected = sqrt(expected);
+        double actual = descriptor_distance(fa.data(), fb.data(), length);
+        snprintf(detail, sizeof(detail), "descriptor_distance, length %d: %.9g instead of %.9g", length, actual, expected);
+        check(fabs(actual - expected) <= 1e-5 * expected + 1e-6, test, detail);
+    }
+}
+
+/**
+ * hamming_distance() against a bit-by-bit count, and hamming_top_k() against a stable sort of
+ * every distance.
+ */
+static void test_hamming(Rng* rng) {
+    const char* test = "hamming";
+    char detail[160];
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int words = random_between(rng, 1, hash_words(HASH_MAX_BITS));
+        int count = random_between(rng, 1, 300);
+        std::vector<uint64_t> query(words);
+        std::vector<uint64_t> codes((size_t)count * words);
+        for (int w = 0; w < words; w++) {
+            query[w] = rng_next_u64(rng);
+        }
+        // Codes near the query, so that distances tie and the ordering of ties is exercised
+        for (size_t i = 0; i < codes.size(); i++) {
+            uint64_t flips = rng_next_u64(rng) & rng_next_u64(rng) & rng_next_u64(rng) & rng_next_u64(rng);
+            codes[i] = query[i % words] ^ (c % 2 == 0 ? flips : rng_next_u64(rng));
+        }
+
+        std::vector<int> expected(count);
+        std::vector<int> order(count);
+        for (int i = 0; i < count; i++) {
+            int distance = 0;
+            for (int bit = 0; bit < words * 64; bit++) {
+                distance += (int)(((query[bit >> 6] ^ codes[(size_t)i * words + (bit >> 6)]) >> (bit & 63)) & 1);
+            }
+            expected[i] = distance;
+            order[i] = i;
+        }
+        bool same = true;
+        for (int i = 0; i < count; i++) {
+            same &= hamming_distance(query.data(), codes.data() + (size_t)i * words, words) == expected[i];
+        }
+        snprintf(detail, sizeof(detail), "hamming_distance, %d words", words);
+        check(same, test, detail);
+
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return expected[a] < expected[b]; });
+        int k = random_between(rng, 1, count + 2);
+        std::vector<int> index(k);
+        std::vector<int> distance(k);
+        int found = hamming_top_k(query.data(), codes.data(), count, words, k, index.data(), distance.data());
+        same = found == std::min(k, count);
+        for (int i = 0; same && i < found; i++) {
+            same = index[i] == order[i] && distance[i] == expected[order[i]];
+        }
+        snprintf(detail, sizeof(detail), "hamming_top_k, top %d of %d codes of %d words", k, count, words);
+        check(same, test, detail);
+    }
+}
+
+/**
+ * projection_apply() against a double product of the centred input, within float rounding.
+ */
+static void test_projection(Rng* rng) {
+    const char* test = "projection";
+    char detail[160];
+    for (int c = 0; c < 20; c++) {
+        int input_dim = random_between(rng, 1, 1200);
+        int output_dim = random_between(rng, PROJECTION_MIN_DIM, PROJECTION_MIN_DIM + 11);
+        Projection projection;
+        if (!check(projection_init_random(&projection, input_dim, output_dim, rng_next_u64(rng)), test, "allocation failed")) {
+            continue;
+        }
+        std::vector<float> input(input_dim);
+        for (int d = 0; d < input_dim; d++) {
+            projection.mean[d] = (float)rng_next_gaussian(rng);
+            input[d] = (float)(10.0 * rng_next_gaussian(rng));
+        }
+        std::vector<float> output(output_dim);
+        projection_apply(&projection, input.data(), output.data());
+        for (int r = 0; r < output_dim; r++) {
+            double expected = 0.0;
+            double magnitude = 0.0;
+            for (int d = 0; d < input_dim; d++) {
+                double term = (double)projection.matrix[(size_t)r * input_dim + d] * ((double)input[d] - projection.mean[d]);
+                expected += term;
+                magnitude += fabs(term);
+            }
+            snprintf(detail, sizeof(detail), "%d x %d, row %d: %.9g instead of %.9g", output_dim, input_dim, r, output[r], expected);
+            if (!check(fabs(output[r] - expected) <= 1e-5 * magnitude + 1e-6, test, detail)) {
+                break;
+            }
+        }
+        projection_free(&projection);
+    }
+}
+
+/**
+ * The original stage evaluation: one window at a time, features and rectangles in order.
+ */
+static float reference_haar_window(const HaarFeature* features, const HaarRectOffsets* rects, int feature_count,
+                                   const unsigned int* base, float inverse_norm) {
+    float stage_sum = 0.0f;
+    for (int f = 0; f < feature_count; f++) {
+        float value = 0.0f;
+        for (int r = 0; r < features[f].rect_count; r++) {
+            const HaarRectOffsets& rect = rects[f * HAAR_MAX_RECTS + r];
+            int sum = (int)(base[rect.bottom_right] - base[rect.bottom_left] - base[rect.top_right] + base[rect.top_left]);
+            value += rect.weight * sum;
+        }
+        stage_sum += value * inverse_norm < features[f].threshold ? features[f].left_value : features[f].right_value;
+    }
+    return stage_sum;
+}
+
+/**
+ * The batched Haar stage kernel against one window at a time, on random stages of a random image.
+ */
+static void test_haar(Rng* rng) {
+    const char* test = "haar";
+    char detail[160];
+    const int width = 64;
+    const int height = 48;
+    const int window = 24;
+    std::vector<unsigned char> image(width * height);
+    fill_random(rng, image.data(), image.size());
+    IntegralImage integral;
+    if (!check(integral_init(&integral, image.data(), width, height), test, "allocation failed")) {
+        return;
+    }
+    int table_stride = width + 1;
+
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int feature_count = random_between(rng, 1, 12);
+        std::vector<HaarFeature> features(feature_count);
+        std::vector<HaarRectOffsets> rects(feature_count * HAAR_MAX_RECTS);
+        for (int f = 0; f < feature_count; f++) {
+            HaarFeature& feature = features[f];
+            feature.rect_count = random_between(rng, 1, HAAR_MAX_RECTS);
+            feature.threshold = (float)(0.5 * rng_next_gaussian(rng));
+            feature.left_value = (float)rng_next_gaussian(rng);
+            feature.right_value = (float)rng_next_gaussian(rng);
+            for (int r = 0; r < feature.rect_count; r++) {
+                int x = random_between(rng, 0, window - 1);
+                int y = random_between(rng, 0, window - 1);
+                HaarRectOffsets& rect = rects[f * HAAR_MAX_RECTS + r];
+                rect.top_left = y * table_stride + x;
+                rect.top_right = rect.top_left + random_between(rng, 1, window - x);
+                rect.bottom_left = rect.top_left + random_between(rng, 1, window - y) * table_stride;
+                rect.bottom_right = rect.bottom_left + (rect.top_right - rect.top_left);
+                rect.weight = (float)(2.0 * rng_next_gaussian(rng));
+            }
+        }
+
+        int windows = random_between(rng, 0, 37);
+        std::vector<int> origins(windows);
+        std::vector<float> norms(windows);
+        for (int i = 0; i < windows; i++) {
+            origins[i] = random_between(rng, 0, height - window) * table_stride + random_between(rng, 0, width - window);
+            norms[i] = 1.0f / (float)(window * window * (20.0 + 60.0 * rng_next_uniform(rng)));
+        }
+        std::vector<float> sums(windows);
+        cpu_kernels()->haar_stage(features.data(), rects.data(), feature_count, integral.sum, origins.data(), norms.data(),
+                                  windows, sums.data());
+        bool same = true;
+        for (int i = 0; i < windows; i++) {
+            same &= sums[i] == reference_haar_window(features.data(), rects.data(), feature_count, integral.sum + origins[i], norms[i]);
+        }
+        snprintf(detail, sizeof(detail), "%d features over %d windows", feature_count, windows);
+        check(same, test, detail);
+    }
+    integral_free(&integral);
+}
+
+/**
+ * decimate_2x() against the rounded mean of every 2x2 block, and pyramid_level_rect() against the
+ * levels pyramid_build() stores.
+ */
+static void test_pyramid(Rng* rng) {
+    const char* test = "pyramid";
+    char detail[160];
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int width = random_between(rng, 2, 200);
+        int height = random_between(rng, 2, 12);
+        std::vector<unsigned char> image((size_t)width * height);
+        fill_random(rng, image.data(), image.size());
+        int out_width = width / 2;
+        int out_height = height / 2;
+        std::vector<unsigned char> expected((size_t)out_width * out_height);
+        std::vector<unsigned char> actual((size_t)out_width * out_height);
+        for (int y = 0; y < out_height; y++) {
+            for (int x = 0; x < out_width; x++) {
+                const unsigned char* block = image.data() + (size_t)(2 * y) * width + 2 * x;
+                expected[(size_t)y * out_width + x] = (unsigned char)((block[0] + block[1] + block[width] + block[width + 1] + 2) / 4);
+            }
+        }
+        decimate_2x(image.data(), width, height, actual.data());
+        snprintf(detail, sizeof(detail), "decimate_2x, %dx%d image", width, height);
+        check(expected == actual, test, detail);
+    }
+
+    ResizeScratch scratch = { NULL, 0 };
+    for (int c = 0; c < 10; c++) {
+        int width = random_between(rng, SIZE, 400);
+        int height = random_between(rng, SIZE, 300);
+        float scale_step = 1.1f + 0.3f * (float)rng_next_uniform(rng);
+        std::vector<unsigned char> image((size_t)width * height);
+        fill_random(rng, image.data(), image.size());
+        Pyramid full;
+        Pyramid octaves;
+        bool built = pyramid_build(&full, image.data(), width, height, scale_step, SIZE, SIZE);
+        if (!check(built && pyramid_build_octaves(&octaves, image.data(), width, height, scale_step, SIZE, SIZE), test, "allocation failed")) {
+            pyramid_free(&full);
+            continue;
+        }
+        for (int level = 0; level < full.level_count; level++) {
+            const PyramidLevel& expected = full.levels[level];
+            int left = random_between(rng, 0, expected.width - 1);
+            int top = random_between(rng, 0, expected.height - 1);
+            int right = random_between(rng, left + 1, expected.width);
+            int bottom = random_between(rng, top + 1, expected.height);
+            int stride = right - left + random_between(rng, 0, 8);
+            std::vector<unsigned char> region((size_t)stride * (bottom - top));
+            bool same = pyramid_level_rect(&octaves, level, left, top, right, bottom, region.data(), stride, &scratch);
+            for (int y = top; same && y < bottom; y++) {
+                same = memcmp(region.data() + (size_t)(y - top) * stride, expected.pixels + (size_t)y * expected.width + left, right - left) == 0;
+            }
+            snprintf(detail, sizeof(detail), "%dx%d image, level %d, rectangle %d,%d-%d,%d differs", width, height, level, left, top, right, bottom);
+            check(same, test, detail);
+        }
+        pyramid_free(&full);
+        pyramid_free(&octaves);
+    }
+    resize_scratch_free(&scratch);
+}
+
+/**
+ * resize_gray() and resize_gray_rect() against stbir_resize_uint8().
+ */
+static void test_resize(Rng* rng) {
+    const char* test = "resize";
+    char detail[160];
+    ResizeScratch scratch = { NULL, 0 };
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int width = random_between(rng, 1, 400);
+        int height = random_between(rng, 1, 400);
+        int stride = width + (c % 3 == 0 ? random_between(rng, 1, 16) : 0);
+        std::vector<unsigned char> image((size_t)stride * height);
+        fill_random(rng, image.data(), image.size());
+        unsigned char expected[SIZE * SIZE];
+        unsigned char actual[SIZE * SIZE];
+        stbir_resize_uint8(image.data(), width, height, stride, expected, SIZE, SIZE, 0, 1);
+        bool resized = resize_gray(image.data(), width, height, stride, actual, SIZE, SIZE, &scratch);
+        snprintf(detail, sizeof(detail), "%dx%d image, stride %d differs", width, height, stride);
+        if (!check(resized && memcmp(expected, actual, sizeof(expected)) == 0, test, detail)) {
+            continue;
+        }
+
+        int left = random_between(rng, 0, SIZE - 1);
+        int top = random_between(rng, 0, SIZE - 1);
+        int right = random_between(rng, left + 1, SIZE);
+        int bottom = random_between(rng, top + 1, SIZE);
+        memset(actual, 0, sizeof(actual));
+        resized = resize_gray_rect(image.data(), width, height, stride, actual, SIZE, SIZE, left, top, right, bottom, &scratch);
+        bool same = resized;
+        for (int y = top; y < bottom; y++) {
+            same &= memcmp(expected + y * SIZE + left, actual + y * SIZE + left, right - left) == 0;
+        }
+        snprintf(detail, sizeof(detail), "%dx%d image, rectangle %d,%d-%d,%d differs", width, height, left, top, right, bottom);
+        check(same, test, detail);
+    }
+    resize_scratch_free(&scratch);
+}
+
+/**
+ * The region decoder against a crop of the full decode, on the bundled JPEG faces.
+ */
+static void test_roi_decode(Rng* rng) {
+    const char* test = "roi_decode";
+    char detail[160];
+    for (int f = 0; f < GOLDEN_FACES; f++) {
+        char path[64];
+        snprintf(path, sizeof(path), "face/face%d.jpg", f + 1);
+        FILE* file = fopen(path, "rb");
+        if (!check(file != NULL, test, path)) {
+            continue;
+        }
+        std::vector<unsigned char> bytes;
+        unsigned char chunk[4096];
+        size_t read;
+        while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            bytes.insert(bytes.end(), chunk, chunk + read);
+        }
+        fclose(file);
+
+        int width, height, channels;
+        unsigned char* full = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &width, &height, &channels, 1);
+        if (!check(full != NULL, test, path)) {
+            continue;
+        }
+        for (int c = 0; c < 20; c++) {
+            int x = random_between(rng, 0, width - 1);
+            int y = random_between(rng, 0, height - 1);
+            int w = random_between(rng, 1, width - x);
+            int h = random_between(rng, 1, height - y);
+            int roi_width, roi_height, roi_channels;
+            unsigned char* roi = stbi_load_from_memory_roi(bytes.data(), (int)bytes.size(), x, y, w, h,
+                                                           &roi_width, &roi_height, &roi_channels, 1);
+            bool same = roi && roi_width == w && roi_height == h;
+            for (int row = 0; same && row < h; row++) {
+                same = memcmp(roi + (size_t)row * w, full + (size_t)(y + row) * width + x, w) == 0;
+            }
+            snprintf(detail, sizeof(detail), "%s, region %d,%d %dx%d differs", path, x, y, w, h);
+            check(same, test, detail);
+            stbi_image_free(roi);
+        }
+        stbi_image_free(full);
+    }
+}
+
+/**
+ * Rectangle sums of the integral images against direct sums.
+ */
+static void test_integral(Rng* rng) {
+    const char* test = "integral";
+    char detail[160];
+    for (int c = 0; c < 20; c++) {
+        int width = random_between(rng, 1, 300);
+        int height = random_between(rng, 1, 300);
+        std::vector<unsigned char> image((size_t)width * height);
+        fill_random(rng, image.data(), image.size());
+        IntegralImage integral;
+        if (!check(integral_init(&integral, image.data(), width, height), test, "allocation failed")) {
+            continue;
+        }
+        for (int r = 0; r < 50; r++) {
+            int x = random_between(rng, 0, width - 1);
+            int y = random_between(rng, 0, height - 1);
+            int w = random_between(rng, 1, std::min(width - x, SIZE));
+            int h = random_between(rng, 1, std::min(height - y, SIZE));
+            unsigned int sum = 0;
+            unsigned int squared = 0;
+            for (int row = y; row < y + h; row++) {
+                for (int column = x; column < x + w; column++) {
+                    unsigned int value = image[(size_t)row * width + column];
+                    sum += value;
+                    squared += value * value;
+                }
+            }
+            snprintf(detail, sizeof(detail), "%dx%d image, rectangle %d,%d %dx%d", width, height, x, y, w, h);
+            check(integral_rect_sum(&integral, x, y, w, h) == sum && integral_rect_squared(&integral, x, y, w, h) == squared,
+                  test, detail);
+        }
+        integral_free(&integral);
+    }
+}
+
+/**
+ * Quantized distances against the float distance, within the rounding of both entries' codes.
+ */
+static void test_quantized(Rng* rng) {
+    const char* test = "quantized";
+    char detail[160];
+    QuantKind kinds[2] = { QUANT_INT8, QUANT_INT4 };
+    for (int k = 0; k < 2; k++) {
+        for (int c = 0; c < 50; c++) {
+            int length = random_between(rng, 1, 2048);
+            QuantizedSet set;
+            if (!check(quantized_set_init(&set, kinds[k], length, 2), test, "allocation failed")) {
+                continue;
+            }
+            std::vector<float> descriptors(2 * (size_t)length);
+            double spread = 0.1 + 10.0 * rng_next_uniform(rng);
+            for (size_t i = 0; i < descriptors.size(); i++) {
+                descriptors[i] = (float)(spread * rng_next_gaussian(rng));
+            }
+            quantize_entry(&set, 0, descriptors.data());
+            quantize_entry(&set, 1, descriptors.data() + length);
+            double expected = 0.0;
+            for (int i = 0; i < length; i++) {
+                double difference = (double)descriptors[i] - descriptors[length + i];
+                expected += difference * difference;
+            }
+            expected = sqrt(expected);
+            // Every value is off by at most half a step, so the distance by at most sqrt(n) half steps of each entry
+            double bound = sqrt((double)length) * (set.scales[0] + set.scales[1]) / 2.0;
+            double actual = quantized_distance(&set, 0, &set, 1);
+            snprintf(detail, sizeof(detail), "%s, length %d: %.6g instead of %.6g (bound %.3g)",
+                     kinds[k] == QUANT_INT8 ? "int8" : "int4", length, actual, expected, bound);
+            check(fabs(actual - expected) <= bound * 1.0001 + 1e-6, test, detail);
+            quantized_set_free(&set);
+        }
+    }
+}
+
+/**
+ * The original O(n^2) suppression: every box against every kept box, or for soft-NMS, every
+ * selection decaying every remaining box.
+ */
+static void reference_suppress(std::vector<Detection>& detections, const NmsOptions* options) {
+    std::vector<Detection> sorted(detections);
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Detection& a, const Detection& b) {
+        return a.distance < b.distance;
+    });
+    detections.clear();
+    int count = (int)sorted.size();
+    if (!options->soft) {
+        for (int i = 0; i < count; i++) {
+            bool suppressed = false;
+            for (const Detection& kept : detections) {
+                suppressed |= detection_iou(sorted[i], kept) > options->iou_threshold;
+            }
+            if (!suppressed) {
+                detections.push_back(sorted[i]);
+            }
+        }
+        return;
+    }
+
+    std::vector<float> weights(count, 1.0f);
+    std::vector<bool> done(count, false);
+    for (;;) {
+        int best = -1;
+        for (int i = 0; i < count; i++) {
+            if (!done[i] && (best < 0 || sorted[i].distance / weights[i] < sorted[best].distance / weights[best])) {
+                best = i;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        done[best] = true;
+        detections.push_back(sorted[best]);
+        detections.back().distance = sorted[best].distance / weights[best];
+        for (int i = 0; i < count; i++) {
+            float iou = done[i] ? 0.0f : detection_iou(sorted[best], sorted[i]);
+            if (iou > 0.0f) {
+                weights[i] *= expf(-iou * iou / options->sigma);
+                done[i] = weights[i] < options->min_weight;
+            }
+        }
+    }
+}
+
+/**
+ * Grid-bucketed hard and soft NMS against the O(n^2) reference, on clustered boxes of mixed sizes
+ * and scales with tied distances.
+ */
+static void test_nms(Rng* rng) {
+    const char* test = "nms";
+    char detail[160];
+    for (int c = 0; c < GOLDEN_RANDOM_CASES; c++) {
+        int count = random_between(rng, 1, 300);
+        float extent = (float)random_between(rng, 50, 1000);
+        // Every other pair of cases mixes small windows with boxes up to the scene size, as a pyramid does
+        int max_size = c % 4 < 2 ? 120 : (int)extent;
+        std::vector<Detection> detections(count);
+        for (int i = 0; i < count; i++) {
+            Detection& detection = detections[i];
+            detection.width = (float)random_between(rng, 8, max_size);
+            detection.height = c % 2 == 0 ? detection.width : (float)random_between(rng, 8, max_size);
+            detection.x = (float)(extent * rng_next_uniform(rng));
+            detection.y = (float)(extent * rng_next_uniform(rng));
+            detection.distance = (double)random_between(rng, 1, 50) * 100.0;
+            detection.match = i;
+            detection.level = 0;
+        }
+
+        NmsOptions options;
+        nms_default_options(&options);
+        options.soft = c % 2 == 1;
+        options.iou_threshold = (float)rng_next_uniform(rng);
+        options.sigma = 0.1f + (float)rng_next_uniform(rng);
+        std::vector<Detection> expected(detections);
+        reference_suppress(expected, &options);
+        suppress_detections(detections, &options);
+        bool same = expected.size() == detections.size();
+        for (size_t i = 0; same && i < detections.size(); i++) {
+            same = detections[i].match == expected[i].match && detections[i].distance == expected[i].distance;
+        }
+        snprintf(detail, sizeof(detail), "%s NMS of %d boxes: %d kept instead of %d", options.soft ? "soft" : "hard",
+                 count, (int)detections.size(), (int)expected.size());
+        check(same, test, detail);
+    }
+}
+
+/**
+ * Temporal reuse with a zero threshold against a full extraction and search of every frame.
+ */
+static void test_temporal(Rng* rng, const Gallery* gallery) {
+    const char* test = "temporal";
+    char detail[160];
+    int sizes[3][2] = { { 64, 64 }, { 160, 120 }, { 101, 77 } };
+    for (int s = 0; s < 3; s++) {
+        int width = sizes[s][0];
+        int height = sizes[s][1];
+        TemporalCache cache;
+        if (!check(temporal_init(&cache, 0.0f), test, "allocation failed")) {
+            continue;
+        }
+        std::vector<unsigned char> frame((size_t)width * height);
+        fill_random(rng, frame.data(), frame.size());
+        for (int f = 0; f < 30; f++) {
+            // Repaint a few random blocks, or nothing at all
+            int blocks = f % 5 == 4 ? 0 : random_between(rng, 1, 4);
+            for (int b = 0; b < blocks; b++) {
+                int x = random_between(rng, 0, width - 1);
+                int y = random_between(rng, 0, height - 1);
+                int w = random_between(rng, 1, std::min(width - x, 24));
+                int h = random_between(rng, 1, std::min(height - y, 24));
+                for (int row = y; row < y + h; row++) {
+                    fill_random(rng, frame.data() + (size_t)row * width + x, w);
+                }
+            }
+            GalleryMatch reused;
+            bool matched = temporal_match(&cache, gallery, frame.data(), width, height, &reused, NULL);
+
+            unsigned char grad[4][SIZE * SIZE];
+            unsigned char entry[GALLERY_ENTRY_SIZE];
+            unsigned char coarse[COARSE_ENTRY_SIZE];
+            extract_gradients(frame.data(), width, height, width, grad[0], grad[1], grad[2], grad[3]);
+            gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+            GalleryMatch expected;
+            gallery_search_exact(gallery, entry, 1, &expected);
+            snprintf(detail, sizeof(detail), "%dx%d frame %d: entry %d at %.6f instead of %d at %.6f", width, height, f,
+                     reused.index, reused.distance, expected.index, expected.distance);
+            check(matched && reused.index == expected.index && reused.distance == expected.distance, test, detail);
+        }
+        temporal_free(&cache);
+    }
+}
+
+/**
+ * The streamed-strip detector against whole-level scanning, for every stride up to just above a
+ * window, where consecutive strips share image rows but no final plane rows.
+ */
+static void test_detector(const Gallery* gallery) {
+    const char* test = "detector";
+    char detail[160];
+    int width, height, channels;
+    unsigned char* scene = stbi_load("image.png", &width, &height, &channels, 1);
+    if (!check(scene != NULL, test, "image.png")) {
+        return;
+    }
+    // A smaller copy keeps the stride-1 scans quick
+    int small_width = width / 4;
+    int small_height = height / 4;
+    std::vector<unsigned char> image((size_t)small_width * small_height);
+    bool resized = resize_gray(scene, width, height, width, image.data(), small_width, small_height, NULL);
+    stbi_image_free(scene);
+    if (!check(resized, test, "resize failed")) {
+        return;
+    }
+
+    auto order = [](const Detection& a, const Detection& b) {
+        if (a.level != b.level) {
+            return a.level < b.level;
+        }
+        return a.y != b.y ? a.y < b.y : a.x < b.x;
+    };
+    int budgets[2] = { 1, 48 };
+    for (int stride = 1; stride <= SIZE + 8; stride++) {
+        DetectorOptions options;
+        detector_default_options(&options);
+        options.stride = stride;
+        options.scale_step = 1.5f;
+        options.threshold = 4000.0;
+        options.cache_kb = 0;
+        std::vector<Detection> expected;
+        DetectorStats expected_stats;
+        if (!check(detect_faces(image.data(), small_width, small_height, gallery, &options, expected, &expected_stats),
+                   test, "allocation failed")) {
+            continue;
+        }
+        std::sort(expected.begin(), expected.end(), order);
+
+        for (int b = 0; b < 2; b++) {
+            options.cache_kb = budgets[b];
+            std::vector<Detection> actual;
+            DetectorStats stats;
+            bool same = detect_faces(image.data(), small_width, small_height, gallery, &options, actual, &stats)
+                     && actual.size() == expected.size() && stats.windows == expected_stats.windows
+                     && stats.pruned == expected_stats.pruned && stats.exact == expected_stats.exact;
+            std::sort(actual.begin(), actual.end(), order);
+            for (size_t i = 0; same && i < actual.size(); i++) {
+                same = actual[i].x == expected[i].x && actual[i].y == expected[i].y && actual[i].width == expected[i].width
+                    && actual[i].level == expected[i].level && actual[i].distance == expected[i].distance;
+            }
+            snprintf(detail, sizeof(detail), "stride %d, %d KB strips: %d detections instead of %d", stride, budgets[b],
+                     (int)actual.size(), (int)expected.size());
+            check(same, test, detail);
+        }
+    }
+}
+
+/**
+ * The library features of the bundled images against the original pipeline, then the ranking
+ * of every training image for the golden queries, with the exact and cascade gallery searches.
+ *
+ * @param gallery The output gallery of the training images, initialised by the caller.
+ * @return Returns true if every training image was enrolled, false otherwise.
+ */
+static bool test_rankings(Gallery* gallery) {
+    const char* test = "rankings";
+    char detail[256];
+    unsigned char grad[4][SIZE * SIZE];
+    unsigned char expected[GALLERY_ENTRY_SIZE];
+    unsigned char entry[GALLERY_ENTRY_SIZE];
+    unsigned char coarse[COARSE_ENTRY_SIZE];
+    for (int f = 0; f < GOLDEN_FACES; f++) {
+        char path[64];
+        snprintf(path, sizeof(path), "face/face%d.jpg", f + 1);
+        if (!check(reference_features(path, expected) && process_image(path, grad[0], grad[1], grad[2], grad[3]), test, path)) {
+            return false;
+        }
+        gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+        snprintf(detail, sizeof(detail), "features of %s differ from the original pipeline", path);
+        check(memcmp(expected, entry, GALLERY_ENTRY_SIZE) == 0, test, detail);
+        gallery_add(gallery, grad[0], grad[1], grad[2], grad[3]);
+    }
+
+    for (int q = 0; q < GOLDEN_QUERIES; q++) {
+        const char* path = golden_queries[q];
+        if (!check(reference_features(path, expected) && process_image(path, grad[0], grad[1], grad[2], grad[3]), test, path)) {
+            continue;
+        }
+        gallery_pack_entry(grad[0], grad[1], grad[2], grad[3], entry, coarse);
+
+        // The original scan: mean of the four compare_images() distances, in training order
+        GalleryMatch reference[GOLDEN_FACES];
+        for (int f = 0; f < GOLDEN_FACES; f++) {
+            double sum = 0.0;
+            for (int p = 0; p < 4; p++) {
+                sum += reference_compare(gallery->planes + (size_t)f * GALLERY_ENTRY_SIZE + p * GALLERY_PLANE_SIZE,
+                                         expected + p * GALLERY_PLANE_SIZE, GALLERY_PLANE_SIZE);
+            }
+            reference[f].index = f;
+            reference[f].distance = sum / 4.0;
+        }
+        std::stable_sort(reference, reference + GOLDEN_FACES, [](const GalleryMatch& a, const GalleryMatch& b) {
+            return a.distance < b.distance;
+        });
+
+        char ranking[128] = "";
+        bool golden = true;
+        for (int f = 0; f < GOLDEN_FACES; f++) {
+            snprintf(ranking + strlen(ranking), sizeof(ranking) - strlen(ranking), " %d", reference[f].index + 1);
+            golden &= reference[f].index + 1 == golden_rankings[q][f];
+        }
+        snprintf(detail, sizeof(detail), "%s ranks the training images%s", path, ranking);
+        check(golden, test, detail);
+
+        GalleryMatch exact[GOLDEN_FACES];
+        int found = gallery_search_exact(gallery, entry, GOLDEN_FACES, exact);
+        bool same = found == GOLDEN_FACES;
+        for (int f = 0; same && f < GOLDEN_FACES; f++) {
+            same = exact[f].index == reference[f].index && exact[f].distance == reference[f].distance;
+        }
+        snprintf(detail, sizeof(detail), "%s: gallery_search_exact ranks differently from the original scan", path);
+        check(same, test, detail);
+
+        // The cascade is approximate, but keeping every coarse survivor must give the exact search
+        GalleryMatch cascade[GOLDEN_FACES];
+        found = gallery_search_cascade(gallery, entry, coarse, GOLDEN_FACES, GOLDEN_FACES, cascade);
+        same = found == GOLDEN_FACES;
+        for (int f = 0; same && f < GOLDEN_FACES; f++) {
+            same = cascade[f].index == exact[f].index && cascade[f].distance == exact[f].distance;
+        }
+        snprintf(detail, sizeof(detail), "%s: gallery_search_cascade disagrees with the exact search", path);
+        check(same, test, detail);
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        printf("Usage: %s (run from the directory holding face/)\n", argv[0]);
+        return -1;
+    }
+    Rng rng;
+    rng_seed(&rng, GOLDEN_SEED);
+
+    Gallery gallery;
+    if (!gallery_init(&gallery, GOLDEN_FACES)) {
+        printf("Error allocating the gallery.\n");
+        return -1;
+    }
+    bool enrolled = test_rankings(&gallery);
+
+    // Every variant the processor can run, whatever IMAGEDETECTION_CPU selected for the rest
+    CpuLevel selected = cpu_level();
+    for (int level = 0; level < CPU_LEVEL_COUNT; level++) {
+        if (!cpu_set_level((CpuLevel)level)) {
+            continue;
+        }
+        golden_level = cpu_level_name((CpuLevel)level);
+        printf("Checking the %s kernels\n", golden_level);
+        test_convolution(&rng);
+        test_tiled_convolution(&rng);
+        test_distances(&rng);
+        test_hamming(&rng);
+        test_projection(&rng);
+        test_haar(&rng);
+        test_pyramid(&rng);
+    }
+    cpu_set_level(selected);
+    golden_level = NULL;
+
+    test_resize(&rng);
+    test_roi_decode(&rng);
+    test_integral(&rng);
+    test_quantized(&rng);
+    test_nms(&rng);
+    if (enrolled) {
+        test_temporal(&rng, &gallery);
+        test_detector(&gallery);
+    }
+    gallery_free(&gallery);
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All golden checks passed with the %s kernels\n", cpu_level_name(selected));
+    return 0;
+}